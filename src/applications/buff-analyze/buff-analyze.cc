@@ -34,8 +34,6 @@
 using namespace scuff;
 using namespace buff;
 
-#define FIBBIDATALEN 6
-
 /***************************************************************/
 /* quality factor for tetrahedron, defined as                  */
 /*  volume / ( (avg edge length) * (total surface area) )      */
@@ -133,7 +131,6 @@ void WriteCache(SWGVolume *O, int NumChunks=1, int WhichChunk=0)
 {
   FIBBICache *Cache = new FIBBICache(O->MeshFileName);
 
-  int NF     = O->NumInteriorFaces;
   Log("Writing GCache for %s", O->MeshFileName);
   if (NumChunks>1)
    LogC(" (chunk %i/%i)",WhichChunk,NumChunks);
@@ -141,39 +138,7 @@ void WriteCache(SWGVolume *O, int NumChunks=1, int WhichChunk=0)
   unsigned long M0=GetMemoryUsage() / (1<<20);
   Log("Initial memory usage: %8lu MB",M0);
 
-  int NumPairs = NF*(NF+1)/2;
-  int ChunkSize = NumPairs / NumChunks;
-  int npMin = WhichChunk*ChunkSize;
-  int npMax = npMin + ChunkSize - 1;
-  if (npMax >= NumPairs)
-   npMax=NumPairs-1;
-  int np=-1;
-  int NumRecords=0;
-#ifdef USE_OPENMP
-  int NumThreads=GetNumThreads();
-  Log("OpenMP multithreading (%i threads)",NumThreads);
-#pragma omp parallel for schedule(dynamic,1),      \
-                         reduction(+:NumRecords)   \
-                         num_threads(NumThreads)
-#endif
-  for(int nfa=0; nfa<NF; nfa++)
-   for(int nfb=nfa; nfb<NF; nfb++)
-    {
-      //if (nfb<nfa) continue;
-
-      np++;
-      if (np<npMin) continue;
-      if (np>=npMax) continue;
-
-      int ncv = CompareBFs(O, nfa, O, nfb);
-      if (ncv==0) continue;
-
-      LogPercent(np-npMin, ChunkSize, 100);
-      double Data[FIBBIDATALEN];
-      Cache->GetFIBBIData(O, nfa, O, nfb, Data);
-      NumRecords++;
-    };
-// end of multithreaded loop
+  int NumRecords=Cache->Precompute(O, NumChunks, WhichChunk);
 
   char FileName[MAXSTR];
   if (NumChunks>1)
@@ -181,12 +146,18 @@ void WriteCache(SWGVolume *O, int NumChunks=1, int WhichChunk=0)
      snprintf(FileName,MAXSTR,"%s.cache.%i.%i",
                                RemoveExtension(O->MeshFileName),
                                WhichChunk, NumChunks);
+     Cache->StoreAs(FileName, true);
    }
   else
    {
-     snprintf(FileName,MAXSTR,"%s.cache",RemoveExtension(O->MeshFileName));
+     // same location as FIBBICache::Store()
+     char *CacheDir=getenv("BUFF_CACHE_PATH");
+     if (CacheDir)
+      snprintf(FileName,MAXSTR,"%s/%s.cache",CacheDir,GetFileBase(O->MeshFileName));
+     else
+      snprintf(FileName,MAXSTR,"%s.cache",GetFileBase(O->MeshFileName));
+     Cache->StoreAs(FileName, true);
    };
-  Cache->Store(FileName);
 
   printf("Wrote %i FIBBI records to %s.\n",NumRecords,FileName);
 
@@ -199,6 +170,28 @@ void WriteCache(SWGVolume *O, int NumChunks=1, int WhichChunk=0)
 
 }
 
+/***************************************************************/
+/* combine the cache files written by separate --WriteCache    */
+/* --NumChunks N --WhichChunk n runs (or any other cache files */
+/* for the same mesh) into the single cache file for O         */
+/***************************************************************/
+void MergeCaches(SWGVolume *O, char **FileNames, int NumFiles)
+{
+  FIBBICache *Cache = new FIBBICache(O->MeshFileName);
+  int NumAdded=0;
+  for(int n=0; n<NumFiles; n++)
+   { int NumMerged=Cache->Merge(FileNames[n]);
+     if (NumMerged<0)
+      ErrExit("could not read cache file %s",FileNames[n]);
+     printf("Merged %i new FIBBI records from %s.\n",NumMerged,FileNames[n]);
+     NumAdded+=NumMerged;
+   };
+  Cache->Store(O->MeshFileName, true);
+  printf("Cache for %s now has %i FIBBI records (%i new).\n",
+          O->MeshFileName,Cache->Size(),NumAdded);
+  delete Cache;
+}
+
 /***************************************************************/
 /* report permittivity at user-specified (Omega, X, Y, Z)      */
 /***************************************************************/
@@ -298,6 +291,9 @@ int main(int argc, char *argv[])
   int PlotBF[10], nPlotBF;
   int PlotTet[10], nPlotTet;
   bool WriteGCache=false;
+  bool CompactGCache=false;
+#define MAXMERGE 1000
+  char *MergeFiles[MAXMERGE]; int nMergeFiles;
   int NumChunks=1;
   int WhichChunk=0;
   double XYZ[3]; int nXYZ=0;
@@ -317,6 +313,8 @@ int main(int argc, char *argv[])
 /**/
      {"WriteCache",         PA_BOOL,    0, 1, (void *)&WriteGCache,       0, "write cache file"},
      {"WriteGCache",        PA_BOOL,    0, 1, (void *)&WriteGCache,       0, "write cache file"},
+     {"CompactGCache",      PA_BOOL,    0, 1, (void *)&CompactGCache,     0, "merge cache journal into cache file"},
+     {"MergeGCache",        PA_STRING,  1, MAXMERGE, (void *)MergeFiles, &nMergeFiles, "merge cache file (e.g. from --WhichChunk) into the cache"},
      {"NumChunks",          PA_INT,     1, 1, (void *)&NumChunks,         0, "number of pieces into which to subdivide cache write (1)"},
      {"WhichChunk",         PA_INT,     1, 1, (void *)&WhichChunk,        0, "which piece to write (0)"},
 /**/
@@ -358,7 +356,14 @@ int main(int argc, char *argv[])
    }
   else if (MeshFile)
    { SWGVolume *O=new SWGVolume(MeshFile);
-     if (WriteGCache)
+     if (nMergeFiles>0)
+      MergeCaches(O, MergeFiles, nMergeFiles);
+     else if (CompactGCache)
+      { FIBBICache *Cache = new FIBBICache(O->MeshFileName);
+        Cache->Store(O->MeshFileName, true);
+        delete Cache;
+      }
+     else if (WriteGCache)
       WriteCache(O, NumChunks, WhichChunk);
      else
       AnalyzeVolume( O );
@@ -104,7 +104,8 @@ BNEQData *CreateBNEQData(char *GeoFile, char *TransFile, int QuantityFlags,
      if (noMate!=-1)
       BNEQD->GBlocks[no][no] = BNEQD->GBlocks[noMate][noMate];
      else 
-      BNEQD->GBlocks[no][no] = new HMatrix(NBF, NBF, LHM_COMPLEX);
+      BNEQD->GBlocks[no][no] = new HMatrix(NBF, NBF, LHM_COMPLEX,
+                                           G->VIEMatrixIsSymmetric() ? LHM_SYMMETRIC : LHM_NORMAL);
 
      for(int nop=no+1; nop<NO; nop++)
       { int NBFP = G->Objects[nop]->NumInteriorFaces;
@@ -99,6 +99,15 @@ int main(int argc, char *argv[])
   char *FileBase=0;
   bool UseExistingData=false;
 
+  /*--------------------------------------------------------------*/
+  bool HMatrixMode=false;
+  double ACATolerance=1.0e-4;
+  double SweepMemory=-1.0;
+  double GMETolerance=-1.0;
+  int GSeriesOrder=-1;
+  double GSeriesTolerance=1.0e-4;
+  double MultipoleTolerance=-1.0;
+
   /* name               type    #args  max_instances  storage           count         description*/
   OptStruct OSArray[]=
    { 
@@ -140,6 +149,14 @@ int main(int argc, char *argv[])
      {"FileBase",       PA_STRING,  1, 1,       (void *)&FileBase,   0,             "base filename for output files"},
 /**/
      {"UseExistingData", PA_BOOL,   0, 1,       (void *)&UseExistingData, 0,        "read existing data from .flux files"},
+/**/
+     {"HMatrix",        PA_BOOL,    0, 1,       (void *)&HMatrixMode,  0,           "assemble G blocks with hierarchical-matrix (ACA) compression"},
+     {"ACATolerance",   PA_DOUBLE,  1, 1,       (void *)&ACATolerance, 0,           "relative tolerance for ACA compression of far-field blocks"},
+     {"SweepMemory",    PA_DOUBLE,  1, 1,       (void *)&SweepMemory,  0,           "memory budget (MB) for geometry data retained across frequencies"},
+     {"GMETolerance",   PA_DOUBLE,  1, 1,       (void *)&GMETolerance, 0,           "target accuracy for distance-adaptive quadrature of G-matrix elements (0=fixed rules)"},
+     {"LFSeriesOrder",  PA_INT,     1, 1,       (void *)&GSeriesOrder, 0,           "use low-frequency series of this order for G blocks where accurate"},
+     {"LFSeriesTolerance", PA_DOUBLE, 1, 1,     (void *)&GSeriesTolerance, 0,       "relative error tolerance for low-frequency series"},
+     {"MultipoleTolerance", PA_DOUBLE, 1, 1,    (void *)&MultipoleTolerance, 0,     "use multipole approximation for inter-object G blocks with this relative error tolerance"},
 /**/
      {0,0,0,0,0,0,0}
    };
@@ -233,6 +250,25 @@ int main(int argc, char *argv[])
 
   SWGGeometry *G=BNEQD->G;
   BNEQD->UseExistingData = UseExistingData;
+  G->UseHMatrix = HMatrixMode;
+  SWGGeometry::ACATolerance = ACATolerance;
+  if (SweepMemory>=0.0)
+   SWGGeometry::SweepMemoryBudget = SweepMemory;
+  if (GMETolerance>=0.0)
+   SWGGeometry::QuadraturePolicy.SetTolerance(GMETolerance);
+  // a single frequency gains nothing from retaining the frequency-
+  // independent data; NumFreqs==0 means a frequency integral
+  if (NumFreqs!=1)
+   G->BeginFrequencySweep();
+  if (GSeriesOrder>=0)
+   { G->UseGSeries = true;
+     SWGGeometry::GSeriesOrder = GSeriesOrder;
+     SWGGeometry::GSeriesTolerance = GSeriesTolerance;
+   };
+  if (MultipoleTolerance>0.0)
+   { G->UseMultipoleBlocks = true;
+     SWGGeometry::MultipoleTolerance = MultipoleTolerance;
+   };
 
   if (DSIOmegaFile)
    BNEQD->DSIOmegaPoints = new HVector(DSIOmegaFile);
@@ -91,6 +91,15 @@ int main(int argc, char *argv[])
   char *DSIMesh          = 0;
 //
   char *MomentFile=0;
+//
+  bool HMatrixMode=false;
+  double ACATolerance=1.0e-4;
+  double SweepMemory=-1.0;
+  double GMETolerance=-1.0;
+  char *SolverName=0;
+  char *PCName=const_cast<char *>("overlap");
+  double SolverTolerance=1.0e-6;
+  int MaxIters=1000;
 
   int ExportMatrix=0;
   /* name               type    #args  max_instances  storage           count         description*/
@@ -130,6 +139,15 @@ int main(int argc, char *argv[])
      {"PlotCurrents",   PA_BOOL,    0, 1,       (void *)&PlotCurrents, 0,          "plot induced current distribution and E-field visualization files"},
 /**/
      {"MomentFile",     PA_STRING,  1, 1,       (void *)&MomentFile, 0,            "name of induced-dipole-moment output file"},
+/**/
+     {"HMatrix",        PA_BOOL,    0, 1,       (void *)&HMatrixMode,  0,          "use hierarchical-matrix (ACA) compression with a preconditioned iterative solver"},
+     {"ACATolerance",   PA_DOUBLE,  1, 1,       (void *)&ACATolerance, 0,          "relative tolerance for ACA compression of far-field blocks"},
+     {"SweepMemory",    PA_DOUBLE,  1, 1,       (void *)&SweepMemory,  0,          "memory budget (MB) for geometry data retained across frequencies"},
+     {"GMETolerance",   PA_DOUBLE,  1, 1,       (void *)&GMETolerance, 0,          "target accuracy for distance-adaptive quadrature of G-matrix elements (0=fixed rules)"},
+     {"Solver",         PA_STRING,  1, 1,       (void *)&SolverName,   0,          "LU | GMRES | BiCGStab"},
+     {"Preconditioner", PA_STRING,  1, 1,       (void *)&PCName,       0,          "none | overlap | nearfield (iterative solvers only)"},
+     {"SolverTolerance",PA_DOUBLE,  1, 1,       (void *)&SolverTolerance, 0,       "relative residual tolerance for iterative solvers"},
+     {"MaxIters",       PA_INT,     1, 1,       (void *)&MaxIters,     0,          "maximum number of iterations for iterative solvers"},
 /**/
      {0,0,0,0,0,0,0}
    };
@@ -214,6 +232,33 @@ int main(int argc, char *argv[])
   if ( NeedIncidentField && IFList==0 )
    ErrExit("you must specify at least one incident field source");
 
+  /*******************************************************************/
+  /* linear-solver options: the iterative solvers apply the VIE      */
+  /* matrix in compressed form and never store it densely; --HMatrix */
+  /* without --Solver selects GMRES                                   */
+  /*******************************************************************/
+  int SolverType = HMatrixMode ? BUFF_SOLVER_GMRES : BUFF_SOLVER_LU;
+  if (SolverName)
+   { if (!strcasecmp(SolverName,"LU"))
+      SolverType=BUFF_SOLVER_LU;
+     else if (!strcasecmp(SolverName,"GMRES"))
+      SolverType=BUFF_SOLVER_GMRES;
+     else if (!strcasecmp(SolverName,"BiCGStab"))
+      SolverType=BUFF_SOLVER_BICGSTAB;
+     else
+      OSUsage(argv[0], OSArray, "unknown --Solver %s",SolverName);
+   };
+
+  int PCType=BUFF_PRECOND_OVERLAP;
+  if (!strcasecmp(PCName,"none"))
+   PCType=BUFF_PRECOND_NONE;
+  else if (!strcasecmp(PCName,"overlap"))
+   PCType=BUFF_PRECOND_OVERLAP;
+  else if (!strcasecmp(PCName,"nearfield"))
+   PCType=BUFF_PRECOND_NEARFIELD;
+  else
+   OSUsage(argv[0], OSArray, "unknown --Preconditioner %s",PCName);
+
   /*******************************************************************/
   /* PFT options *****************************************************/
   /*******************************************************************/
@@ -234,7 +279,20 @@ int main(int argc, char *argv[])
   BSData MyBSData, *BSD=&MyBSData;
 
   SWGGeometry *G      = BSD->G   = new SWGGeometry(GeoFile);
-  HMatrix *M          = BSD->M   = G->AllocateVIEMatrix();
+  bool Iterative      = (SolverType!=BUFF_SOLVER_LU);
+  HMatrix *M          = BSD->M   = Iterative ? 0 : G->AllocateVIEMatrix();
+  VIEOperator *Op     = BSD->Op  = Iterative ? new VIEOperator(G, SolverType, PCType) : 0;
+  SWGGeometry::ACATolerance = ACATolerance;
+  if (SweepMemory>=0.0)
+   SWGGeometry::SweepMemoryBudget = SweepMemory;
+  if (GMETolerance>=0.0)
+   SWGGeometry::QuadraturePolicy.SetTolerance(GMETolerance);
+  if (M && OmegaList->N>1)
+   G->BeginFrequencySweep();
+  if (Op)
+   { Op->RelTol   = SolverTolerance;
+     Op->MaxIters = MaxIters;
+   };
                         BSD->RHS = G->AllocateRHSVector();
   HVector *J          = BSD->J   = G->AllocateRHSVector();
   BSD->IF             = 0;
@@ -258,12 +316,15 @@ int main(int argc, char *argv[])
      /*******************************************************************/
      /* assemble VIE matrix at this frequency                           */
      /*******************************************************************/
-     G->AssembleVIEMatrix(Omega, M);
+     if (Op)
+      Op->Assemble(Omega);
+     else
+      G->AssembleVIEMatrix(Omega, M);
 
      /*******************************************************************/
      /* export VIE matrix to a binary file if that was requested        */
      /*******************************************************************/
-     if (ExportMatrix)
+     if (ExportMatrix && M)
       { void *pCC=HMatrix::OpenMATLABContext("%s_%s",FileBase,OmegaStr);
         M->ExportToMATLAB(pCC,"M");
         HMatrix::CloseMATLABContext(pCC);
@@ -279,10 +340,13 @@ int main(int argc, char *argv[])
 
      /*******************************************************************/
      /* LU-factorize the VIE matrix to prepare for solving scattering   */
-     /* problems                                                        */
+     /* problems (the iterative solvers set up their preconditioner    */
+     /* at assembly time)                                               */
      /*******************************************************************/
-     Log("  LU-factorizing VIE matrix...");
-     M->LUFactorize();
+     if (M)
+      { Log("  LU-factorizing VIE matrix...");
+        M->LUFactorize();
+      };
 
      /***************************************************************/
      /* loop over incident fields                                   */
@@ -311,7 +375,10 @@ int main(int argc, char *argv[])
         /* solve the VIE system ****************************************/
         /***************************************************************/
         Log("  Solving the VIE system...");
-        M->LUSolve(J);
+        if (Op)
+         Op->Solve(J);
+        else
+         M->LUSolve(J);
 
         /*--------------------------------------------------------------*/
         /*--------------------------------------------------------------*/
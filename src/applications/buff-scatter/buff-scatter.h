@@ -42,6 +42,7 @@ typedef struct BSData
  {
    SWGGeometry *G;
    HMatrix *M;
+   VIEOperator *Op;
    HVector *RHS, *J;
    cdouble Omega;
    IncField *IF;
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 
 #include <complex>
 
@@ -65,6 +66,17 @@ void GetScriptK(int WhichK, cdouble KParam, double X,
 #define NUMY3PS (MAXY3POW+1)
 #define NUMY4PS (MAXY4POW+1)
 
+// integrand counts up to which we use stack buffers
+#define TTD_MAXPKS 64
+
+// largest number of Gauss-Legendre points per dimension
+#define TTD_MAXGLORDER 32
+
+// number of cubature points processed together by TTDIntegrand_v,
+// and the size of the buffer holding one P function for a block
+#define TTD_VBLOCK 8
+#define PBLOCKLEN  (NUMREGIONS*NUMWPOWERS*TTD_VBLOCK)
+
 typedef double UpsilonVector[NUMREGIONS][NUMWPOWERS][NUMY1PS][NUMY2PS][NUMY3PS][NUMY4PS];
 
 typedef struct CoefficientRule
@@ -95,11 +107,26 @@ typedef struct TTDWorkspace
    /* geometric data needed to compute X_d functions*/
    double RMatrix[6][6];
 
-   /* coefficient rules */
+   /* coefficient rules; CRList[np] has room for CRListSize[np] */
+   /* rules and is reused from call to call                     */
    CoefficientRule *CRList[NUMPS];
    int NumCRs[NUMPS];
+   int CRListSize[NUMPS];
    int MinwPower[NUMPS], MaxwPower[NUMPS], MaxyPower[NUMPS][MAXYDIM];
 
+   /* range of w powers over all P functions we need */
+   int MinwPowerAll, MaxwPowerAll;
+
+   /* buffers for TTDIntegrand_v: P function #np at a block of */
+   /* cubature points is at PBlock + PSlot[np]*PBLOCKLEN, and  */
+   /* the real and imaginary parts of the current kernel are   */
+   /* in KBlockR, KBlockI; the last index is the point number  */
+   int PSlot[NUMPS];
+   double *PBlock;
+   int PBlockSize;
+   double KBlockR[NUMREGIONS][NUMWPOWERS+5][TTD_VBLOCK];
+   double KBlockI[NUMREGIONS][NUMWPOWERS+5][TTD_VBLOCK];
+
    /* */
    bool NeedP[NUMPS];
    bool NeedK[NUMKS];
@@ -116,9 +143,10 @@ typedef struct TTDWorkspace
 void GetXAndJPrime(TTDWorkspace *TTDW, const double *yVector,
                    double X[NUMREGIONS], double JPrime[NUMREGIONS]);
 
-void GetScriptP(TTDWorkspace *TTDW, int WhichP,
-                const double *yVector,
-                double P[NUMREGIONS][NUMWPOWERS]);
+template<int NB>
+void GetScriptP_v(TTDWorkspace *TTDW, int WhichP,
+                  int NumPts, int ydim, const double *yVectors,
+                  double JPrime[NUMREGIONS][TTD_VBLOCK], double *P);
 
 void ComputeGeometricParameters(TTDArgStruct *Args,
                                 TTDWorkspace *TTDW);
@@ -146,79 +174,146 @@ void GetUpsilon_CommonEdge_TMuBDotBP_5(TTDWorkspace *TTDW, int Mu, double L1[3],
 void GetUpsilon_CommonEdge_TMuBDotBP_6(TTDWorkspace *TTDW, int Mu, double L1[3], double L2[3], double L3[3], double L1P[3], double L2P[3], double L3P[3], double D[3], double DP[3], double V0mXTorque[3], UpsilonVector Upsilon); 
 
 /***************************************************************/
+/* evaluate the NumPKs integrands at a block of nb<=TTD_VBLOCK */
+/* cubature points, with point #n at yBlock[n*ydim...] and its */
+/* integrand values at Sum[n*NumPKs...].                       */
+/*                                                             */
+/* all per-point quantities are stored with the point index    */
+/* last, so that the inner loops over the coefficient rules    */
+/* and over regions and w powers run over contiguous arrays.   */
+/* NB>0 fixes nb=NB at compile time, which lets the compiler   */
+/* vectorize those loops; NB=0 is for partial blocks.          */
 /***************************************************************/
-/***************************************************************/
-int TTDIntegrand(unsigned ydim, const double *yVector, void *parms,
-                 unsigned fdim, double *f)
+template<int NB>
+static void TTDIntegrandBlock(TTDWorkspace *TTDW, int nb,
+                              unsigned ydim, const double *yBlock,
+                              cdouble *Sum)
 {
-  (void) fdim; // unused
+  if (NB>0) nb=NB;
 
-  /*--------------------------------------------------------------*/
-  /*- extract parameters from data structure ---------------------*/
-  /*--------------------------------------------------------------*/
-  TTDWorkspace *TTDW = (TTDWorkspace *)parms;
   int NumPKs        = TTDW->NumPKs;
   int *PIndex       = TTDW->PIndex;
   int *KIndex       = TTDW->KIndex;
   cdouble *KParam   = TTDW->KParam;
-  TTDW->nCalls++;
 
-  /*--------------------------------------------------------------*/
-  /*--------------------------------------------------------------*/
-  /*--------------------------------------------------------------*/
   int nOffset = ydim;
+  int nMinAll = TTDW->MinwPowerAll + nOffset;
+  int nMaxAll = TTDW->MaxwPowerAll + nOffset;
+  double (*KR)[NUMWPOWERS+5][TTD_VBLOCK] = TTDW->KBlockR;
+  double (*KI)[NUMWPOWERS+5][TTD_VBLOCK] = TTDW->KBlockI;
 
   /*--------------------------------------------------------------*/
-  /*- prefetch values of the X_d and J_d^\prime functions for all */
-  /*- regions.                                                    */
+  /*- values of the X_d and J_d^\prime functions for all regions  */
   /*--------------------------------------------------------------*/
-  double X[NUMREGIONS], JPrime[NUMREGIONS];
-  GetXAndJPrime(TTDW, yVector, X, JPrime);
+  double X[NUMREGIONS][TTD_VBLOCK], JPrime[NUMREGIONS][TTD_VBLOCK];
+  for(int n=0; n<nb; n++)
+   { double Xn[NUMREGIONS], JPrimen[NUMREGIONS];
+     GetXAndJPrime(TTDW, yBlock + n*ydim, Xn, JPrimen);
+     for(int d=0; d<NUMREGIONS; d++)
+      { X[d][n]      = Xn[d];
+        JPrime[d][n] = JPrimen[d];
+      };
+   };
 
   /*--------------------------------------------------------------*/
-  /*- prefetch values of the scriptP vector for all P functions  -*/
-  /*- we will need                                               -*/
+  /*- values of the scriptP functions we need, times J_d^\prime   */
   /*--------------------------------------------------------------*/
-  double P[NUMPS][NUMREGIONS][NUMWPOWERS];
   for(int np=0; np<NUMPS; np++)
    if (TTDW->NeedP[np])
-    GetScriptP(TTDW, np, yVector, P[np]);
+    GetScriptP_v<NB>(TTDW, np, nb, ydim, yBlock, JPrime,
+                     TTDW->PBlock + TTDW->PSlot[np]*PBLOCKLEN);
 
   /*--------------------------------------------------------------*/
   /*- assemble the integrand vector by adding all subregions and  */
   /*- all n-values                                                */
   /*--------------------------------------------------------------*/
-  cdouble K[NUMREGIONS][NUMWPOWERS+5];
-  cdouble *Sum=(cdouble *)f;
   for(int npk=0; npk<NumPKs; npk++)
    { 
      int np = PIndex[npk];
      int nMin = TTDW->MinwPower[ np ];
      int nMax = TTDW->MaxwPower[ np ];
+     double *P = TTDW->PBlock + TTDW->PSlot[np]*PBLOCKLEN;
 
-     // attempt to skip the calculation of ScriptK
-     // if we can use values from the previous loop iteration
-     for(int d=0; d<NUMREGIONS; d++)
-      GetScriptK( KIndex[npk], KParam[npk], X[d],
-                  nMin+nOffset, nMax+nOffset, K[d]);
+     // ScriptK depends on the kernel but not on the P function,
+     // so we compute it for all w powers we will need and reuse
+     // it for consecutive integrands with the same kernel
+     if ( npk==0 || KIndex[npk]!=KIndex[npk-1] || KParam[npk]!=KParam[npk-1] )
+      for(int d=0; d<NUMREGIONS; d++)
+       for(int n=0; n<nb; n++)
+        { cdouble K[NUMWPOWERS+5];
+          GetScriptK( KIndex[npk], KParam[npk], X[d][n],
+                      nMinAll, nMaxAll, K);
+          for(int nw=nMinAll; nw<=nMaxAll; nw++)
+           { KR[d][nw][n] = real(K[nw]);
+             KI[d][nw][n] = imag(K[nw]);
+           };
+        };
 
-     Sum[npk]=0.0;
-     for(int n=nMin; n<=nMax; n++)
+     double SumR[TTD_VBLOCK], SumI[TTD_VBLOCK];
+     for(int n=0; n<nb; n++)
+      SumR[n]=SumI[n]=0.0;
+     for(int nw=nMin; nw<=nMax; nw++)
       for(int d=0; d<NUMREGIONS; d++)
-       Sum[npk] += JPrime[d] * P[np][d][n] * K[d][n+nOffset];
+       { const double *Pdn  = P + (d*NUMWPOWERS + nw)*TTD_VBLOCK;
+         const double *KRdn = KR[d][nw+nOffset];
+         const double *KIdn = KI[d][nw+nOffset];
+         for(int n=0; n<nb; n++)
+          { SumR[n] += Pdn[n]*KRdn[n];
+            SumI[n] += Pdn[n]*KIdn[n];
+          };
+       };
 
+     for(int n=0; n<nb; n++)
+      Sum[n*NumPKs + npk] = cdouble(SumR[n], SumI[n]);
    };
+}
 
-  if (TTDW->IntegrandLogFile)
-   { for(unsigned ny=0; ny<ydim; ny++)
-      fprintf(TTDW->IntegrandLogFile,"%e ",yVector[ny]);
-     fprintVecCR(TTDW->IntegrandLogFile,Sum,NumPKs);
+/***************************************************************/
+/* integrand routine in the format of hcubature_v: evaluates   */
+/* the NumPKs integrands at NumPts points, with point #n at    */
+/* yVectors[n*ydim ... n*ydim+ydim-1] and its integrand values */
+/* at f[n*fdim ... n*fdim+fdim-1].                             */
+/***************************************************************/
+int TTDIntegrand_v(unsigned ydim, size_t NumPts, const double *yVectors,
+                   void *parms, unsigned fdim, double *f)
+{
+  TTDWorkspace *TTDW = (TTDWorkspace *)parms;
+  int NumPKs         = TTDW->NumPKs;
+  TTDW->nCalls+=NumPts;
+
+  for(size_t nb0=0; nb0<NumPts; nb0+=TTD_VBLOCK)
+   { 
+     int nb = (NumPts-nb0 < TTD_VBLOCK) ? (int)(NumPts-nb0) : TTD_VBLOCK;
+     const double *yBlock = yVectors + nb0*ydim;
+     cdouble *Sum = (cdouble *)(f + nb0*fdim);
+
+     if (nb==TTD_VBLOCK)
+      TTDIntegrandBlock<TTD_VBLOCK>(TTDW, nb, ydim, yBlock, Sum);
+     else
+      TTDIntegrandBlock<0>(TTDW, nb, ydim, yBlock, Sum);
+
+     if (TTDW->IntegrandLogFile)
+      for(int n=0; n<nb; n++)
+       { for(unsigned ny=0; ny<ydim; ny++)
+          fprintf(TTDW->IntegrandLogFile,"%e ",yBlock[n*ydim + ny]);
+         fprintVecCR(TTDW->IntegrandLogFile,Sum + n*NumPKs,NumPKs);
+       };
    };
  
   return 0;
 
 }
 
+/***************************************************************/
+/* single-point version of TTDIntegrand_v in the format of     */
+/* hcubature and CCCubature                                    */
+/***************************************************************/
+int TTDIntegrand(unsigned ydim, const double *yVector, void *parms,
+                 unsigned fdim, double *f)
+{
+  return TTDIntegrand_v(ydim, 1, yVector, parms, fdim, f);
+}
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
@@ -235,11 +330,12 @@ void InitTTDArgs(TTDArgStruct *Args)
 }
 
 /***************************************************************/
+/* (re)initialize the fields of a workspace that depend on the */
+/* arguments of an individual call; the coefficient-rule       */
+/* buffers are left alone.                                     */
 /***************************************************************/
-/***************************************************************/
-void *CreateTTDWorkspace(TTDArgStruct *Args)
+static void InitTTDWorkspace(TTDWorkspace *TTDW, TTDArgStruct *Args)
 {
-  TTDWorkspace *TTDW=(TTDWorkspace *)mallocEC(sizeof *TTDW);
   TTDW->WhichCase = Args->WhichCase;
   int NumPKs  = TTDW->NumPKs = Args->NumPKs;
   int *PIndex = TTDW->PIndex = Args->PIndex;
@@ -257,10 +353,34 @@ void *CreateTTDWorkspace(TTDArgStruct *Args)
      TTDW->NeedK[KIndex[npk]] = true;
    };
 
+  // the P-function buffer for TTDIntegrand_v only ever grows
+  int NumPsNeeded=0;
+  for(int np=0; np<NUMPS; np++)
+   TTDW->PSlot[np] = TTDW->NeedP[np] ? NumPsNeeded++ : -1;
+  if (NumPsNeeded > TTDW->PBlockSize)
+   { if (TTDW->PBlock) free(TTDW->PBlock);
+     TTDW->PBlock=(double *)mallocEC(NumPsNeeded*PBLOCKLEN*sizeof(double));
+     TTDW->PBlockSize=NumPsNeeded;
+   };
+
+  TTDW->IntegrandLogFile = Args->IntegrandLogFile;
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+void *CreateTTDWorkspace(TTDArgStruct *Args)
+{
+  TTDWorkspace *TTDW=(TTDWorkspace *)mallocEC(sizeof *TTDW);
+
   memset(TTDW->NumCRs,0,NUMPS*sizeof(int));
+  memset(TTDW->CRListSize,0,NUMPS*sizeof(int));
   memset(TTDW->CRList,0,NUMPS*sizeof(TTDW->CRList[0]));
+  TTDW->PBlock=0;
+  TTDW->PBlockSize=0;
 
-  TTDW->IntegrandLogFile = Args->IntegrandLogFile;
+  if (Args)
+   InitTTDWorkspace(TTDW, Args);
 
   return (void *)TTDW;
 
@@ -274,10 +394,148 @@ void DestroyTTDWorkspace(void *pTTDW)
   for(int np=0; np<NUMPS; np++)
    if (TTDW->CRList[np])
     free(TTDW->CRList[np]);
+  if (TTDW->PBlock)
+   free(TTDW->PBlock);
   free(TTDW);
   
 }
 
+/***************************************************************/
+/* each thread that calls TTaylorDuffy without a workspace     */
+/* gets one of its own, which is created on the first call and */
+/* destroyed when the thread exits. the coefficient-rule       */
+/* buffers in the workspace only ever grow, so after the first */
+/* few calls the singular-integral path does no allocation.    */
+/***************************************************************/
+static pthread_key_t TTDWorkspaceKey;
+static pthread_once_t TTDWorkspaceKeyOnce = PTHREAD_ONCE_INIT;
+
+static void CreateTTDWorkspaceKey()
+{ pthread_key_create(&TTDWorkspaceKey, DestroyTTDWorkspace); }
+
+static TTDWorkspace *GetThreadTTDWorkspace()
+{
+  pthread_once(&TTDWorkspaceKeyOnce, CreateTTDWorkspaceKey);
+  TTDWorkspace *TTDW=(TTDWorkspace *)pthread_getspecific(TTDWorkspaceKey);
+  if (TTDW==0)
+   { TTDW=(TTDWorkspace *)CreateTTDWorkspace(0);
+     pthread_setspecific(TTDWorkspaceKey, (void *)TTDW);
+   };
+  return TTDW;
+}
+
+/***************************************************************/
+/* Gauss-Legendre rules on [0,1] with 1..TTD_MAXGLORDER points,*/
+/* computed once. the N-point rule starts at GLRules[N(N-1)]   */
+/* and consists of N (x,w) pairs.                              */
+/***************************************************************/
+static double GLRules[TTD_MAXGLORDER*(TTD_MAXGLORDER+1)];
+static pthread_once_t GLRulesOnce = PTHREAD_ONCE_INIT;
+
+static void InitGLRules()
+{
+  for(int N=1; N<=TTD_MAXGLORDER; N++)
+   { double *xw = GLRules + N*(N-1);
+     for(int i=0; i<N; i++)
+      { // Newton iteration for the ith root of P_N on [-1,1]
+        double z=cos(M_PI*(i+0.75)/(N+0.5)), dP=1.0;
+        for(int Iter=0; Iter<100; Iter++)
+         { double P0=1.0, P1=0.0;
+           for(int j=0; j<N; j++)
+            { double P2=P1; P1=P0; P0=((2*j+1)*z*P1 - j*P2)/(j+1); };
+           dP = N*(z*P0 - P1)/(z*z-1.0);
+           double dz = P0/dP;
+           z -= dz;
+           if ( fabs(dz) < 1.0e-15 ) break;
+         };
+        xw[2*i+0] = 0.5*(1.0-z);
+        xw[2*i+1] = 1.0/((1.0-z*z)*dP*dP);
+      };
+   };
+}
+
+/***************************************************************/
+/* number of Gauss-Legendre points per dimension needed to     */
+/* reach relative accuracy RelTol in each case, calibrated on  */
+/* the static (r^{-1}, r^0, r^1) and Helmholtz (kL=0.5, 2)     */
+/* kernels for regular, flattened, elongated, and irregular    */
+/* tet pairs, with one point of margin. row nt is for          */
+/* RelTol=10^{-nt}. the common-edge integrand converges only   */
+/* algebraically, so below 1e-4 we fall back to adaptive       */
+/* cubature there (entry 0).                                   */
+/***************************************************************/
+#define TTD_NUMGLTOLS 10
+static int TTDGLOrders[TTD_NUMGLTOLS+1][3]=
+ {/* edge, triangle, tet */
+   {  2,  2,  3 },
+   {  4,  3,  4 },
+   {  5,  4,  5 },
+   {  6,  5,  6 },
+   { 12,  7,  8 },
+   {  0,  9, 10 },
+   {  0, 10, 12 },
+   {  0, 12, 14 },
+   {  0, 14, 16 },
+   {  0, 16, 18 },
+   {  0, 18, 20 }
+ };
+
+int GetTTDGLOrder(int WhichCase, double RelTol)
+{
+  int nt = (RelTol>0.0) ? (int)ceil(-log10(RelTol)-1.0e-6) : TTD_NUMGLTOLS;
+  if (nt<0) nt=0;
+  if (nt>TTD_NUMGLTOLS) nt=TTD_NUMGLTOLS;
+  int nc = WhichCase - TTD_COMMONEDGE;
+  if (nc<0 || nc>2)
+   ErrExit("invalid WhichCase (%i) in GetTTDGLOrder",WhichCase);
+  return TTDGLOrders[nt][nc];
+}
+
+/***************************************************************/
+/* tensor-product Gauss-Legendre cubature of TTDIntegrand_v   */
+/* over the unit hypercube with N points per dimension, in     */
+/* blocks of TTD_VBLOCK points. there is no error estimate, so */
+/* Error is set to zero.                                       */
+/***************************************************************/
+static void GLCubature(int N, int fDim, TTDWorkspace *TTDW,
+                       int IntegralDimension, double *Result,
+                       double *Error)
+{
+  if (N>TTD_MAXGLORDER)
+   ErrExit("Gauss-Legendre order %i exceeds maximum (%i) in TTaylorDuffy",
+           N,TTD_MAXGLORDER);
+  pthread_once(&GLRulesOnce, InitGLRules);
+  const double *xw = GLRules + N*(N-1);
+
+  double fBuffer[TTD_VBLOCK*2*TTD_MAXPKS];
+  double *f = (fDim<=2*TTD_MAXPKS) ? fBuffer : (double *)mallocEC(TTD_VBLOCK*fDim*sizeof(double));
+
+  memset(Result, 0, fDim*sizeof(double));
+  int NumPoints=1;
+  for(int nd=0; nd<IntegralDimension; nd++)
+   NumPoints*=N;
+  for(int np0=0; np0<NumPoints; np0+=TTD_VBLOCK)
+   { int nb = (NumPoints-np0 < TTD_VBLOCK) ? NumPoints-np0 : TTD_VBLOCK;
+     double y[TTD_VBLOCK*MAXYDIM], w[TTD_VBLOCK];
+     for(int n=0; n<nb; n++)
+      { w[n]=1.0;
+        for(int nd=0, Index=np0+n; nd<IntegralDimension; nd++, Index/=N)
+         { y[n*IntegralDimension + nd] = xw[2*(Index%N) + 0];
+           w[n]                       *= xw[2*(Index%N) + 1];
+         };
+      };
+     TTDIntegrand_v(IntegralDimension, nb, y, (void *)TTDW, fDim, f);
+     for(int n=0; n<nb; n++)
+      for(int nf=0; nf<fDim; nf++)
+       Result[nf] += w[n]*f[n*fDim + nf];
+   };
+
+  if (Error)
+   memset(Error, 0, fDim*sizeof(double));
+  if (f!=fBuffer)
+   free(f);
+}
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
@@ -299,14 +557,22 @@ void TTaylorDuffy(TTDArgStruct *Args, void *pTTDW)
   /***************************************************************/
   /* initialize TTDW structure to pass data to integrand routines */
   /***************************************************************/
-  bool OwnsTTDW=false;
   TTDWorkspace *TTDW=(TTDWorkspace *)pTTDW;
   if (TTDW==0)
-   { OwnsTTDW=true;
-     TTDW=(TTDWorkspace *)CreateTTDWorkspace(Args);
-   };
+   TTDW=GetThreadTTDWorkspace();
+  InitTTDWorkspace(TTDW, Args);
 
   ComputeGeometricParameters(Args,TTDW);
+
+  TTDW->MinwPowerAll=NUMWPOWERS;
+  TTDW->MaxwPowerAll=0;
+  for(int np=0; np<NUMPS; np++)
+   if (TTDW->NeedP[np])
+    { if (TTDW->MinwPower[np] < TTDW->MinwPowerAll)
+       TTDW->MinwPowerAll = TTDW->MinwPower[np];
+      if (TTDW->MaxwPower[np] > TTDW->MaxwPowerAll)
+       TTDW->MaxwPowerAll = TTDW->MaxwPower[np];
+    };
   
   /***************************************************************/
   /* evaluate the 2-, 3-, 4-, or 5- dimensional cubature         */
@@ -319,15 +585,21 @@ void TTaylorDuffy(TTDArgStruct *Args, void *pTTDW)
   TTDW->nCalls=0;
   int IntegralDimension = 6 - WhichCase;
 
-  if (IntegralDimension<=2 || CubaturePoints!=0)
-   CCCubature(CubaturePoints, fDim, 
+  if (CubaturePoints==TTD_AUTOORDER)
+   CubaturePoints=GetTTDGLOrder(WhichCase, RelTol);
+
+  if (CubaturePoints>0)
+   GLCubature(CubaturePoints, fDim, TTDW, IntegralDimension,
+              dResult, dError);
+  else if (IntegralDimension<=2)
+   CCCubature(0, fDim, 
               TTDIntegrand, (void *)TTDW, IntegralDimension,
               Lower, Upper, MaxEval, AbsTol, RelTol,
               ERROR_INDIVIDUAL, dResult, dError);
   else
-   hcubature(fDim, TTDIntegrand, (void *)TTDW, IntegralDimension,
-             Lower, Upper, MaxEval, AbsTol, RelTol,
-             ERROR_INDIVIDUAL, dResult, dError);
+   hcubature_v(fDim, TTDIntegrand_v, (void *)TTDW, IntegralDimension,
+               Lower, Upper, MaxEval, AbsTol, RelTol,
+               ERROR_INDIVIDUAL, dResult, dError);
 
   Args->nCalls = TTDW->nCalls;
 
@@ -337,9 +609,57 @@ void TTaylorDuffy(TTDArgStruct *Args, void *pTTDW)
   for(int npk=0; npk<NumPKs; npk++)
    if ( KIndex[npk]==TTD_HELMHOLTZ || KIndex[npk]==TTD_GRADHELMHOLTZ)
     Args->Result[npk] /= (4.0*M_PI);
+}
+
+/***************************************************************/
+/* evaluate the NumPKs integrals specified by Args->PIndex and */
+/* Args->KIndex for each of NumKParams values of the kernel    */
+/* parameter (Args->KParam is ignored). all NumPKs*NumKParams  */
+/* integrals share the geometric setup and a single cubature.  */
+/* Args->Result and Args->Error must have room for             */
+/* NumPKs*NumKParams entries, and on return                    */
+/* Result[nk*NumPKs + npk] is integral #npk for KParams[nk].   */
+/***************************************************************/
+void TTaylorDuffy(TTDArgStruct *Args, int NumKParams, cdouble *KParams,
+                  void *pTTDW)
+{
+  int NumPKs   = Args->NumPKs;
+  int *PIndex  = Args->PIndex;
+  int *KIndex  = Args->KIndex;
+  cdouble *KParam = Args->KParam;
+
+  int NumAllPKs = NumPKs*NumKParams;
+  int PBuffer[TTD_MAXPKS], KBuffer[TTD_MAXPKS];
+  cdouble KPBuffer[TTD_MAXPKS];
+  int *AllPIndex = PBuffer, *AllKIndex = KBuffer;
+  cdouble *AllKParam = KPBuffer;
+  if (NumAllPKs > TTD_MAXPKS)
+   { AllPIndex = (int *)mallocEC(2*NumAllPKs*sizeof(int));
+     AllKIndex = AllPIndex + NumAllPKs;
+     AllKParam = (cdouble *)mallocEC(NumAllPKs*sizeof(cdouble));
+   };
 
-  if (OwnsTTDW)
-   DestroyTTDWorkspace( (void *) TTDW );
+  for(int nk=0, nt=0; nk<NumKParams; nk++)
+   for(int npk=0; npk<NumPKs; npk++, nt++)
+    { AllPIndex[nt] = PIndex[npk];
+      AllKIndex[nt] = KIndex[npk];
+      AllKParam[nt] = KParams[nk];
+    };
+
+  Args->NumPKs = NumAllPKs;
+  Args->PIndex = AllPIndex;
+  Args->KIndex = AllKIndex;
+  Args->KParam = AllKParam;
+  TTaylorDuffy(Args, pTTDW);
+  Args->NumPKs = NumPKs;
+  Args->PIndex = PIndex;
+  Args->KIndex = KIndex;
+  Args->KParam = KParam;
+
+  if (AllPIndex!=PBuffer)
+   { free(AllPIndex);
+     free(AllKParam);
+   };
 }
 
 /***************************************************************/
@@ -518,40 +838,65 @@ void GetnMinMax(double P[NUMREGIONS][NUMWPOWERS], int nMinMax[2])
 #endif
 
 /***************************************************************/
+/* compute the ScriptP polynomials for P function #WhichP, for */
+/* all subregions and all powers of w, at NumPts<=TTD_VBLOCK   */
+/* points, and multiply by the Jacobian factors J_d^\prime.    */
+/* on return, P[(d*NUMWPOWERS + n)*TTD_VBLOCK + m] is the      */
+/* value for region d and w power n at point m. NB>0 fixes    */
+/* NumPts=NB at compile time (see TTDIntegrandBlock).          */
 /***************************************************************/
-/***************************************************************/
-void GetScriptP(TTDWorkspace *TTDW, int WhichP, const double *yVector,
-                double P[NUMREGIONS][NUMWPOWERS])
+template<int NB>
+void GetScriptP_v(TTDWorkspace *TTDW, int WhichP,
+                  int NumPts, int ydim, const double *yVectors,
+                  double JPrime[NUMREGIONS][TTD_VBLOCK], double *P)
 {
+  if (NB>0) NumPts=NB;
+
   int WhichCase=TTDW->WhichCase;
 
   /***************************************************************/
   /* initialize vectors of powers of Y variables                 */
   /***************************************************************/
-  double yPowers[MAXYDIM][NUMY1PS];
-  yPowers[0][0]=yPowers[1][0]=yPowers[2][0]=yPowers[3][0]=1.0;
+  double yPowers[MAXYDIM][NUMY1PS][TTD_VBLOCK];
+  for(int ny=0; ny<MAXYDIM; ny++)
+   for(int m=0; m<NumPts; m++)
+    yPowers[ny][0][m]=1.0;
   int NumYs = 6 - WhichCase;
   for(int ny=0; ny<NumYs; ny++)
    for(int np=1; np<=TTDW->MaxyPower[WhichP][ny]; np++)
-    yPowers[ny][np]=yPowers[ny][np-1]*yVector[ny];
+    for(int m=0; m<NumPts; m++)
+     yPowers[ny][np][m]=yPowers[ny][np-1][m]*yVectors[m*ydim + ny];
 
   /***************************************************************/
   /* compute ScriptP polynomials for all subregions and all      */
   /* powers of w                                                 */
   /***************************************************************/
+  int nMin = TTDW->MinwPower[WhichP];
+  int nMax = TTDW->MaxwPower[WhichP];
   for(int d=0; d<NUMREGIONS; d++)
-   memset(P[d], 0, NUMWPOWERS*sizeof(double));
+   for(int n=nMin; n<=nMax; n++)
+    memset(P + (d*NUMWPOWERS + n)*TTD_VBLOCK, 0, NumPts*sizeof(double));
 
   for(int ncr=0; ncr<TTDW->NumCRs[WhichP]; ncr++)
    { 
      CoefficientRule *CR = &(TTDW->CRList[WhichP][ncr]);
-     P[CR->Region][CR->wPower] += CR->Coefficient
-                                  *yPowers[0][CR->y1Power]
-                                  *yPowers[1][CR->y2Power]
-                                  *yPowers[2][CR->y3Power]
-                                  *yPowers[3][CR->y4Power];
+     double C           = CR->Coefficient;
+     const double *Y1   = yPowers[0][CR->y1Power];
+     const double *Y2   = yPowers[1][CR->y2Power];
+     const double *Y3   = yPowers[2][CR->y3Power];
+     const double *Y4   = yPowers[3][CR->y4Power];
+     double *PCR        = P + (CR->Region*NUMWPOWERS + CR->wPower)*TTD_VBLOCK;
+     for(int m=0; m<NumPts; m++)
+      PCR[m] += C*Y1[m]*Y2[m]*Y3[m]*Y4[m];
    };
 
+  for(int d=0; d<NUMREGIONS; d++)
+   for(int n=nMin; n<=nMax; n++)
+    { double *Pdn = P + (d*NUMWPOWERS + n)*TTD_VBLOCK;
+      for(int m=0; m<NumPts; m++)
+       Pdn[m] *= JPrime[d][m];
+    };
+
 }
 
 /***************************************************************/
@@ -573,7 +918,7 @@ void ZeroUpsilonVector(UpsilonVector *Upsilon)
 /***************************************************************/
 void GetCRList(UpsilonVector *Upsilon,
                int MinwPower, int MaxwPower, int MaxyPower[MAXYDIM],
-               CoefficientRule **pCRList, int *pCRListLength)
+               CoefficientRule **pCRList, int *pNumCRs, int *pCRListSize)
 {
 #define UPSTHRESH 1.0e-10
   /***************************************************/
@@ -590,22 +935,21 @@ void GetCRList(UpsilonVector *Upsilon,
          NumRules++;
 
   /***************************************************/
-  /* second pass to populate list of rules ***********/
+  /* second pass to populate list of rules; if the   */
+  /* buffer is too small we reallocate it with room  */
+  /* for every rule that can occur for these powers, */
+  /* so that it never needs to grow again            */
   /***************************************************/
-  CoefficientRule *CRList = *pCRList;
-  int CRListLength        = *pCRListLength;
-  if ( CRList && CRListLength!=NumRules)
-   { 
-     Warn("%s:%i: mismatch in Taylor-Duffy workspace size (%i!=%i) (reallocating)...",__FILE__,__LINE__,CRListLength,NumRules);
-     free(CRList);
-     CRList=0;
-   };
-
-  if ( CRList==0 )
-   { CRList=(CoefficientRule *)mallocEC(NumRules*sizeof(*CRList));
-     *pCRList=CRList;
-     *pCRListLength=NumRules;
+  if ( NumRules > *pCRListSize )
+   { int MaxRules = NUMREGIONS*(MaxwPower-MinwPower+1);
+     for(int ny=0; ny<4; ny++)
+      MaxRules*=(MaxyPower[ny]+1);
+     if (*pCRList) free(*pCRList);
+     *pCRList=(CoefficientRule *)mallocEC(MaxRules*sizeof(**pCRList));
+     *pCRListSize=MaxRules;
    };
+  CoefficientRule *CRList = *pCRList;
+  *pNumCRs = NumRules;
  
   for(int nr=0, d=0; d<NUMREGIONS; d++)
    for(int wPower=MinwPower; wPower<=MaxwPower; wPower++)
@@ -726,7 +1070,6 @@ void ComputeGeometricParameters(TTDArgStruct *Args,
   /***************************************************************/
   /***************************************************************/
   /***************************************************************/
-  memset(TTDW->CRList, 0, NUMPS*sizeof(CoefficientRule *));
   bool *NeedP   = TTDW->NeedP;
   int WhichCase = TTDW->WhichCase;
   UpsilonVector Upsilon;
@@ -758,7 +1101,8 @@ void ComputeGeometricParameters(TTDArgStruct *Args,
      TTDW->MaxyPower[WhichP][2]=MaxyPower[2];
      TTDW->MaxyPower[WhichP][3]=MaxyPower[3];
      GetCRList(&Upsilon, MinwPower, MaxwPower, MaxyPower,
-               TTDW->CRList + WhichP, TTDW->NumCRs + WhichP);
+               TTDW->CRList + WhichP, TTDW->NumCRs + WhichP,
+               TTDW->CRListSize + WhichP);
    };
 
   /***************************************************************/
@@ -789,7 +1133,8 @@ void ComputeGeometricParameters(TTDArgStruct *Args,
      TTDW->MaxyPower[WhichP][2]=MaxyPower[2];
      TTDW->MaxyPower[WhichP][3]=MaxyPower[3];
      GetCRList(&Upsilon, MinwPower, MaxwPower, MaxyPower,
-               TTDW->CRList + WhichP, TTDW->NumCRs + WhichP);
+               TTDW->CRList + WhichP, TTDW->NumCRs + WhichP,
+               TTDW->CRListSize + WhichP);
    };
 
   /***************************************************************/
@@ -825,7 +1170,8 @@ void ComputeGeometricParameters(TTDArgStruct *Args,
        TTDW->MaxyPower[WhichP][2]=MaxyPower[2];
        TTDW->MaxyPower[WhichP][3]=MaxyPower[3];
        GetCRList(&Upsilon, MinwPower, MaxwPower, MaxyPower,
-                 TTDW->CRList + WhichP, TTDW->NumCRs + WhichP);
+                 TTDW->CRList + WhichP, TTDW->NumCRs + WhichP,
+                 TTDW->CRListSize + WhichP);
     };
 
   /***************************************************************/
@@ -860,7 +1206,8 @@ void ComputeGeometricParameters(TTDArgStruct *Args,
        TTDW->MaxyPower[WhichP][2]=MaxyPower[2];
        TTDW->MaxyPower[WhichP][3]=MaxyPower[3];
        GetCRList(&Upsilon, MinwPower, MaxwPower, MaxyPower,
-                 TTDW->CRList + WhichP, TTDW->NumCRs + WhichP);
+                 TTDW->CRList + WhichP, TTDW->NumCRs + WhichP,
+                 TTDW->CRListSize + WhichP);
     };
 
   /***************************************************************/
@@ -904,7 +1251,8 @@ void ComputeGeometricParameters(TTDArgStruct *Args,
        TTDW->MaxyPower[WhichP][2]=MaxyPower[2];
        TTDW->MaxyPower[WhichP][3]=MaxyPower[3];
        GetCRList(&Upsilon, MinwPower, MaxwPower, MaxyPower,
-                 TTDW->CRList + WhichP, TTDW->NumCRs + WhichP);
+                 TTDW->CRList + WhichP, TTDW->NumCRs + WhichP,
+                 TTDW->CRListSize + WhichP);
 
     }; //  if ( TTDW->NeedP[WhichP] )
 
@@ -972,7 +1320,8 @@ void ComputeGeometricParameters(TTDArgStruct *Args,
        TTDW->MaxyPower[WhichP][2]=MaxyPower[2];
        TTDW->MaxyPower[WhichP][3]=MaxyPower[3];
        GetCRList(&Upsilon, MinwPower, MaxwPower, MaxyPower,
-                 TTDW->CRList + WhichP, TTDW->NumCRs + WhichP);
+                 TTDW->CRList + WhichP, TTDW->NumCRs + WhichP,
+                 TTDW->CRListSize + WhichP);
 
     };
 #endif
@@ -72,6 +72,10 @@ using namespace scuff;
 #define TTD_COMMONEDGE           2
 #define TTD_COMMONVERTEX         1
 
+//value for the CubaturePoints field requesting automatic selection
+//of a fixed-order rule
+#define TTD_AUTOORDER           -1
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
@@ -97,6 +101,10 @@ typedef struct TTDArgStruct
     double XTorque[3];
     double AbsTol, RelTol;
     int MaxEval;
+
+    // 0 for adaptive cubature; N>0 for a fixed tensor-product rule
+    // with N Gauss-Legendre points per dimension; TTD_AUTOORDER to
+    // choose N automatically from WhichCase and RelTol
     int CubaturePoints;
     FILE *IntegrandLogFile;
 
@@ -108,6 +116,25 @@ typedef struct TTDArgStruct
 void InitTTDArgs(TTDArgStruct *Args);
 void *CreateTTDWorkspace(TTDArgStruct *Args);
 void DestroyTTDWorkspace(void *TTDW);
+
+// if pTTDW is NULL, a workspace private to the calling thread is used
 void TTaylorDuffy(TTDArgStruct *Args, void *pTTDW=0);
 
+// the integrand in the formats of hcubature_v and hcubature, for
+// a workspace prepared by a previous call to TTaylorDuffy(Args, TTDW)
+int TTDIntegrand_v(unsigned ydim, size_t NumPts, const double *yVectors,
+                   void *parms, unsigned fdim, double *f);
+int TTDIntegrand(unsigned ydim, const double *yVector, void *parms,
+                 unsigned fdim, double *f);
+
+// number of Gauss-Legendre points per dimension used for
+// CubaturePoints=TTD_AUTOORDER (0 if adaptive cubature is used)
+int GetTTDGLOrder(int WhichCase, double RelTol);
+
+// evaluate the integrals specified by Args for each of NumKParams
+// values of KParam (e.g. a list of frequencies) in a single pass;
+// Result[nk*NumPKs + npk] is integral #npk for KParams[nk]
+void TTaylorDuffy(TTDArgStruct *Args, int NumKParams, cdouble *KParams,
+                  void *pTTDW=0);
+
 #endif // TTAYLORDUFFY_H
@@ -0,0 +1,819 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * ACAMatrix.cc -- hierarchical-matrix representation of G-matrix
+ *              -- blocks, with far-field cluster pairs compressed by
+ *              -- adaptive cross approximation (ACA)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <tr1/unordered_map>
+
+#include <libhrutil.h>
+
+#include "libbuff.h"
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#ifdef USE_OPENMP
+#  include <omp.h>
+#endif
+
+using namespace scuff;
+
+namespace buff {
+
+int GetOverlaps(SWGVolume *O, int nfA, cdouble Omega,
+                SVTensor *TemperatureSVT,
+                double TAvg, double TEnvironment,
+                int Indices[MAXOVERLAP],
+                cdouble VEntries[MAXOVERLAP],
+                cdouble VInvEntries[MAXOVERLAP],
+                double RytovEntries[MAXOVERLAP]);
+
+/***************************************************************/
+/* initialize the list of (object, face) indices for the BFs   */
+/* in the row or column space of the matrix. no==-1 means all  */
+/* BFs in the geometry, in the order set by BFIndexOffset.     */
+/***************************************************************/
+static void GetBFList(SWGGeometry *G, int no, int *pN, int **pNO, int **pNF)
+{
+  int N = (no==-1) ? G->TotalBFs : G->Objects[no]->NumInteriorFaces;
+  int *NO = (int *)mallocEC(N*sizeof(int));
+  int *NF = (int *)mallocEC(N*sizeof(int));
+
+  int noMin = (no==-1) ? 0 : no;
+  int noMax = (no==-1) ? G->NumObjects : no+1;
+  for(int n=0, nop=noMin; nop<noMax; nop++)
+   for(int nf=0; nf<G->Objects[nop]->NumInteriorFaces; nf++, n++)
+    { NO[n]=nop;
+      NF[n]=nf;
+    };
+
+  *pN=N;
+  *pNO=NO;
+  *pNF=NF;
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+ACAMatrix::ACAMatrix(SWGGeometry *pG, int noa, int nob)
+{
+  if ( (noa==-1) != (nob==-1) )
+   ErrExit("%s:%i: internal error",__FILE__,__LINE__);
+
+  G=pG;
+  Symmetric = (noa==nob);
+
+  GetBFList(G, noa, &NR, &RowNO, &RowNF);
+  if (Symmetric)
+   { NC=NR;
+     ColNO=RowNO;
+     ColNF=RowNF;
+   }
+  else
+   GetBFList(G, nob, &NC, &ColNO, &ColNF);
+
+  RowClusters=ColClusters=0;
+  NumRowClusters=NumColClusters=0;
+  RowPerm=ColPerm=0;
+
+  Blocks=0;
+  NumBlocks=MaxBlocks=0;
+
+  NumPCBlocks=0;
+  PCClusters=0;
+  PCBlocks=0;
+  PCWork=0;
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+ACAMatrix::~ACAMatrix()
+{
+  FreeBlocks();
+
+  free(RowClusters);
+  free(RowPerm);
+  free(RowNO);
+  free(RowNF);
+  if (!Symmetric)
+   { free(ColClusters);
+     free(ColPerm);
+     free(ColNO);
+     free(ColNF);
+   };
+}
+
+/***************************************************************/
+/* deallocate all matrix blocks and preconditioner blocks      */
+/***************************************************************/
+void ACAMatrix::FreeBlocks()
+{
+  for(int nb=0; nb<NumBlocks; nb++)
+   { free(Blocks[nb].D);
+     free(Blocks[nb].U);
+     free(Blocks[nb].V);
+   };
+  free(Blocks);
+  Blocks=0;
+  NumBlocks=MaxBlocks=0;
+
+  for(int n=0; n<NumPCBlocks; n++)
+   { delete PCBlocks[n];
+     delete PCWork[n];
+   };
+  free(PCBlocks);
+  free(PCWork);
+  free(PCClusters);
+  PCBlocks=0;
+  PCWork=0;
+  PCClusters=0;
+  NumPCBlocks=0;
+}
+
+/***************************************************************/
+/* recursive bisection of a set of BFs into a binary cluster   */
+/* tree. each cluster is split at the median BF centroid along */
+/* the longest dimension of the bounding box of its centroids. */
+/***************************************************************/
+struct CentroidCmp
+ {
+   SWGGeometry *G;
+   int *NO, *NF, Axis;
+
+   bool operator()(int na, int nb) const
+    { return G->Objects[NO[na]]->Faces[NF[na]]->Centroid[Axis]
+           < G->Objects[NO[nb]]->Faces[NF[nb]]->Centroid[Axis];
+    };
+ };
+
+static int BuildClusterTree(SWGGeometry *G, int *NO, int *NF, int *Perm,
+                            int Start, int Num, int LeafSize,
+                            BFCluster *Clusters, int *NumClusters)
+{
+  int nc = (*NumClusters)++;
+  BFCluster *C = Clusters + nc;
+  C->Start    = Start;
+  C->Num      = Num;
+  C->Child[0] = C->Child[1] = -1;
+
+  double CMin[3], CMax[3];
+  for(int i=0; i<3; i++)
+   { C->BoxMin[i] = CMin[i] =  HUGE_VAL;
+     C->BoxMax[i] = CMax[i] = -HUGE_VAL;
+   };
+  for(int p=Start; p<Start+Num; p++)
+   { SWGFace *F = G->Objects[ NO[Perm[p]] ]->Faces[ NF[Perm[p]] ];
+     for(int i=0; i<3; i++)
+      { C->BoxMin[i] = fmin(C->BoxMin[i], F->Centroid[i] - F->Radius);
+        C->BoxMax[i] = fmax(C->BoxMax[i], F->Centroid[i] + F->Radius);
+        CMin[i]      = fmin(CMin[i], F->Centroid[i]);
+        CMax[i]      = fmax(CMax[i], F->Centroid[i]);
+      };
+   };
+
+  if (Num<=LeafSize)
+   return nc;
+
+  struct CentroidCmp Cmp;
+  Cmp.G=G;
+  Cmp.NO=NO;
+  Cmp.NF=NF;
+  Cmp.Axis=0;
+  for(int i=1; i<3; i++)
+   if ( (CMax[i]-CMin[i]) > (CMax[Cmp.Axis]-CMin[Cmp.Axis]) )
+    Cmp.Axis=i;
+  if ( CMax[Cmp.Axis]==CMin[Cmp.Axis] )
+   return nc;
+
+  int Half=Num/2;
+  std::nth_element(Perm+Start, Perm+Start+Half, Perm+Start+Num, Cmp);
+
+  int nc0=BuildClusterTree(G, NO, NF, Perm, Start, Half,
+                           LeafSize, Clusters, NumClusters);
+  int nc1=BuildClusterTree(G, NO, NF, Perm, Start+Half, Num-Half,
+                           LeafSize, Clusters, NumClusters);
+  Clusters[nc].Child[0]=nc0;
+  Clusters[nc].Child[1]=nc1;
+  return nc;
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+void ACAMatrix::BuildClusterTrees()
+{
+  int LeafSize = SWGGeometry::ACALeafSize;
+
+  free(RowClusters);
+  free(RowPerm);
+  RowClusters = (BFCluster *)mallocEC(2*NR*sizeof(BFCluster));
+  RowPerm     = (int *)mallocEC(NR*sizeof(int));
+  for(int n=0; n<NR; n++)
+   RowPerm[n]=n;
+  NumRowClusters=0;
+  BuildClusterTree(G, RowNO, RowNF, RowPerm, 0, NR, LeafSize,
+                   RowClusters, &NumRowClusters);
+
+  if (Symmetric)
+   { ColClusters    = RowClusters;
+     ColPerm        = RowPerm;
+     NumColClusters = NumRowClusters;
+     return;
+   };
+
+  free(ColClusters);
+  free(ColPerm);
+  ColClusters = (BFCluster *)mallocEC(2*NC*sizeof(BFCluster));
+  ColPerm     = (int *)mallocEC(NC*sizeof(int));
+  for(int n=0; n<NC; n++)
+   ColPerm[n]=n;
+  NumColClusters=0;
+  BuildClusterTree(G, ColNO, ColNF, ColPerm, 0, NC, LeafSize,
+                   ColClusters, &NumColClusters);
+}
+
+/***************************************************************/
+/* admissibility condition: two clusters are well-separated if */
+/* the smaller of their diameters is at most ACAEta times the  */
+/* distance between their bounding boxes.                      */
+/***************************************************************/
+static bool Admissible(BFCluster *CA, BFCluster *CB)
+{
+  double DiamA2=0.0, DiamB2=0.0, Dist2=0.0;
+  for(int i=0; i<3; i++)
+   { DiamA2 += (CA->BoxMax[i]-CA->BoxMin[i])*(CA->BoxMax[i]-CA->BoxMin[i]);
+     DiamB2 += (CB->BoxMax[i]-CB->BoxMin[i])*(CB->BoxMax[i]-CB->BoxMin[i]);
+     double Gap = fmax(0.0, fmax(CA->BoxMin[i]-CB->BoxMax[i],
+                                 CB->BoxMin[i]-CA->BoxMax[i]));
+     Dist2 += Gap*Gap;
+   };
+  if (Dist2==0.0)
+   return false;
+  double Eta=SWGGeometry::ACAEta;
+  return fmin(DiamA2, DiamB2) <= Eta*Eta*Dist2;
+}
+
+/***************************************************************/
+/* recursively partition the cluster pair (RC, CC) into        */
+/* admissible (low-rank) blocks and leaf-leaf (dense) blocks.  */
+/* in the symmetric case we only visit cluster pairs in the    */
+/* upper triangle.                                             */
+/***************************************************************/
+void ACAMatrix::AddBlocks(int RC, int CC)
+{
+  BFCluster *R = RowClusters + RC;
+  BFCluster *C = ColClusters + CC;
+  bool Diagonal = (Symmetric && RC==CC);
+  bool LowRank  = !Diagonal && Admissible(R, C);
+  bool RLeaf    = (R->Child[0]==-1);
+  bool CLeaf    = (C->Child[0]==-1);
+
+  if ( LowRank || (RLeaf && CLeaf) )
+   { if (NumBlocks==MaxBlocks)
+      { MaxBlocks = (MaxBlocks==0) ? 1024 : 2*MaxBlocks;
+        Blocks = (ACABlock *)realloc(Blocks, MaxBlocks*sizeof(ACABlock));
+        if (!Blocks)
+         ErrExit("out of memory in ACAMatrix");
+      };
+     ACABlock *B = Blocks + (NumBlocks++);
+     B->RC   = RC;
+     B->CC   = CC;
+     B->Rank = LowRank ? 0 : -1;
+     B->D    = B->U = B->V = 0;
+     return;
+   };
+
+  if (RLeaf)
+   { AddBlocks(RC, C->Child[0]);
+     AddBlocks(RC, C->Child[1]);
+   }
+  else if (CLeaf)
+   { AddBlocks(R->Child[0], CC);
+     AddBlocks(R->Child[1], CC);
+   }
+  else if (Diagonal)
+   { AddBlocks(R->Child[0], R->Child[0]);
+     AddBlocks(R->Child[0], R->Child[1]);
+     AddBlocks(R->Child[1], R->Child[1]);
+   }
+  else
+   { AddBlocks(R->Child[0], C->Child[0]);
+     AddBlocks(R->Child[0], C->Child[1]);
+     AddBlocks(R->Child[1], C->Child[0]);
+     AddBlocks(R->Child[1], C->Child[1]);
+   };
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+cdouble ACAMatrix::GetEntry(int nr, int nc, cdouble Omega,
+                            FIBBICache **Caches)
+{
+  int noa=RowNO[nr], nob=ColNO[nc];
+  FIBBICache *Cache = (noa==nob) ? Caches[noa] : 0;
+  return GetGMatrixElement(G->Objects[noa], RowNF[nr],
+                           G->Objects[nob], ColNF[nc],
+                           Omega, Cache);
+}
+
+/***************************************************************/
+/* fill in a single block: for admissible blocks we attempt    */
+/* adaptive cross approximation with partial pivoting, falling */
+/* back to dense storage if the rank is not small enough to    */
+/* be worth it.                                                */
+/***************************************************************/
+void ACAMatrix::AssembleBlock(ACABlock *B, cdouble Omega, FIBBICache **Caches)
+{
+  BFCluster *R = RowClusters + B->RC;
+  BFCluster *C = ColClusters + B->CC;
+  int M = R->Num, N = C->Num;
+  int *Rows = RowPerm + R->Start;
+  int *Cols = ColPerm + C->Start;
+
+  /*--------------------------------------------------------------*/
+  /*- ACA with partial pivoting ----------------------------------*/
+  /*--------------------------------------------------------------*/
+  int MaxRank = ( (M<N) ? M : N ) / 2;
+  if (B->Rank==0 && MaxRank>0)
+   {
+     double Tol = SWGGeometry::ACATolerance;
+     cdouble *U = (cdouble *)mallocEC(M*MaxRank*sizeof(cdouble));
+     cdouble *V = (cdouble *)mallocEC(N*MaxRank*sizeof(cdouble));
+     bool *RowUsed = (bool *)mallocEC(M*sizeof(bool));
+     memset(RowUsed, 0, M*sizeof(bool));
+
+     double Norm2=0.0;
+     int Rank=0, i=0, NumZeroRows=0;
+     bool Converged=false;
+     while( Rank<MaxRank )
+      {
+        RowUsed[i]=true;
+
+        // residual row i
+        cdouble *v = V + Rank*N;
+        int jPivot=0;
+        double vMax=0.0;
+        for(int j=0; j<N; j++)
+         { v[j] = GetEntry(Rows[i], Cols[j], Omega, Caches);
+           for(int l=0; l<Rank; l++)
+            v[j] -= U[l*M + i] * V[l*N + j];
+           if ( abs(v[j]) > vMax )
+            { vMax=abs(v[j]); jPivot=j; }
+         };
+
+        // if the residual row vanishes, try the next unused row
+        if (vMax==0.0)
+         { for(i=0; i<M && RowUsed[i]; i++)
+            ;
+           if ( i==M || ++NumZeroRows>3 )
+            { Converged=true;
+              break;
+            };
+           continue;
+         };
+        cdouble Pivot = v[jPivot];
+        for(int j=0; j<N; j++)
+         v[j] /= Pivot;
+
+        // residual column jPivot
+        cdouble *u = U + Rank*M;
+        for(int ii=0; ii<M; ii++)
+         { u[ii] = GetEntry(Rows[ii], Cols[jPivot], Omega, Caches);
+           for(int l=0; l<Rank; l++)
+            u[ii] -= V[l*N + jPivot] * U[l*M + ii];
+         };
+
+        // update the estimate of the frobenius norm of the approximant
+        double uu=0.0, vv=0.0;
+        for(int ii=0; ii<M; ii++) uu+=norm(u[ii]);
+        for(int j=0; j<N; j++)    vv+=norm(v[j]);
+        cdouble Cross=0.0;
+        for(int l=0; l<Rank; l++)
+         { cdouble uDot=0.0, vDot=0.0;
+           for(int ii=0; ii<M; ii++) uDot += conj(U[l*M+ii])*u[ii];
+           for(int j=0; j<N; j++)    vDot += conj(V[l*N+j])*v[j];
+           Cross += uDot*vDot;
+         };
+        Norm2 += uu*vv + 2.0*real(Cross);
+        Rank++;
+
+        if ( uu*vv <= Tol*Tol*Norm2 )
+         { Converged=true;
+           break;
+         };
+
+        // next pivot row is the largest entry of u among unused rows
+        double uMax=-1.0;
+        i=-1;
+        for(int ii=0; ii<M; ii++)
+         if ( !RowUsed[ii] && abs(u[ii])>uMax )
+          { uMax=abs(u[ii]); i=ii; }
+        if (i==-1)
+         { Converged=true;
+           break;
+         };
+      };
+     free(RowUsed);
+
+     if (Converged)
+      { B->Rank=Rank;
+        if (Rank==0)
+         { free(U); U=0;
+           free(V); V=0;
+         }
+        else
+         { U=(cdouble *)realloc(U, M*Rank*sizeof(cdouble));
+           V=(cdouble *)realloc(V, N*Rank*sizeof(cdouble));
+         };
+        B->U=U;
+        B->V=V;
+        return;
+      };
+
+     free(U);
+     free(V);
+   };
+
+  /*--------------------------------------------------------------*/
+  /*- dense block: near-field pairs, or far-field pairs for which */
+  /*- ACA did not reach the requested tolerance at low rank       */
+  /*--------------------------------------------------------------*/
+  B->Rank=-1;
+  B->D = (cdouble *)mallocEC(M*N*sizeof(cdouble));
+  bool Diagonal = (Symmetric && B->RC==B->CC);
+  for(int j=0; j<N; j++)
+   for(int i=(Diagonal ? j : 0); i<M; i++)
+    { B->D[i + j*M] = GetEntry(Rows[i], Cols[j], Omega, Caches);
+      if (Diagonal)
+       B->D[j + i*M] = B->D[i + j*M];
+    };
+}
+
+/***************************************************************/
+/* add the VInv overlap entries to the dense diagonal blocks.  */
+/* overlapping BFs share a tetrahedron, so their cluster pair  */
+/* is never admissible and the entries always land in a dense  */
+/* block. in the symmetric case, entries falling in the lower  */
+/* triangle of the cluster-pair partition are skipped, since   */
+/* they are supplied by the corresponding upper-triangle block.*/
+/***************************************************************/
+void ACAMatrix::AddOverlapBlocks(cdouble Omega)
+{
+  if (!Symmetric)
+   return;
+
+  int *Slot = (int *)mallocEC(NR*sizeof(int));
+  for(int p=0; p<NR; p++)
+   Slot[RowPerm[p]]=p;
+
+  int *Leaf = (int *)mallocEC(NR*sizeof(int));
+  for(int nc=0; nc<NumRowClusters; nc++)
+   if (RowClusters[nc].Child[0]==-1)
+    for(int p=RowClusters[nc].Start; p<RowClusters[nc].Start+RowClusters[nc].Num; p++)
+     Leaf[p]=nc;
+
+  std::tr1::unordered_map<long, int> DenseBlocks;
+  for(int nb=0; nb<NumBlocks; nb++)
+   if (Blocks[nb].Rank==-1)
+    DenseBlocks[ (long)Blocks[nb].RC*NumRowClusters + Blocks[nb].CC ] = nb;
+
+#ifdef USE_OPENMP
+  int NumThreads=GetNumThreads();
+#pragma omp parallel for schedule(dynamic,1), num_threads(NumThreads)
+#endif
+  for(int nr=0; nr<NR; nr++)
+   {
+     int ncList[MAXOVERLAP];
+     cdouble VEntries[MAXOVERLAP], VInvEntries[MAXOVERLAP];
+     double RytovEntries[MAXOVERLAP];
+     int nf  = RowNF[nr];
+     int NNZ = GetOverlaps(G->Objects[RowNO[nr]], nf, Omega, 0, 0.0, 0.0,
+                           ncList, VEntries, VInvEntries, RytovEntries);
+     for(int nnz=0; nnz<NNZ; nnz++)
+      {
+        int nc = nr - nf + ncList[nnz];
+        int RC = Leaf[Slot[nr]], CC = Leaf[Slot[nc]];
+        std::tr1::unordered_map<long, int>::iterator it
+         = DenseBlocks.find( (long)RC*NumRowClusters + CC );
+        if ( it==DenseBlocks.end() )
+         { if ( DenseBlocks.count( (long)CC*NumRowClusters + RC ) )
+            continue;
+           ErrExit("%s:%i: internal error (%i,%i)",__FILE__,__LINE__,nr,nc);
+         };
+        ACABlock *B = Blocks + it->second;
+        int M = RowClusters[RC].Num;
+        int i = Slot[nr] - RowClusters[RC].Start;
+        int j = Slot[nc] - RowClusters[CC].Start;
+        B->D[i + j*M] += VInvEntries[nnz];
+      };
+   };
+
+  free(Slot);
+  free(Leaf);
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+void ACAMatrix::Assemble(cdouble Omega, bool AddVInv)
+{
+  FreeBlocks();
+  BuildClusterTrees();
+  AddBlocks(0, 0);
+
+  /*--------------------------------------------------------------*/
+  /*- FIBBI caches for same-object interactions ------------------*/
+  /*--------------------------------------------------------------*/
+  FIBBICache **Caches=(FIBBICache **)mallocEC(G->NumObjects*sizeof(FIBBICache *));
+  for(int no=0; no<G->NumObjects; no++)
+   { bool InRows=false, InCols=false;
+     for(int nr=0; nr<NR && !InRows; nr++) InRows = (RowNO[nr]==no);
+     for(int nc=0; nc<NC && !InCols; nc++) InCols = (ColNO[nc]==no);
+     Caches[no] = (InRows && InCols) ? G->GetGCache(no, no) : 0;
+   };
+
+  /*--------------------------------------------------------------*/
+  /*--------------------------------------------------------------*/
+  /*--------------------------------------------------------------*/
+  Log("ACA assembling %ix%i matrix (%i blocks)",NR,NC,NumBlocks);
+#ifdef USE_OPENMP
+  int NumThreads=GetNumThreads();
+#pragma omp parallel for schedule(dynamic,1), num_threads(NumThreads)
+#endif
+  for(int nb=0; nb<NumBlocks; nb++)
+   { if (G->LogLevel>=BUFF_VERBOSE_LOGGING)
+      LogPercent(nb, NumBlocks);
+     AssembleBlock(Blocks + nb, Omega, Caches);
+   };
+
+  if (AddVInv)
+   AddOverlapBlocks(Omega);
+
+  /*--------------------------------------------------------------*/
+  /*- report compression statistics ------------------------------*/
+  /*--------------------------------------------------------------*/
+  double Stored=0.0;
+  int NumDense=0, NumLowRank=0, MaxRank=0;
+  for(int nb=0; nb<NumBlocks; nb++)
+   { int M = RowClusters[Blocks[nb].RC].Num;
+     int N = ColClusters[Blocks[nb].CC].Num;
+     int Rank = Blocks[nb].Rank;
+     if (Rank==-1)
+      { NumDense++;
+        Stored += ((double)M)*((double)N);
+      }
+     else
+      { NumLowRank++;
+        Stored += ((double)Rank)*((double)(M+N));
+        if (Rank>MaxRank) MaxRank=Rank;
+      };
+   };
+  Log("ACA %i dense, %i low-rank blocks (max rank %i): storage %.1f%% of dense",
+       NumDense, NumLowRank, MaxRank, 100.0*Stored/( ((double)NR)*((double)NC) ));
+
+  for(int no=0; no<G->NumObjects; no++)
+   if (Caches[no])
+    Caches[no]->Store(G->Objects[no]->MeshFileName);
+  free(Caches);
+}
+
+/***************************************************************/
+/* Y += B*X for a single block; in the symmetric case,         */
+/* off-diagonal blocks also contribute their transposes.       */
+/***************************************************************/
+static void ApplyBlock(ACAMatrix *H, ACABlock *B, cdouble *X, cdouble *Y)
+{
+  BFCluster *R = H->RowClusters + B->RC;
+  BFCluster *C = H->ColClusters + B->CC;
+  int M = R->Num, N = C->Num;
+  int *Rows = H->RowPerm + R->Start;
+  int *Cols = H->ColPerm + C->Start;
+  bool Transpose = (H->Symmetric && B->RC!=B->CC);
+
+  if (B->Rank==-1)
+   { for(int j=0; j<N; j++)
+      { cdouble *D=B->D + j*M, Xj=X[Cols[j]], YSum=0.0;
+        for(int i=0; i<M; i++)
+         { Y[Rows[i]] += D[i]*Xj;
+           if (Transpose) YSum += D[i]*X[Rows[i]];
+         };
+        if (Transpose) Y[Cols[j]] += YSum;
+      };
+     return;
+   };
+
+  for(int l=0; l<B->Rank; l++)
+   { cdouble *u=B->U + l*M, *v=B->V + l*N;
+     cdouble vX=0.0, uX=0.0;
+     for(int j=0; j<N; j++)
+      vX += v[j]*X[Cols[j]];
+     for(int i=0; i<M; i++)
+      { Y[Rows[i]] += u[i]*vX;
+        if (Transpose) uX += u[i]*X[Rows[i]];
+      };
+     if (Transpose)
+      for(int j=0; j<N; j++)
+       Y[Cols[j]] += v[j]*uX;
+   };
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+void ACAMatrix::Apply(HVector *X, HVector *Y)
+{
+  Y->Zero();
+
+#ifdef USE_OPENMP
+  int NumThreads=GetNumThreads();
+#pragma omp parallel num_threads(NumThreads)
+#endif
+   {
+     cdouble *YPartial=(cdouble *)mallocEC(NR*sizeof(cdouble));
+     for(int n=0; n<NR; n++)
+      YPartial[n]=0.0;
+
+#ifdef USE_OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+     for(int nb=0; nb<NumBlocks; nb++)
+      ApplyBlock(this, Blocks + nb, X->ZV, YPartial);
+
+#ifdef USE_OPENMP
+#pragma omp critical
+#endif
+     for(int nr=0; nr<NR; nr++)
+      Y->ZV[nr] += YPartial[nr];
+
+     free(YPartial);
+   };
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+void ACAMatrix::Unpack(HMatrix *M, int RowOffset, int ColOffset)
+{
+#ifdef USE_OPENMP
+  int NumThreads=GetNumThreads();
+#pragma omp parallel for schedule(dynamic,1), num_threads(NumThreads)
+#endif
+  for(int nb=0; nb<NumBlocks; nb++)
+   {
+     ACABlock *B  = Blocks + nb;
+     BFCluster *R = RowClusters + B->RC;
+     BFCluster *C = ColClusters + B->CC;
+     int NRB = R->Num, NCB = C->Num;
+     int *Rows = RowPerm + R->Start;
+     int *Cols = ColPerm + C->Start;
+     bool Transpose = (Symmetric && B->RC!=B->CC);
+     for(int j=0; j<NCB; j++)
+      for(int i=0; i<NRB; i++)
+       { cdouble Entry=0.0;
+         if (B->Rank==-1)
+          Entry = B->D[i + j*NRB];
+         else
+          for(int l=0; l<B->Rank; l++)
+           Entry += B->U[l*NRB + i] * B->V[l*NCB + j];
+         M->SetEntry(RowOffset + Rows[i], ColOffset + Cols[j], Entry);
+         if (Transpose)
+          M->SetEntry(RowOffset + Cols[j], ColOffset + Rows[i], Entry);
+       };
+   };
+}
+
+/***************************************************************/
+/* LU-factorize the diagonal (leaf-leaf) blocks for use as a   */
+/* block-Jacobi preconditioner. the blocks are the dense G     */
+/* blocks (if NearField) plus the entries of the per-object    */
+/* sparse VInv blocks (if VInvBlocks is non-null) coupling BFs */
+/* within the same leaf cluster.                               */
+/***************************************************************/
+void ACAMatrix::Factorize(SMatrix **VInvBlocks, bool NearField)
+{
+  if (!Symmetric)
+   ErrExit("%s:%i: ACAMatrix::Factorize requires a square matrix",__FILE__,__LINE__);
+
+  for(int n=0; n<NumPCBlocks; n++)
+   { delete PCBlocks[n];
+     delete PCWork[n];
+   };
+  free(PCBlocks);
+  free(PCWork);
+  free(PCClusters);
+
+  NumPCBlocks=0;
+  for(int nb=0; nb<NumBlocks; nb++)
+   if (Blocks[nb].RC==Blocks[nb].CC)
+    NumPCBlocks++;
+  PCClusters = (int *)mallocEC(NumPCBlocks*sizeof(int));
+  PCBlocks   = (HMatrix **)mallocEC(NumPCBlocks*sizeof(HMatrix *));
+  PCWork     = (HVector **)mallocEC(NumPCBlocks*sizeof(HVector *));
+  int *PCBlockIndex = (int *)mallocEC(NumPCBlocks*sizeof(int));
+  for(int nb=0, n=0; nb<NumBlocks; nb++)
+   if (Blocks[nb].RC==Blocks[nb].CC)
+    { int M = RowClusters[Blocks[nb].RC].Num;
+      PCClusters[n]   = Blocks[nb].RC;
+      PCBlocks[n]     = new HMatrix(M, M, LHM_COMPLEX);
+      PCWork[n]       = new HVector(M, LHM_COMPLEX);
+      PCBlockIndex[n] = nb;
+      n++;
+    };
+
+  Log("ACA factorizing %i diagonal blocks",NumPCBlocks);
+#ifdef USE_OPENMP
+  int NumThreads=GetNumThreads();
+#pragma omp parallel for schedule(dynamic,1), num_threads(NumThreads)
+#endif
+  for(int n=0; n<NumPCBlocks; n++)
+   { ACABlock *B = Blocks + PCBlockIndex[n];
+     int M = RowClusters[B->RC].Num;
+     int *Rows = RowPerm + RowClusters[B->RC].Start;
+     for(int j=0; j<M; j++)
+      for(int i=0; i<M; i++)
+       { cdouble Entry = NearField ? B->D[i + j*M] : 0.0;
+         if ( VInvBlocks && RowNO[Rows[i]]==RowNO[Rows[j]] )
+          Entry += VInvBlocks[RowNO[Rows[i]]]->GetEntry(RowNF[Rows[i]], RowNF[Rows[j]]);
+         PCBlocks[n]->SetEntry(i, j, Entry);
+       };
+     PCBlocks[n]->LUFactorize();
+   };
+
+  free(PCBlockIndex);
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+void ACAMatrix::ApplyPreconditioner(HVector *X, HVector *Y)
+{
+#ifdef USE_OPENMP
+  int NumThreads=GetNumThreads();
+#pragma omp parallel for schedule(dynamic,1), num_threads(NumThreads)
+#endif
+  for(int n=0; n<NumPCBlocks; n++)
+   { BFCluster *C = RowClusters + PCClusters[n];
+     int *Rows    = RowPerm + C->Start;
+     cdouble *W   = PCWork[n]->ZV;
+     for(int i=0; i<C->Num; i++)
+      W[i] = X->ZV[Rows[i]];
+     PCBlocks[n]->LUSolve(PCWork[n]);
+     for(int i=0; i<C->Num; i++)
+      Y->ZV[Rows[i]] = W[i];
+   };
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+static void ACAMatrixApply(HVector *X, HVector *Y, void *UserData)
+{ ((ACAMatrix *)UserData)->Apply(X, Y); }
+
+static void ACAMatrixPreconditioner(HVector *X, HVector *Y, void *UserData)
+{ ((ACAMatrix *)UserData)->ApplyPreconditioner(X, Y); }
+
+int ACAMatrix::Solve(HVector *X, double RelTol, int MaxIters)
+{
+  if (NumPCBlocks==0)
+   Factorize();
+
+  HVector *B = new HVector(NR, LHM_COMPLEX);
+  B->Copy(X);
+  X->Zero();
+  double Residual;
+  int NumIters=GMRES(ACAMatrixApply, (void *)this,
+                     ACAMatrixPreconditioner, (void *)this,
+                     B, X, RelTol, MaxIters, 50, &Residual);
+  Log("ACA GMRES: %i iterations (residual %e)",NumIters,Residual);
+  delete B;
+  return NumIters;
+}
+
+} // namespace buff
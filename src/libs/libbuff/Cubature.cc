@@ -33,6 +33,7 @@
 #include "libTriInt.h"
 #include "libscuff.h"
 #include "libbuff.h"
+#include "TetCubature.h"
 
 using namespace scuff;
 
@@ -199,30 +200,11 @@ void TetInt(SWGVolume *V, int nt, int iQ, double Sign,
 	       MaxEvals, 0.0, RelTol, ERROR_INDIVIDUAL, Result, Error);
    }
   else
-   {
-     double *TetCR = GetTetCR(NumPts);
-     memset(Result,0,fdim*sizeof(double));
-     double *dI = new double[fdim];
-     for(int np=0; np<NumPts; np++)
-      { 
-        double u1=TetCR[4*np + 0];
-        double u2=TetCR[4*np + 1];
-        double u3=TetCR[4*np + 2];
-        double w=(6.0*T->Volume)*TetCR[4*np + 3];
-
-        double x[3], b[3];
-        for(int Mu=0; Mu<3; Mu++)
-         { b[Mu] = u1*L1[Mu] + u2*L2[Mu] + u3*L3[Mu];
-           x[Mu] = Q[Mu] + b[Mu];
-           b[Mu] *= PreFac;
-         };
-
-        Integrand(x, b, 3.0*PreFac, UserData, dI);
-
-        for(int nf=0; nf<fdim; nf++)
-         Result[nf]+=w*dI[nf];
-      };
-     delete[] dI;
+   { UserTIntegrandFunctor F;
+     F.Integrand = Integrand;
+     F.UserData  = UserData;
+     TetIntT<0>(V, nt, iQ, Sign, F, Result, NumPts,
+                Error, MaxEvals, RelTol, fdim);
    };
 
 }
@@ -236,25 +218,10 @@ void BFInt(SWGVolume *V, int nf,
            int fdim, double *Result, double *Error,
            int NumPts, int MaxEvals, double RelTol)
 {
-  
-  SWGFace *F = V->Faces[nf];
-
-  TetInt(V, F->iPTet, F->PIndex, +1.0, Integrand, UserData, 
-         fdim, Result, Error, NumPts, MaxEvals, RelTol);
-
-  double *MResult = new double[fdim];
-  double *MError  = new double[fdim];
-  TetInt(V, F->iMTet, F->MIndex, -1.0, Integrand, UserData, 
-         fdim, MResult, MError, NumPts, MaxEvals, RelTol);
-
-  for(int n=0; n<fdim; n++) 
-   { Result[n] += MResult[n];
-     if (Error) Error[n] +=  MError[n];
-   };
-
-  delete[] MResult;
-  delete[] MError;
-
+  UserTIntegrandFunctor F;
+  F.Integrand = Integrand;
+  F.UserData  = UserData;
+  BFIntT<0>(V, nf, F, Result, NumPts, Error, MaxEvals, RelTol, fdim);
 }
 
 /*=============================================================*/
@@ -420,51 +387,12 @@ void TetTetInt(SWGVolume *VA, int ntA, int iQA, double SignA,
 	       MaxEvals, 0.0, RelTol, ERROR_INDIVIDUAL, Result, Error);
    }
   else
-   {
-     double *TetCR = GetTetCR(NumPts);
-     memset(Result,0,fdim*sizeof(double));
-     double *dI = new double[fdim];
-     for(int npA=0; npA<NumPts; npA++)
-      { 
-        double u1A=TetCR[4*npA + 0];
-        double u2A=TetCR[4*npA + 1];
-        double u3A=TetCR[4*npA + 2];
-        double wA=(6.0*TA->Volume)*TetCR[4*npA + 3];
-
-        double xA[3], bA[3];
-        for(int Mu=0; Mu<3; Mu++)
-         { bA[Mu] = u1A*L1A[Mu] + u2A*L2A[Mu] + u3A*L3A[Mu];
-           xA[Mu] = QA[Mu] + bA[Mu];
-           bA[Mu] *= PreFacA;
-         };
-   
-        for(int npB=0; npB<NumPts; npB++)
-         { 
-           double u1B=TetCR[4*npB + 0];
-           double u2B=TetCR[4*npB + 1];
-           double u3B=TetCR[4*npB + 2];
-           double wB=(6.0*TB->Volume)*TetCR[4*npB + 3];
-   
-           double xB[3], bB[3];
-           for(int Mu=0; Mu<3; Mu++)
-            { bB[Mu] = u1B*L1B[Mu] + u2B*L2B[Mu] + u3B*L3B[Mu];
-              xB[Mu] = QB[Mu] + bB[Mu];
-              bB[Mu] *= PreFacB;
-            };
-   
-           Integrand(xA, bA, 3.0*PreFacA,
-                     xB, bB, 3.0*PreFacB,
-                     UserData, dI);
-
-           for(int nf=0; nf<fdim; nf++)
-            Result[nf]+=wA*wB*dI[nf];
-         }; // for (int npB=...)
-
-      }; // for(int npA=0; npA<NumPts; npA++)
-
-     delete[] dI;
-
-   }; // if (NumPts==0)  ... else ...
+   { UserTTIntegrandFunctor F;
+     F.Integrand = Integrand;
+     F.UserData  = UserData;
+     TetTetIntT<0>(VA, ntA, iQA, SignA, VB, ntB, iQB, SignB,
+                   F, Result, NumPts, Error, MaxEvals, RelTol, fdim);
+   };
 
 }
  
@@ -479,51 +407,11 @@ void BFBFInt(SWGVolume *VA, int nfA,
              int fdim, double *Result, double *Error,
              int NumPts, int MaxEvals, double RelTol)
 {
-  
-  SWGFace *FA = VA->Faces[nfA];
-  SWGFace *FB = VB->Faces[nfB];
-
-  double *PResult = new double[fdim];
-  double *PError  = new double[fdim];
-
-  TetTetInt(VA, FA->iPTet, FA->PIndex, +1.0, 
-            VB, FB->iPTet, FB->PIndex, +1.0, 
-            Integrand, UserData, 
-            fdim, Result, Error, NumPts, MaxEvals, RelTol);
-
-  TetTetInt(VA, FA->iPTet, FA->PIndex, +1.0, 
-            VB, FB->iMTet, FB->MIndex, -1.0, 
-            Integrand, UserData, 
-            fdim, PResult, PError, NumPts, MaxEvals, RelTol);
-
-  for(int nf=0; nf<fdim; nf++)
-   { Result[nf] += PResult[nf];
-     if (Error) Error[nf]  += PError[nf];
-   };
-
-  TetTetInt(VA, FA->iMTet, FA->MIndex, -1.0, 
-            VB, FB->iPTet, FB->PIndex, +1.0, 
-            Integrand, UserData, 
-            fdim, PResult, PError, NumPts, MaxEvals, RelTol);
-
-  for(int nf=0; nf<fdim; nf++)
-   { Result[nf] += PResult[nf];
-     if (Error) Error[nf]  += PError[nf];
-   };
-
-  TetTetInt(VA, FA->iMTet, FA->MIndex, -1.0,
-            VB, FB->iMTet, FB->MIndex, -1.0,
-            Integrand, UserData,
-            fdim, PResult, PError, NumPts, MaxEvals, RelTol);
-
-  for(int nf=0; nf<fdim; nf++)
-   { Result[nf] += PResult[nf];
-     if (Error) Error[nf]  += PError[nf];
-   };
-
-  delete[] PResult;
-  delete[] PError;
-
+  UserTTIntegrandFunctor F;
+  F.Integrand = Integrand;
+  F.UserData  = UserData;
+  BFBFIntT<0>(VA, nfA, VB, nfB, F, Result, NumPts,
+              Error, MaxEvals, RelTol, fdim);
 }
 
 /*=============================================================*/
@@ -36,6 +36,7 @@
 
 #include "libscuff.h"
 #include "libbuff.h"
+#include "TetCubature.h"
 
 #ifdef HAVE_CONFIG_H
 #  include "config.h"
@@ -79,15 +80,28 @@ typedef struct PFTIData
 
  } PFTIData;
 
+/***************************************************************/
+/* integrand functors for TetCubature.h                        */
+/***************************************************************/
+struct ExtinctionPFTIntegrand
+ { PFTIData *Data;
+   void operator()(double *x, double *b, double Divb, double *I);
+ };
+
+struct ScatteredPFTIntegrand
+ { PFTIData *Data;
+   void operator()(double *xA, double *bA, double DivbA,
+                   double *xB, double *bB, double DivbB, double *I);
+ };
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
-void ExtinctionPFTIntegrand(double *x, double *b, double Divb,
-                            void *UserData, double *I)
+inline void ExtinctionPFTIntegrand::operator()(double *x, double *b, double Divb,
+                                               double *I)
 {
   (void) Divb; // unused
 
-  PFTIData *Data       = (PFTIData *)UserData;
   IncField *IF         = Data->IF;
   double *TorqueCenter = Data->TorqueCenterA;
 
@@ -138,11 +152,10 @@ void GetExtinctionPFTIntegrals(SWGVolume *O, int nbf, IncField *IF,
   Data->IF            = IF;
   Data->TorqueCenterA = O->Origin;
 
-  double Error[2*NUMPFTT];
-  int IDim=2*NUMPFTT;
+  ExtinctionPFTIntegrand Integrand;
+  Integrand.Data = Data;
   int NumPts=33;
-  BFInt(O, nbf, ExtinctionPFTIntegrand, (void *)Data,
-        IDim, (double *)Q, Error, NumPts, 0, 0);
+  BFIntT<2*NUMPFTT>(O, nbf, Integrand, (double *)Q, NumPts);
 }
 
 /***************************************************************/
@@ -213,14 +226,13 @@ void GetExtinctionPFTT(SWGGeometry *G, HVector *JVector,
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
-void ScatteredPFTIntegrand(double *xA, double *bA, double DivbA,
-                           double *xB, double *bB, double DivbB,
-                           void *UserData, double *I)
+inline void ScatteredPFTIntegrand::operator()(double *xA, double *bA, double DivbA,
+                                              double *xB, double *bB, double DivbB,
+                                              double *I)
 {
   (void) DivbA; // unused
   (void) DivbB; // unused
 
-  PFTIData *Data        = (PFTIData*)UserData;
   double Omega          = Data->Omega;
   double k              = Data->Omega;
   bool SameObject       = Data->SameObject;
@@ -303,7 +315,6 @@ void GetScatteredPFTIntegrals(SWGVolume *Oa, int nbfa,
   Data->TorqueCenterA    = Oa->Origin;
   Data->TorqueCenterB    = Ob->Origin;
 
-  double Error[2*(NUMPFTT+3)];
   int ncv = CompareBFs(Oa, nbfa, Ob, nbfb);
 
   double RadiusA=Oa->Faces[nbfa]->Radius;
@@ -312,10 +323,9 @@ void GetScatteredPFTIntegrals(SWGVolume *Oa, int nbfa,
   bool HighFrequency = ( kR > 5.0 );
   int NumPts = HighFrequency ? ( (ncv > 0) ? 33 : 16 ) : ( (ncv>0) ? 16 : 4 );
 
-  int IDim = 2*(NUMPFTT+3);
-  BFBFInt(Oa, nbfa, Ob, nbfb,
-          ScatteredPFTIntegrand, (void *)Data, IDim, 
-          (double *)Q, Error, NumPts, 0, 0);
+  ScatteredPFTIntegrand Integrand;
+  Integrand.Data = Data;
+  BFBFIntT<2*(NUMPFTT+3)>(Oa, nbfa, Ob, nbfb, Integrand, (double *)Q, NumPts);
 }
 
 /***************************************************************/
@@ -31,7 +31,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <tr1/unordered_map>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <algorithm>
 #include <pthread.h> // needed for rwlock
 #include <omp.h> // needed for rwlock
 
@@ -72,47 +74,209 @@ long HashFunction(const float *Key)
 } 
 
 /*--------------------------------------------------------------*/
-/*--------------------------------------------------------------*/
+/*- full search keys are KEYLEN floats describing the geometry  */
+/*- of a BF pair (see GetFIBBICacheKey below). in compact-key   */
+/*- mode, the table and cache files instead store a 128-bit     */
+/*- fingerprint of the full key.                                */
 /*--------------------------------------------------------------*/
 typedef struct { float  Key[KEYLEN];    } KeyStruct;
-typedef struct { double Data[DATALEN];  } DataStruct;
 
-typedef std::pair<KeyStruct, DataStruct> KDPair;
+#define COMPACTKEYSIZE (2*sizeof(uint64_t))
 
-struct KeyHash
- {
-   long operator() (const KeyStruct &K) const 
-    { return HashFunction(K.Key); }
- };
+static uint64_t Mix64(uint64_t x)
+{ x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
 
-typedef struct 
- { 
-   bool operator()(const KeyStruct &K1, const KeyStruct &K2) const
-    { 
-      return !memcmp( (const void *)K1.Key,
-                      (const void *)K2.Key,
-                      KEYSIZE
-                    );
-    };
+static void GetFingerprint(const float *FullKey, uint64_t FP[2])
+{
+  uint64_t h1=0x9e3779b97f4a7c15ULL, h2=0xc2b2ae3d27d4eb4fULL;
+  for(int n=0; n<KEYLEN; n++)
+   { uint32_t w;
+     memcpy(&w, FullKey+n, sizeof(uint32_t));
+     h1 = Mix64(h1 ^ w);
+     h2 = Mix64(h2 + w + (((uint64_t)n)<<32));
+   };
+  FP[0]=h1;
+  FP[1]=Mix64(h2 ^ h1);
+}
+
+/*--------------------------------------------------------------*/
+/*- the in-memory table is split into NUMSHARDS shards, each    */
+/*- with its own lock, so that threads looking up unrelated     */
+/*- keys rarely contend for the same lock. the mutex/condition  */
+/*- variable pair is used only by threads waiting for a record  */
+/*- that another thread is in the middle of computing.          */
+/*-                                                             */
+/*- each shard stores its records (key followed by data, in the */
+/*- same layout as in cache files) densely, in chunks of        */
+/*- CHUNKRECORDS records, each record followed by one byte of   */
+/*- flags and (in compact-key mode with key verification) the   */
+/*- full key. the last chunk may hold fewer than CHUNKRECORDS   */
+/*- records after a Trim(); it is reallocated (only under the   */
+/*- write lock) when it fills up, so records keep their indices */
+/*- but not their addresses. the records are indexed by an      */
+/*- open-addressing hash table with linear probing whose slots  */
+/*- hold record indices plus one.                               */
+/*--------------------------------------------------------------*/
+#define NUMSHARDS 64
+#define CHUNKRECORDS 256
 
- } KeyCmp;
+#define REC_READY      1  // the data are valid
+#define REC_JOURNALED  2  // the record is safely on disk
+#define REC_VERIFIABLE 4  // the full key of the record is known
+#define REC_REFERENCED 8  // looked up since the last Trim() sweep
+#define REC_EVICT     16  // chosen for eviction by Trim()
 
-typedef std::tr1::unordered_map< KeyStruct,
-                                 DataStruct,
-                                 KeyHash,
-                                 KeyCmp> KDMap;
+typedef struct KDShard
+ { int KeySize, RecordSize;
+   bool HaveFullKeys;
+   char **Chunks;
+   unsigned long NumChunks, NumRecords;
+   unsigned long Capacity; // number of records the chunks can hold
+   uint32_t *Slots;
+   unsigned long NumSlots;
+   unsigned long Hand; // CLOCK hand for Trim()
+   pthread_rwlock_t Lock;
+   pthread_mutex_t PendingMutex;
+   pthread_cond_t PendingCond;
+ } KDShard;
+
+// bytes per record in a chunk, including flags and full key
+static size_t EntrySize(KDShard *S)
+{ return S->RecordSize + 1 + (S->HaveFullKeys ? KEYSIZE : 0); }
+
+static char *RecordAt(KDShard *S, unsigned long nr)
+{ return S->Chunks[nr/CHUNKRECORDS] + (nr%CHUNKRECORDS)*EntrySize(S); }
+
+static unsigned char *FlagsAt(KDShard *S, unsigned long nr)
+{ return (unsigned char *)(RecordAt(S, nr) + S->RecordSize); }
+
+// not aligned; access only with memcpy/memcmp
+static char *FullKeyAt(KDShard *S, unsigned long nr)
+{ return RecordAt(S, nr) + S->RecordSize + 1; }
+
+static unsigned long GetKeyHash(const char *Key, int KeySize)
+{ uint64_t h;
+  if (KeySize==COMPACTKEYSIZE)
+   memcpy(&h, Key, sizeof(uint64_t)); // already well mixed
+  else
+   h = Mix64( (uint64_t)JenkinsHash(Key, KeySize) );
+  return (unsigned long)h;
+}
+
+static KDShard *GetShard(void *opTable, unsigned long h)
+{ return ((KDShard *)opTable) + ((h>>40) % NUMSHARDS); }
+
+// index of the slot that holds Key, or of the empty slot at
+// which it would be inserted
+static unsigned long ProbeSlot(KDShard *S, const char *Key, unsigned long h)
+{ 
+  unsigned long Mask = S->NumSlots - 1, ns = h & Mask;
+  while(    S->Slots[ns]!=0
+         && memcmp(RecordAt(S, S->Slots[ns]-1), Key, S->KeySize)
+       )
+   ns = (ns+1) & Mask;
+  return ns;
+}
+
+// index of the record with the given key, or -1 if there is none
+static long FindRecord(KDShard *S, const char *Key, unsigned long h)
+{ 
+  if (S->NumSlots==0) return -1;
+  return ((long)S->Slots[ProbeSlot(S, Key, h)]) - 1;
+}
+
+// reindex all records in a slot table of the given size
+static void RebuildSlots(KDShard *S, unsigned long NumSlots)
+{
+  if (S->Slots) free(S->Slots);
+  S->NumSlots = NumSlots;
+  S->Slots    = (uint32_t *)mallocEC(S->NumSlots*sizeof(uint32_t));
+  memset(S->Slots, 0, S->NumSlots*sizeof(uint32_t));
+  for(unsigned long nr=0; nr<S->NumRecords; nr++)
+   { const char *Record=RecordAt(S, nr);
+     S->Slots[ ProbeSlot(S, Record, GetKeyHash(Record, S->KeySize)) ] = nr+1;
+   };
+}
+
+// add a record with the given key and no data (the key must not
+// be present already) and return its index. the caller must hold
+// the write lock.
+static unsigned long NewRecord(KDShard *S, const char *Key, unsigned long h)
+{
+  // double the number of slots if the load factor would exceed 3/4
+  if ( 4*(S->NumRecords+1) > 3*S->NumSlots )
+   RebuildSlots(S, (S->NumSlots==0) ? 64 : 2*S->NumSlots);
+
+  unsigned long nr = S->NumRecords;
+  if ( nr == S->Capacity )
+   { if ( nr == S->NumChunks*CHUNKRECORDS )
+      { S->Chunks = (char **)realloc(S->Chunks, (S->NumChunks+1)*sizeof(char *));
+        S->Chunks[S->NumChunks++] = (char *)mallocEC(CHUNKRECORDS*EntrySize(S));
+      }
+     else // last chunk was shrunk by PackShard
+      S->Chunks[S->NumChunks-1]
+       = (char *)reallocEC(S->Chunks[S->NumChunks-1], CHUNKRECORDS*EntrySize(S));
+     S->Capacity = S->NumChunks*CHUNKRECORDS;
+   };
+
+  memcpy(RecordAt(S, nr), Key, S->KeySize);
+  *FlagsAt(S, nr)=0;
+  S->Slots[ProbeSlot(S, Key, h)] = nr+1;
+  S->NumRecords++;
+  return nr;
+}
 
 /*--------------------------------------------------------------*/
 /*- class constructor                                          -*/
 /*--------------------------------------------------------------*/
+bool FIBBICache::CompactKeys=false;
+bool FIBBICache::VerifyKeys=false;
+
 FIBBICache::FIBBICache(char *MeshFileName)
 {
-  KDMap *KDM=new KDMap;
-  opTable = (void *)KDM;
+  char *s=getenv("BUFF_CACHE_KEY_TOLERANCE");
+  if (s)
+   sscanf(s,"%le",&KeyTolerance);
+  if ( (s=getenv("BUFF_CACHE_COMPACT_KEYS")) )
+   CompactKeys = (s[0]!='0');
+  if ( (s=getenv("BUFF_CACHE_VERIFY_KEYS")) )
+   VerifyKeys = (s[0]!='0');
 
-  pthread_rwlock_init(&lock,0);
+  UseCompactKeys = CompactKeys;
+  KeySize        = UseCompactKeys ? COMPACTKEYSIZE : KEYSIZE;
+  RecordSize     = KeySize + DATASIZE;
 
-  Hits=Misses=0;
+  KDShard *Shards=new KDShard[NUMSHARDS];
+  for(int ns=0; ns<NUMSHARDS; ns++)
+   { Shards[ns].KeySize=KeySize;
+     Shards[ns].RecordSize=RecordSize;
+     Shards[ns].HaveFullKeys=(UseCompactKeys && VerifyKeys);
+     Shards[ns].Chunks=0;
+     Shards[ns].NumChunks=Shards[ns].NumRecords=Shards[ns].Capacity=0;
+     Shards[ns].Slots=0;
+     Shards[ns].NumSlots=0;
+     Shards[ns].Hand=0;
+     pthread_rwlock_init(&(Shards[ns].Lock),0);
+     pthread_mutex_init(&(Shards[ns].PendingMutex),0);
+     pthread_cond_init(&(Shards[ns].PendingCond),0);
+   };
+  opTable = (void *)Shards;
+
+  Hits=Misses=Collisions=BackingHits=0;
+  Backing=0;
+
+  JournalEnabled=false;
+  ConvertedFromFullKeys=false;
+  MappedRegion=0;
+  MappedLength=0;
+  MappedRecords=0;
+  NumMappedRecords=0;
 
   /*--------------------------------------------------------------*/
   /*- attempt to preload cache                                   -*/
@@ -147,32 +311,113 @@ FIBBICache::FIBBICache(char *MeshFileName)
 /*--------------------------------------------------------------*/
 FIBBICache::~FIBBICache()
 {
-  pthread_rwlock_destroy(&lock);
-
   if (PreloadFileName)
    free(PreloadFileName);
 
-  KDMap *KDM = (KDMap *)opTable;
-  delete KDM;
+  if (MappedRegion)
+   munmap(MappedRegion, MappedLength);
+
+  KDShard *Shards = (KDShard *)opTable;
+  for(int ns=0; ns<NUMSHARDS; ns++)
+   { for(unsigned long nc=0; nc<Shards[ns].NumChunks; nc++)
+      free(Shards[ns].Chunks[nc]);
+     if (Shards[ns].Chunks) free(Shards[ns].Chunks);
+     if (Shards[ns].Slots)  free(Shards[ns].Slots);
+     pthread_rwlock_destroy(&(Shards[ns].Lock));
+     pthread_mutex_destroy(&(Shards[ns].PendingMutex));
+     pthread_cond_destroy(&(Shards[ns].PendingCond));
+   };
+  delete[] Shards;
 
 } 
 
+/*--------------------------------------------------------------*/
+/*- the key under which the record for a BF pair with the given -*/
+/*- full key is stored in this cache                            -*/
+/*--------------------------------------------------------------*/
+void FIBBICache::MakeLookupKey(const float *FullKey, char *Key)
+{ 
+  if (UseCompactKeys)
+   { uint64_t FP[2];
+     GetFingerprint(FullKey, FP);
+     memcpy(Key, FP, COMPACTKEYSIZE);
+   }
+  else
+   memcpy(Key, FullKey, KEYSIZE);
+}
+
+/*--------------------------------------------------------------*/
+/*- add a record read from a file, whose key occupies the first -*/
+/*- FileKeySize bytes, to the table (converting full keys to    -*/
+/*- fingerprints if we are in compact-key mode). returns true if-*/
+/*- the record was new.                                         -*/
+/*--------------------------------------------------------------*/
+bool FIBBICache::AddRecord(const char *FileRecord, int FileKeySize,
+                           unsigned char NewFlags)
+{
+  char Key[KEYSIZE];
+  KeyStruct FullKey;
+  bool HaveFullKey = (FileKeySize==KEYSIZE);
+  if (HaveFullKey)
+   { memcpy(FullKey.Key, FileRecord, KEYSIZE);
+     MakeLookupKey(FullKey.Key, Key);
+   }
+  else
+   memcpy(Key, FileRecord, KeySize);
+
+  if ( NumMappedRecords>0 && FindMappedRecord(Key) )
+   return false;
+
+  unsigned long h = GetKeyHash(Key, KeySize);
+  KDShard *Shard = GetShard(opTable, h);
+  bool Inserted=false;
+  pthread_rwlock_wrlock(&(Shard->Lock));
+  if ( FindRecord(Shard, Key, h) == -1 )
+   { unsigned long nr=NewRecord(Shard, Key, h);
+     memcpy(RecordAt(Shard, nr) + KeySize, FileRecord + FileKeySize, DATASIZE);
+     *FlagsAt(Shard, nr) = REC_READY | NewFlags;
+     if (Shard->HaveFullKeys && HaveFullKey)
+      { memcpy(FullKeyAt(Shard, nr), FullKey.Key, KEYSIZE);
+        *FlagsAt(Shard, nr) |= REC_VERIFIABLE;
+      };
+     Inserted=true;
+   };
+  pthread_rwlock_unlock(&(Shard->Lock));
+  return Inserted;
+}
+
 /***************************************************************/
-/* the following three routines implement a technique for      */
-/* assigning a search key to pairs of SWG basis functions in   */
-/* a translation-independent (but not rotation-indepedent) way */
+/* the following routines implement a technique for assigning  */
+/* a search key to pairs of SWG basis functions.               */
+/*                                                             */
+/* the FIBBI data for a BF pair are integrals of scalars       */
+/* (b_A \cdot b_B and div b_A div b_B times powers of |x-x'|), */
+/* so they are unchanged if the pair is translated, rotated,   */
+/* or reflected as a whole, if the two BFs are interchanged,   */
+/* or if the vertices of either face are relabeled. the key    */
+/* describes the pair in a canonical frame that removes all of */
+/* these freedoms, so congruent BF pairs anywhere in any mesh  */
+/* share a single cache record and no transformation of the    */
+/* cached data is needed.                                      */
+/*                                                             */
+/* the key coordinates are rounded to multiples of a quantum   */
+/* h, a power of 2 close to KeyTolerance*|QM_A - QP_A|, so     */
+/* pairs that differ by less than (roughly) that relative      */
+/* amount collide on purpose. setting KeyTolerance=0 restores  */
+/* the original translation-invariant-only keys.               */
 /***************************************************************/
+double FIBBICache::KeyTolerance=1.0e-6;
+
 static void inline VecSubFloat(double *V1, double *V2, float *V1mV2)
 { V1mV2[0] = (float)(V1[0] - V2[0]);
   V1mV2[1] = (float)(V1[1] - V2[1]);
   V1mV2[2] = (float)(V1[2] - V2[2]);
 }
 
-void GetFIBBICacheKey(SWGVolume *OA, int nfA,
-                      SWGVolume *OB, int nfB,
-                      float *K)
+static void GetTranslationInvariantKey(SWGVolume *OA, int nfA,
+                                       SWGVolume *OB, int nfB,
+                                       float *K)
 {
-
   double  *VA = OA->Vertices;
   SWGFace *FA = OA->Faces[nfA];
   double *QPA = VA + 3*(FA->iQP);
@@ -198,7 +443,123 @@ void GetFIBBICacheKey(SWGVolume *OA, int nfA,
   VecSubFloat(V1B, QPA, K + 6*3);
   VecSubFloat(V2B, QPA, K + 7*3);
   VecSubFloat(V3B, QPA, K + 8*3);
+}
+
+static int CompareTriples(const void *T1, const void *T2)
+{ return memcmp(T1, T2, 3*sizeof(float)); }
+
+/*--------------------------------------------------------------*/
+/*- canonical key for the ordered pair (A,B): the origin is QPA,*/
+/*- the first axis points from QPA to QMA, the second is fixed  */
+/*- by the first of (face centroid A, QPB, QMB, face centroid B)*/
+/*- not (nearly) on the first axis, and the sense of the third  */
+/*- is fixed by the first quantity in a similar list that is    */
+/*- odd under reflection.                                       */
+/*--------------------------------------------------------------*/
+static void GetCanonicalKey(SWGVolume *OA, int nfA,
+                            SWGVolume *OB, int nfB,
+                            float *K)
+{
+  SWGFace *FA = OA->Faces[nfA];
+  SWGFace *FB = OB->Faces[nfB];
+  double *QPA = OA->Vertices + 3*(FA->iQP);
+
+  // the nine points, relative to QPA, in the same order as
+  // in the translation-invariant key
+  double X[9][3];
+  int iV[9]={ FA->iQM, FA->iV1, FA->iV2, FA->iV3,
+              FB->iQP, FB->iQM, FB->iV1, FB->iV2, FB->iV3 };
+  for(int n=0; n<9; n++)
+   VecSub( (n<4 ? OA->Vertices : OB->Vertices) + 3*iV[n], QPA, X[n]);
+
+  double CA[3], CB[3];
+  VecSub(FA->Centroid, QPA, CA);
+  VecSub(FB->Centroid, QPA, CB);
+
+  double E1[3], E2[3], E3[3];
+  double L = VecNorm(X[0]);
+  for(int Mu=0; Mu<3; Mu++)
+   E1[Mu] = X[0][Mu] / L;
+  double Thresh = 1.0e-3*L;
+
+  // second axis
+  double *E2Candidates[4] = { CA, X[4], X[5], CB };
+  bool HaveE2=false;
+  for(int nc=0; nc<4 && !HaveE2; nc++)
+   { double *C=E2Candidates[nc];
+     double C1=VecDot(C,E1);
+     for(int Mu=0; Mu<3; Mu++)
+      E2[Mu] = C[Mu] - C1*E1[Mu];
+     double Norm=VecNorm(E2);
+     if (Norm>Thresh)
+      { VecScale(E2, 1.0/Norm);
+        HaveE2=true;
+      };
+   };
+  if (!HaveE2) // all points collinear; can't happen for valid tets
+   { GetTranslationInvariantKey(OA, nfA, OB, nfB, K);
+     return;
+   };
+  VecCross(E1, E2, E3);
+
+  // sense of third axis
+  double Sign=0.0;
+  double *E3Candidates[4] = { CA, X[4], X[5], CB };
+  for(int nc=0; nc<4 && Sign==0.0; nc++)
+   { double z=VecDot(E3Candidates[nc], E3);
+     if ( fabs(z)>Thresh ) Sign = (z>0.0 ? 1.0 : -1.0);
+   };
+  for(int nf=0; nf<2 && Sign==0.0; nf++)
+   { // sums over face vertices are independent of vertex labeling
+     double Sums[3]={0.0, 0.0, 0.0}, Scales[3];
+     for(int nv=0; nv<3; nv++)
+      { double *XV=X[1 + 5*nf + nv];
+        double z=VecDot(XV,E3);
+        Sums[0] += z*z*z;
+        Sums[1] += z*VecDot(XV,E1);
+        Sums[2] += z*VecDot(XV,E2);
+      };
+     Scales[0]=Thresh*Thresh*Thresh;
+     Scales[1]=Scales[2]=Thresh*L;
+     for(int ns=0; ns<3 && Sign==0.0; ns++)
+      if ( fabs(Sums[ns])>Scales[ns] ) Sign = (Sums[ns]>0.0 ? 1.0 : -1.0);
+   };
+  if (Sign<0.0)
+   VecScale(E3, -1.0);
+
+  // quantized coordinates in the canonical frame
+  double h = (FIBBICache::KeyTolerance*L > 0.0) ?
+              pow(2.0, floor(log2(FIBBICache::KeyTolerance*L))) : 0.0;
+  for(int n=0; n<9; n++)
+   { double x[3];
+     x[0]=VecDot(X[n],E1);
+     x[1]=VecDot(X[n],E2);
+     x[2]=VecDot(X[n],E3);
+     for(int Mu=0; Mu<3; Mu++)
+      K[3*n+Mu] = (float)(h*rint(x[Mu]/h)) + 0.0f; // +0.0f turns -0 into +0
+   };
+
+  // face vertices in lexicographic order
+  qsort(K + 1*3, 3, 3*sizeof(float), CompareTriples);
+  qsort(K + 6*3, 3, 3*sizeof(float), CompareTriples);
+}
+
+void GetFIBBICacheKey(SWGVolume *OA, int nfA,
+                      SWGVolume *OB, int nfB,
+                      float *K)
+{
+  if (FIBBICache::KeyTolerance<=0.0)
+   { GetTranslationInvariantKey(OA, nfA, OB, nfB, K);
+     return;
+   };
 
+  // the data are symmetric under A<->B, so use whichever
+  // ordering gives the smaller key
+  float KBA[KEYLEN];
+  GetCanonicalKey(OA, nfA, OB, nfB, K);
+  GetCanonicalKey(OB, nfB, OA, nfA, KBA);
+  if ( memcmp(KBA, K, KEYSIZE) < 0 )
+   memcpy(K, KBA, KEYSIZE);
 }
 
 /*--------------------------------------------------------------*/
@@ -208,6 +569,24 @@ void GetFIBBICacheKey(SWGVolume *OA, int nfA,
 /*- compute a new FIBBI data record for this panel pair and     */
 /*- add it to the table.                                        */
 /*--------------------------------------------------------------*/
+
+// copy the data out of record nr if they are ready; *Mismatch is
+// set if the full key stored with the record differs from FullKey
+// (a fingerprint collision). the caller must hold a lock.
+static bool ReadRecord(KDShard *S, unsigned long nr,
+                       const float *FullKey, double *Data, bool *Mismatch)
+{
+  *Mismatch=false;
+  unsigned char Flags=*FlagsAt(S, nr);
+  if ( !(Flags & REC_READY) )
+   return false;
+  if ( (Flags & REC_VERIFIABLE) && memcmp(FullKeyAt(S, nr), FullKey, KEYSIZE) )
+   *Mismatch=true;
+  else
+   memcpy(Data, RecordAt(S, nr) + S->KeySize, DATASIZE);
+  return true;
+}
+
 void FIBBICache::GetFIBBIData(SWGVolume *OA, int nfA,
                               SWGVolume *OB, int nfB,
                               double *Data)
@@ -215,33 +594,342 @@ void FIBBICache::GetFIBBIData(SWGVolume *OA, int nfA,
   /***************************************************************/
   /* look for this key in the cache ******************************/
   /***************************************************************/
-  KeyStruct Key;
-  GetFIBBICacheKey(OA, nfA, OB, nfB, Key.Key);
-
-  KDMap *KDM    = (KDMap *)opTable;
-  bool Found;
-  pthread_rwlock_rdlock(&lock);
-  KDMap::iterator p=KDM->find(Key);
-  Found = (p != (KDM->end()) );
-  if (Found) memcpy(Data, p->second.Data, DATASIZE);
-  pthread_rwlock_unlock(&lock);
-
-  if ( Found )
-   { Hits++;
+  KeyStruct FullKey;
+  GetFIBBICacheKey(OA, nfA, OB, nfB, FullKey.Key);
+  char Key[KEYSIZE];
+  MakeLookupKey(FullKey.Key, Key);
+
+  // records in a memory-mapped cache file are immutable, so
+  // they may be read without locking
+  if (NumMappedRecords>0)
+   { const char *Record=FindMappedRecord(Key);
+     if (Record)
+      { memcpy(Data, Record + KeySize, DATASIZE);
+        __sync_fetch_and_add(&Hits, 1);
+        return;
+      };
+   };
+
+  unsigned long h= GetKeyHash(Key, KeySize);
+  KDShard *Shard = GetShard(opTable, h);
+  bool Ready=false, Mismatch=false;
+  pthread_rwlock_rdlock(&(Shard->Lock));
+  long nr=FindRecord(Shard, Key, h);
+  if (nr!=-1)
+   { Ready=ReadRecord(Shard, nr, FullKey.Key, Data, &Mismatch);
+     if ( Ready && !(*FlagsAt(Shard, nr) & REC_REFERENCED) )
+      __sync_fetch_and_or(FlagsAt(Shard, nr), (unsigned char)REC_REFERENCED);
+   };
+  pthread_rwlock_unlock(&(Shard->Lock));
+
+  if ( Ready && !Mismatch )
+   { __sync_fetch_and_add(&Hits, 1);
      return;
    };
   
   /***************************************************************/
-  /* if it was not found, compute a new FIBBI data record and add*/
-  /* it to the cache                                             */
+  /* if it was not found, insert a placeholder record to claim   */
+  /* the key (unless another thread got there first), compute    */
+  /* the FIBBI data, and mark the record ready. (records never   */
+  /* move, so the index remains valid after we drop the lock.)   */
   /***************************************************************/
-  Misses++;
-  ComputeFIBBIData(OA, nfA, OB, nfB, Data);
-  DataStruct DS;
-  memcpy(DS.Data, Data, DATASIZE);
-  pthread_rwlock_wrlock(&lock);
-  KDM->insert( KDPair(Key,DS) );
-  pthread_rwlock_unlock(&lock);
+  bool Owner=false;
+  if (nr==-1)
+   { pthread_rwlock_wrlock(&(Shard->Lock));
+     if ( (nr=FindRecord(Shard, Key, h)) == -1 )
+      { nr=NewRecord(Shard, Key, h);
+        if (Shard->HaveFullKeys)
+         { memcpy(FullKeyAt(Shard, nr), FullKey.Key, KEYSIZE);
+           *FlagsAt(Shard, nr) |= REC_VERIFIABLE;
+         };
+        Owner=true;
+      };
+     pthread_rwlock_unlock(&(Shard->Lock));
+   };
+
+  if (Owner)
+   { if ( Backing && Backing->Lookup(FullKey.Key, Data) )
+      { __sync_fetch_and_add(&Hits, 1);
+        __sync_fetch_and_add(&BackingHits, 1);
+      }
+     else
+      { __sync_fetch_and_add(&Misses, 1);
+        ComputeFIBBIData(OA, nfA, OB, nfB, Data);
+        if (Backing)
+         Backing->Insert(FullKey.Key, Data);
+      };
+     pthread_rwlock_wrlock(&(Shard->Lock));
+     memcpy(RecordAt(Shard, nr) + KeySize, Data, DATASIZE);
+     *FlagsAt(Shard, nr) |= REC_READY;
+     pthread_rwlock_unlock(&(Shard->Lock));
+     pthread_mutex_lock(&(Shard->PendingMutex));
+     pthread_cond_broadcast(&(Shard->PendingCond));
+     pthread_mutex_unlock(&(Shard->PendingMutex));
+     return;
+   };
+
+  /***************************************************************/
+  /* otherwise another thread is computing this record; wait for */
+  /* it to finish. (the owner broadcasts while holding the mutex,*/
+  /* so a wakeup cannot slip in between our check and our wait.) */
+  /***************************************************************/
+  if (!Ready)
+   { pthread_mutex_lock(&(Shard->PendingMutex));
+     for(;;)
+      { pthread_rwlock_rdlock(&(Shard->Lock));
+        Ready=ReadRecord(Shard, nr, FullKey.Key, Data, &Mismatch);
+        pthread_rwlock_unlock(&(Shard->Lock));
+        if (Ready) break;
+        pthread_cond_wait(&(Shard->PendingCond), &(Shard->PendingMutex));
+      };
+     pthread_mutex_unlock(&(Shard->PendingMutex));
+   };
+
+  /***************************************************************/
+  /* a different BF pair with the same fingerprint owns the      */
+  /* record; compute ours directly without caching it            */
+  /***************************************************************/
+  if (Mismatch)
+   { if ( __sync_fetch_and_add(&Collisions, 1) == 0 )
+      Log("FC::G warning: FIBBI cache key fingerprint collision (recomputing)");
+     __sync_fetch_and_add(&Misses, 1);
+     ComputeFIBBIData(OA, nfA, OB, nfB, Data);
+     return;
+   };
+
+  __sync_fetch_and_add(&Hits, 1);
+}
+
+/*--------------------------------------------------------------*/
+/*- look up the record for a given full key without computing   */
+/*- it if it is absent (returns false in that case), and add a  */
+/*- record computed elsewhere. these are used when this cache   */
+/*- serves as the backing cache of other caches.                */
+/*--------------------------------------------------------------*/
+bool FIBBICache::Lookup(const float *FullKey, double *Data)
+{
+  char Key[KEYSIZE];
+  MakeLookupKey(FullKey, Key);
+
+  if (NumMappedRecords>0)
+   { const char *Record=FindMappedRecord(Key);
+     if (Record)
+      { memcpy(Data, Record + KeySize, DATASIZE);
+        return true;
+      };
+   };
+
+  unsigned long h= GetKeyHash(Key, KeySize);
+  KDShard *Shard = GetShard(opTable, h);
+  bool Ready=false, Mismatch=false;
+  pthread_rwlock_rdlock(&(Shard->Lock));
+  long nr=FindRecord(Shard, Key, h);
+  if (nr!=-1)
+   { Ready=ReadRecord(Shard, nr, FullKey, Data, &Mismatch);
+     if ( Ready && !(*FlagsAt(Shard, nr) & REC_REFERENCED) )
+      __sync_fetch_and_or(FlagsAt(Shard, nr), (unsigned char)REC_REFERENCED);
+   };
+  pthread_rwlock_unlock(&(Shard->Lock));
+  return Ready && !Mismatch;
+}
+
+void FIBBICache::Insert(const float *FullKey, const double *Data)
+{
+  char Record[KEYSIZE + DATASIZE];
+  memcpy(Record, FullKey, KEYSIZE);
+  memcpy(Record + KEYSIZE, Data, DATASIZE);
+  AddRecord(Record, KEYSIZE, 0);
+}
+
+/*--------------------------------------------------------------*/
+/*- bytes of memory used by the in-memory table (records mapped -*/
+/*- from a cache file live in the page cache and don't count)   -*/
+/*--------------------------------------------------------------*/
+size_t FIBBICache::MemoryUsage()
+{
+  KDShard *Shards = (KDShard *)opTable;
+  size_t Bytes=0;
+  for(int ns=0; ns<NUMSHARDS; ns++)
+   { pthread_rwlock_rdlock(&(Shards[ns].Lock));
+     Bytes +=   Shards[ns].Capacity*EntrySize(Shards+ns)
+              + Shards[ns].NumSlots*sizeof(uint32_t);
+     pthread_rwlock_unlock(&(Shards[ns].Lock));
+   };
+  return Bytes;
+}
+
+/*--------------------------------------------------------------*/
+/*- remove the records marked REC_EVICT from a shard, packing    */
+/*- the survivors together, and shrink its storage to match      */
+/*--------------------------------------------------------------*/
+static void PackShard(KDShard *S)
+{
+  unsigned long N=S->NumRecords, NewN=0, NewHand=0;
+  for(unsigned long nr=0; nr<N; nr++)
+   { if (nr==S->Hand) NewHand=NewN;
+     if ( *FlagsAt(S, nr) & REC_EVICT )
+      continue;
+     if (nr!=NewN)
+      memcpy(RecordAt(S, NewN), RecordAt(S, nr), EntrySize(S));
+     NewN++;
+   };
+  S->NumRecords = NewN;
+  S->Hand = (NewHand<NewN) ? NewHand : 0;
+
+  // free the chunks we no longer need, and shrink the last one
+  // to hold just the records in it
+  unsigned long NumChunks = (NewN + CHUNKRECORDS - 1) / CHUNKRECORDS;
+  for(unsigned long nc=NumChunks; nc<S->NumChunks; nc++)
+   free(S->Chunks[nc]);
+  S->NumChunks = NumChunks;
+  S->Capacity  = NewN;
+  if (NumChunks>0 && NewN < NumChunks*CHUNKRECORDS)
+   S->Chunks[NumChunks-1]
+    = (char *)reallocEC(S->Chunks[NumChunks-1],
+                        (NewN - (NumChunks-1)*CHUNKRECORDS)*EntrySize(S));
+
+  unsigned long NumSlots=64;
+  while( 4*NewN > 3*NumSlots ) NumSlots*=2;
+  RebuildSlots(S, NumSlots);
+}
+
+/*--------------------------------------------------------------*/
+/*- evict records from the in-memory table until it uses no more*/
+/*- than MaxBytes bytes; returns the number of records evicted. */
+/*-                                                             */
+/*- victims are chosen by the CLOCK algorithm: each shard has a */
+/*- hand that sweeps circularly over its records, sparing (and  */
+/*- clearing the REFERENCED bit of) records that have been      */
+/*- looked up since the hand last passed them. records that     */
+/*- are already on disk are evicted first, so records that      */
+/*- have not been Store()d are lost only if that is not enough. */
+/*- the surviving records are then packed together and the      */
+/*- slot table is rebuilt at the smaller size. since the slot   */
+/*- tables shrink in powers of 2, this may leave the table a    */
+/*- little over budget, in which case we go around again.       */
+/*-                                                             */
+/*- like Store() and PreLoad(), this must not be called while   */
+/*- other threads are using the cache.                          */
+/*--------------------------------------------------------------*/
+int FIBBICache::Trim(size_t MaxBytes)
+{
+  size_t Bytes=MemoryUsage();
+  int NumTableRecords=Size() - NumMappedRecords;
+  if (Bytes<=MaxBytes || NumTableRecords==0)
+   return 0;
+
+  KDShard *Shards = (KDShard *)opTable;
+  int NumEvicted=0, NumUnsaved=0;
+  size_t NewBytes=Bytes;
+  while(NewBytes>MaxBytes)
+   {
+     // the fraction of records to keep in each shard
+     double KeepFraction = ((double)MaxBytes) / ((double)NewBytes);
+
+     int NumEvictedThisRound=0;
+     for(int ns=0; ns<NUMSHARDS; ns++)
+      { 
+        KDShard *S=Shards+ns;
+        unsigned long N=S->NumRecords;
+        if (N==0) continue;
+        unsigned long NumToEvict = N - (unsigned long)(KeepFraction*N);
+
+        // sweep the hand at most twice around the shard per pass
+        for(int Pass=0; Pass<2 && NumToEvict>0; Pass++)
+         for(unsigned long Step=0; Step<2*N && NumToEvict>0; Step++)
+          { unsigned char *Flags=FlagsAt(S, S->Hand);
+            if (    (*Flags & REC_READY)
+                 && !(*Flags & REC_EVICT)
+                 && (Pass==1 || (*Flags & REC_JOURNALED))
+               )
+             { if (*Flags & REC_REFERENCED)
+                *Flags &= ~REC_REFERENCED;
+               else
+                { *Flags |= REC_EVICT;
+                  if ( !(*Flags & REC_JOURNALED) ) NumUnsaved++;
+                  NumToEvict--;
+                  NumEvictedThisRound++;
+                };
+             };
+            S->Hand = (S->Hand+1) % N;
+          };
+
+        PackShard(S);
+      };
+
+     NumEvicted+=NumEvictedThisRound;
+     NewBytes=MemoryUsage();
+     if (NumEvictedThisRound==0) // only empty slot tables left
+      break;
+   };
+
+  // the record counts no longer tell us whether the table has
+  // changed since the last Store(), so don't let Store() skip
+  if (NumEvicted>0)
+   RecordsWritten=RecordsPreloaded=0;
+
+  Log("FC::T Evicted %i FIBBI records (%i MB -> %i MB)",
+       NumEvicted, (int)(Bytes>>20), (int)(NewBytes>>20));
+  if (NumUnsaved>0)
+   Log("FC::T warning: %i of the evicted records had not been stored",NumUnsaved);
+  return NumEvicted;
+}
+
+/***************************************************************/
+/* compute (or look up) the FIBBI records for all pairs of     */
+/* touching BFs in O, in parallel.                             */
+/*                                                             */
+/* if NumShards>1, only the pairs whose cache keys hash to     */
+/* shard WhichShard are handled. since congruent pairs have    */
+/* identical keys, NumShards independent processes split the  */
+/* work without computing any record twice, and their cache    */
+/* files may then be combined with Merge().                    */
+/*                                                             */
+/* returns the number of BF pairs handled.                     */
+/***************************************************************/
+int FIBBICache::Precompute(SWGVolume *O, int NumShards, int WhichShard)
+{
+  if (NumShards<1 || WhichShard<0 || WhichShard>=NumShards)
+   ErrExit("invalid shard %i/%i in FIBBICache::Precompute",WhichShard,NumShards);
+
+  int NF=O->NumInteriorFaces;
+  int NumPairs=0;
+#ifdef USE_OPENMP
+  int NumThreads=GetNumThreads();
+  Log("FC::PC Computing FIBBI records for %s (shard %i/%i, %i threads)",
+       O->MeshFileName,WhichShard,NumShards,NumThreads);
+#pragma omp parallel for schedule(dynamic,1),      \
+                         reduction(+:NumPairs)     \
+                         num_threads(NumThreads)
+#else
+  Log("FC::PC Computing FIBBI records for %s (shard %i/%i)",
+       O->MeshFileName,WhichShard,NumShards);
+#endif
+  for(int nfa=0; nfa<NF; nfa++)
+   { 
+     LogPercent(nfa, NF, 10);
+     for(int nn=O->NeighborStart[nfa]; nn<O->NeighborStart[nfa+1]; nn++)
+      { 
+        int nfb=O->NeighborList[nn];
+        if (nfb<nfa) continue;
+
+        if (NumShards>1)
+         { KeyStruct Key;
+           GetFIBBICacheKey(O, nfa, O, nfb, Key.Key);
+           unsigned long h = (unsigned long)HashFunction(Key.Key);
+           if ( (int)((h>>8) % NumShards) != WhichShard )
+            continue;
+         };
+
+        double Data[FIBBIDATALEN];
+        GetFIBBIData(O, nfa, O, nfb, Data);
+        NumPairs++;
+      };
+   };
+
+  Log("FC::PC ...handled %i BF pairs (%i new records, cache size %i)",
+       NumPairs,Misses,Size());
+  return NumPairs;
 }
 
 /***************************************************************/
@@ -258,21 +946,91 @@ void FIBBICache::GetFIBBIData(SWGVolume *OA, int nfA,
 /*                                                             */
 /* the file format is pretty simple (and non-portable w.r.t.   */
 /* endianness):                                                */
-/*  bytes 0--12:   'FIBBI_GCACHE' + 0                          */
+/*  bytes 0--15:   'FIBBI_GSORTED' + 0 (padded with zeros)     */
+/*  bytes 16--23:  number of records (uint64_t)                */
+/*  bytes 24--31:  key length, DATALEN (uint32_t each)         */
 /*  next xx bytes:  first record                               */ 
 /*  next xx bytes:  second record                              */
 /*  ...             ...                                        */
 /*                                                             */
 /* where xx is the size of the record; each record consists of */
-/* a search key (KEYLEN float values) followed by the content  */
-/* of the FIBBI data record for that search key.               */
+/* a search key followed by the content of the FIBBI data      */
+/* record for that search key. the key is either the full key  */
+/* (key length = KEYLEN floats) or, for caches created with    */
+/* BUFF_CACHE_COMPACT_KEYS=1, its 128-bit fingerprint (key     */
+/* length = 4; see GetFingerprint). a compact-key cache reads  */
+/* full-key files by fingerprinting their keys, but not vice   */
+/* versa. records are                                          */
+/* sorted by key in memcmp() order, so the file can be mapped  */
+/* into memory read-only and searched in place by bisection;   */
+/* processes on one node that preload the same file share a    */
+/* single page-cached copy of it. records computed after the   */
+/* preload live in the in-memory table (the 'overlay') and are */
+/* merged with the mapped records by the next Store().         */
+/*                                                             */
+/* once a cache has been mapped from (or written to) its sorted*/
+/* file, subsequent Store()s do not rewrite the file; instead   */
+/* they append only the new records to a journal file named    */
+/* MeshFile.cache.journal and fsync() it. each journal record  */
+/* is a record as above followed by a 32-bit checksum; journal */
+/* records are replayed into the in-memory table by PreLoad(), */
+/* and a record that was only partly written (e.g. because the */
+/* process died mid-write) is simply ignored. the journal is   */
+/* merged into the sorted file and removed by a compacting     */
+/* Store() (e.g. 'buff-analyze --mesh X.vmsh --CompactGCache'),*/
+/* which should be run while no other process is using the     */
+/* cache.                                                      */
+/*                                                             */
+/* files in the older unsorted format (signature 'FIBBI_GCACHE'*/
+/* followed directly by the records) held 6-double records     */
+/* without the higher-order terms; they are recognized, but    */
+/* rejected by PreLoad() and Merge() with a message saying so. */
 /*                                                             */
 /* note: FIBBICF = 'FIBBI cache file'                          */
 /***************************************************************/
 const char FIBBICF_GSignature[]  = "FIBBI_GCACHE";
 #define FIBBICF_SIGSIZE (sizeof(FIBBICF_GSignature))
 
-void FIBBICache::Store(const char *MeshFileName)
+#define FIBBICF_SORTED_SIGSIZE 16
+const char FIBBICF_SortedSignature[FIBBICF_SORTED_SIGSIZE] = "FIBBI_GSORTED";
+
+typedef struct FIBBICFHeader
+ { char Signature[FIBBICF_SORTED_SIGSIZE];
+   uint64_t NumRecords;
+   uint32_t KeyLen, DataLen;
+ } FIBBICFHeader;
+
+static uint32_t JournalCheckSum(const char *Record, int RecordSize)
+{ return (uint32_t) JenkinsHash(Record, RecordSize); }
+
+/*--------------------------------------------------------------*/
+/*- bisection search for a key in the mapped record array       */
+/*--------------------------------------------------------------*/
+const char *FIBBICache::FindMappedRecord(const char *Key)
+{
+  unsigned long Lo=0, Hi=NumMappedRecords;
+  while(Lo<Hi)
+   { unsigned long Mid = Lo + (Hi-Lo)/2;
+     const char *Record = MappedRecords + Mid*RecordSize;
+     int Cmp=memcmp(Record, Key, KeySize);
+     if (Cmp<0)
+      Lo=Mid+1;
+     else if (Cmp>0)
+      Hi=Mid;
+     else
+      return Record;
+   };
+  return 0;
+}
+
+typedef struct RecordLessThan
+ { int KeySize;
+   RecordLessThan(int KS) : KeySize(KS) {}
+   bool operator()(const char *R1, const char *R2) const
+    { return memcmp(R1, R2, KeySize) < 0; }
+ } RecordLessThan;
+
+void FIBBICache::Store(const char *MeshFileName, bool Compact)
 {
   if (!MeshFileName)
    return;
@@ -287,7 +1045,16 @@ void FIBBICache::Store(const char *MeshFileName)
   else
    snprintf(FileName,MAXSTR,"%s/%s.cache",s,GetFileBase(MFNCopy));
 
-  KDMap *KDM = (KDMap *)opTable;
+  StoreAs(FileName, Compact);
+}
+
+/*--------------------------------------------------------------*/
+/*- like Store(), but with the name of the cache file itself    */
+/*- specified by the caller                                     */
+/*--------------------------------------------------------------*/
+void FIBBICache::StoreAs(const char *FileName, bool Compact)
+{
+  KDShard *Shards = (KDShard *)opTable;
 
   /*--------------------------------------------------------------*/
   /*- pause to check if the following conditions are satisfied:  -*/
@@ -300,13 +1067,25 @@ void FIBBICache::Store(const char *MeshFileName)
   /*- the cache since the operation would result in a cache dump -*/
   /*- file identical to the one that already exists.             -*/
   /*--------------------------------------------------------------*/
-  unsigned int NumRecords = KDM->size();
-  if (NumRecords==RecordsWritten)
+  unsigned int NumRecords = Size();
+
+  if (     !Compact
+       && ConvertedFromFullKeys
+       && PreloadFileName
+       && !strcmp(PreloadFileName, FileName)
+     )
+   { Log("FC::S warning: not overwriting full-key cache file %s with compact keys",FileName);
+     Log("FC::S (store with Compact=true, e.g. buff-analyze --CompactGCache, to convert it)");
+     return;
+   };
+
+  if (!Compact && NumRecords==RecordsWritten)
    { Log("FC::S FIBBI cache unchanged since last written to disk (skipping cache dump");
      return;
    };
 
-  if (     PreloadFileName
+  if (     !Compact
+       && PreloadFileName
        && !strcmp(PreloadFileName, FileName)
        && NumRecords==RecordsPreloaded
      )
@@ -320,42 +1099,274 @@ void FIBBICache::Store(const char *MeshFileName)
   /*--------------------------------------------------------------*/
   //FCLock.read_lock();
 
-  FILE *f=fopen(FileName,"w");
+  char JournalFileName[MAXSTR+20];
+  snprintf(JournalFileName,MAXSTR+20,"%s.journal",FileName);
+
+  /*--------------------------------------------------------------*/
+  /*- if the sorted file already holds everything but the records */
+  /*- computed since the last Store(), append those to the journal*/
+  /*--------------------------------------------------------------*/
+  if (     !Compact
+        && JournalEnabled
+        && PreloadFileName
+        && !strcmp(PreloadFileName, FileName)
+     )
+   { if ( AppendToJournal(JournalFileName)==0 )
+      RecordsWritten=NumRecords;
+     return;
+   };
+
+  // pick up any journal records missing from the table (those
+  // appended by other processes since our preload, and those we
+  // have evicted since), since the journal goes away below
+  ReplayJournal(FileName, ConvertedFromFullKeys ? KEYSIZE : KeySize);
+
+  // we write to a temporary file and rename it at the end, since
+  // FileName may be the file currently mapped by this (or some
+  // other) process
+  char TmpFileName[MAXSTR+20];
+  snprintf(TmpFileName,MAXSTR+20,"%s.%i.tmp",FileName,(int)getpid());
+  FILE *f=fopen(TmpFileName,"w");
   if (!f)
-   { Log("FC::S warning: could not open file %s (aborting cache dump)...",FileName);
+   { Log("FC::S warning: could not open file %s (aborting cache dump)...",TmpFileName);
      return;
    };
   Log("FC::S Writing FIBBI cache to file %s...",FileName);
 
   /*---------------------------------------------------------------------*/
-  /*- write file signature ----------------------------------------------*/
+  /*- sort the keys of the in-memory records ----------------------------*/
   /*---------------------------------------------------------------------*/
-  fwrite(FIBBICF_GSignature, FIBBICF_SIGSIZE,1,f);
+  unsigned long NumOverlay=0;
+  for(int ns=0; ns<NUMSHARDS; ns++)
+   NumOverlay+=Shards[ns].NumRecords;
+  const char **Overlay = new const char *[NumOverlay];
+  NumOverlay=0;
+  for(int ns=0; ns<NUMSHARDS; ns++)
+   for(unsigned long nr=0; nr<Shards[ns].NumRecords; nr++)
+    if ( *FlagsAt(Shards+ns, nr) & REC_READY )
+     Overlay[NumOverlay++] = RecordAt(Shards+ns, nr);
+  std::sort(Overlay, Overlay+NumOverlay, RecordLessThan(KeySize));
 
   /*---------------------------------------------------------------------*/
-  /*- iterate through the table and write entries to the file one-by-one */
+  /*- write the header, then merge the mapped and in-memory records -----*/
   /*---------------------------------------------------------------------*/
+  FIBBICFHeader Header;
+  memset(&Header, 0, sizeof(Header));
+  memcpy(Header.Signature, FIBBICF_SortedSignature, FIBBICF_SORTED_SIGSIZE);
+  Header.NumRecords = NumMappedRecords + NumOverlay;
+  Header.KeyLen     = KeySize/sizeof(float);
+  Header.DataLen    = DATALEN;
+  bool WriteError = (1 != fwrite(&Header, sizeof(Header), 1, f));
+
   RecordsWritten=0;
-  KDMap::iterator it;
-  for ( it = KDM->begin(); it != KDM->end(); it++ )
+  unsigned long nm=0, no=0;
+  while( !WriteError && (nm<NumMappedRecords || no<NumOverlay) )
    { 
-     const float *Key   = it->first.Key;
-     double *Data = it->second.Data;
-     if (    (1 != fwrite(Key,  KEYSIZE,  1, f )) 
-          || (1 != fwrite(Data, DATASIZE, 1, f ))
-        ) break;
-     RecordsWritten++;
+     const char *Record = (nm<NumMappedRecords) ? MappedRecords + nm*RecordSize : 0;
+     if ( Record && no<NumOverlay && memcmp(Overlay[no], Record, KeySize) < 0 )
+      Record=0;
+
+     if (Record)
+      nm++;
+     else
+      Record=Overlay[no++];
+     WriteError = (1 != fwrite(Record, RecordSize, 1, f));
+     if (!WriteError) RecordsWritten++;
    };
+  delete[] Overlay;
 
   /*---------------------------------------------------------------------*/
   /*- and that's it -----------------------------------------------------*/
   /*---------------------------------------------------------------------*/
-  fclose(f);
+  if ( fflush(f)!=0 || fsync(fileno(f))!=0 ) WriteError=true;
+  if ( fclose(f)!=0 ) WriteError=true;
+  if (WriteError)
+   { Log("FC::S warning: write to %s failed (aborting cache dump)",TmpFileName);
+     unlink(TmpFileName);
+     RecordsWritten=0;
+     return;
+   };
+  if ( rename(TmpFileName, FileName) )
+   { Log("FC::S warning: could not rename %s to %s (aborting cache dump)",TmpFileName,FileName);
+     unlink(TmpFileName);
+     RecordsWritten=0;
+     return;
+   };
   Log("FC::S ...wrote %i/%i FIBBI records.",RecordsWritten,NumRecords);
 
+  // serve the records from the file we just wrote instead of
+  // keeping a second copy of them in the table (this also keeps
+  // records that Trim() evicts later in the file)
+  int fd=open(FileName, O_RDONLY);
+  if (    fd>=0
+       && MapSortedFile(fd, FileName,
+                        sizeof(FIBBICFHeader) + ((size_t)RecordsWritten)*RecordSize,
+                        RecordsWritten)==0
+     )
+   { for(int ns=0; ns<NUMSHARDS; ns++)
+      { KDShard *S=Shards+ns;
+        for(unsigned long nr=0; nr<S->NumRecords; nr++)
+         if ( *FlagsAt(S, nr) & REC_READY )
+          *FlagsAt(S, nr) |= REC_EVICT;
+        PackShard(S);
+      };
+   };
+  if (fd>=0) close(fd);
+
+  // the sorted file now contains every record we have (including
+  // any that were in the journal), so the journal can go, and
+  // later Store()s need only append to a fresh journal
+  unlink(JournalFileName);
+  for(int ns=0; ns<NUMSHARDS; ns++)
+   for(unsigned long nr=0; nr<Shards[ns].NumRecords; nr++)
+    if ( *FlagsAt(Shards+ns, nr) & REC_READY )
+     *FlagsAt(Shards+ns, nr) |= REC_JOURNALED;
+  ConvertedFromFullKeys=false;
+  if (PreloadFileName)
+   free(PreloadFileName);
+  PreloadFileName=strdupEC(FileName);
+  RecordsPreloaded=RecordsWritten;
+  JournalEnabled=true;
+
   //FCLock.read_unlock();
 }
 
+/*--------------------------------------------------------------*/
+/*- append all records not yet on disk to the journal file;     */
+/*- returns 0 on success, nonzero on failure.                   */
+/*- the file is opened with O_APPEND and each record goes out   */
+/*- in a single write(), so several processes may append to the */
+/*- same journal concurrently.                                  */
+/*--------------------------------------------------------------*/
+int FIBBICache::AppendToJournal(const char *JournalFileName)
+{
+  int fd=open(JournalFileName, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd<0)
+   { Log("FC::S warning: could not open file %s (aborting cache dump)...",JournalFileName);
+     return 1;
+   };
+
+  KDShard *Shards = (KDShard *)opTable;
+  int NumAppended=0;
+  bool WriteError=false;
+  int JRecordSize = RecordSize + sizeof(uint32_t);
+  char Record[KEYSIZE + DATASIZE + sizeof(uint32_t)];
+  for(int ns=0; ns<NUMSHARDS && !WriteError; ns++)
+   for(unsigned long nr=0; nr<Shards[ns].NumRecords; nr++)
+    { 
+      if ( (*FlagsAt(Shards+ns, nr) & (REC_READY|REC_JOURNALED)) != REC_READY )
+       continue;
+      memcpy(Record, RecordAt(Shards+ns, nr), RecordSize);
+      uint32_t CheckSum=JournalCheckSum(Record, RecordSize);
+      memcpy(Record + RecordSize, &CheckSum, sizeof(uint32_t));
+      if ( write(fd, Record, JRecordSize) != (ssize_t)JRecordSize )
+       { WriteError=true;
+         break;
+       };
+      NumAppended++;
+    };
+
+  if ( fsync(fd)!=0 ) WriteError=true;
+  close(fd);
+  if (WriteError)
+   { Log("FC::S warning: write to %s failed (%i records appended)",JournalFileName,NumAppended);
+     return 1;
+   };
+
+  // only now that the records are known to be on disk do we
+  // mark them as such
+  for(int ns=0; ns<NUMSHARDS; ns++)
+   for(unsigned long nr=0; nr<Shards[ns].NumRecords; nr++)
+    if ( *FlagsAt(Shards+ns, nr) & REC_READY )
+     *FlagsAt(Shards+ns, nr) |= REC_JOURNALED;
+
+  Log("FC::S Appended %i FIBBI records to %s.",NumAppended,JournalFileName);
+  return 0;
+}
+
+/*--------------------------------------------------------------*/
+/*- read the journal file (if any) belonging to cache file      */
+/*- FileName into the in-memory table; returns the number of    */
+/*- records replayed.                                           */
+/*--------------------------------------------------------------*/
+int FIBBICache::ReplayJournal(const char *FileName, int FileKeySize)
+{
+  char JournalFileName[MAXSTR+20];
+  snprintf(JournalFileName,MAXSTR+20,"%s.journal",FileName);
+  FILE *f=fopen(JournalFileName,"r");
+  if (!f)
+   return 0;
+
+  int FileRecordSize = FileKeySize + DATASIZE;
+  int JRecordSize = FileRecordSize + sizeof(uint32_t);
+  int NumReplayed=0, NumCorrupt=0;
+  long NumComplete=0;
+  char Record[KEYSIZE + DATASIZE + sizeof(uint32_t)];
+  while( fread(Record, JRecordSize, 1, f)==1 )
+   { 
+     NumComplete++;
+     uint32_t CheckSum;
+     memcpy(&CheckSum, Record + FileRecordSize, sizeof(uint32_t));
+     if ( CheckSum != JournalCheckSum(Record, FileRecordSize) )
+      { NumCorrupt++;
+        continue;
+      };
+     if ( AddRecord(Record, FileKeySize, REC_JOURNALED) )
+      NumReplayed++;
+   };
+
+  // a partial record at the end of the journal is left over from
+  // an interrupted append; chop it off so that later appends stay
+  // aligned on record boundaries
+  off_t CompleteSize = NumComplete*((off_t)JRecordSize);
+  struct stat JournalStats;
+  if ( fstat(fileno(f), &JournalStats)==0 && JournalStats.st_size > CompleteSize )
+   { Log("FC::P warning: discarding partial record at end of %s",JournalFileName);
+     if ( truncate(JournalFileName, CompleteSize) )
+      Log("FC::P warning: could not truncate %s",JournalFileName);
+   };
+  fclose(f);
+
+  Log("FC::P Replayed %i FIBBI records from journal %s.",NumReplayed,JournalFileName);
+  if (NumCorrupt>0)
+   Log("FC::P warning: skipped %i corrupt records in %s",NumCorrupt,JournalFileName);
+  return NumReplayed;
+}
+
+/*--------------------------------------------------------------*/
+/*- map a cache file in the sorted format into memory; returns  */
+/*- 0 on success, nonzero on failure                            */
+/*--------------------------------------------------------------*/
+int FIBBICache::MapSortedFile(int fd, const char *FileName,
+                              size_t FileSize, unsigned long NumRecords)
+{
+  if ( FileSize != sizeof(FIBBICFHeader) + NumRecords*RecordSize )
+   { Log("FC::P warning: file %s: cache file has incorrect size (skipping cache preload)",FileName);
+     return 1;
+   };
+
+  void *Region=mmap(0, FileSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (Region==MAP_FAILED)
+   { Log("FC::P warning: could not map file %s (skipping cache preload)",FileName);
+     return 1;
+   };
+
+  if (MappedRegion)
+   munmap(MappedRegion, MappedLength);
+  MappedRegion     = Region;
+  MappedLength     = FileSize;
+  MappedRecords    = ((const char *)Region) + sizeof(FIBBICFHeader);
+  NumMappedRecords = NumRecords;
+
+  if (PreloadFileName)
+   free(PreloadFileName);
+  PreloadFileName=strdupEC(FileName);
+  RecordsPreloaded=NumRecords;
+
+  Log("FC::P Mapped %lu FIBBI records from file %s.",NumRecords,FileName);
+  return 0;
+}
+
 // return 0 on success, nonzero on failure
 int FIBBICache::PreLoad(const char *FileName)
 {
@@ -369,8 +1380,7 @@ int FIBBICache::PreLoad(const char *FileName)
      return 1;
    };
 
-  KDMap *KDM       = (KDMap *)opTable;
-  int RecordSize   = KEYSIZE + DATASIZE;
+  int FileKeySize  = KEYSIZE;
   int NumRecords   = 0; 
   int RecordsRead  = 0;
   unsigned long M0 = GetMemoryUsage();
@@ -386,29 +1396,56 @@ int FIBBICache::PreLoad(const char *FileName)
    { ErrMsg="invalid cache file";
      goto fail;
    };
-  
-  // check that the file signature is present and has the right size 
-  FileSize=fileStats.st_size;
-  char FileSignature[FIBBICF_SIGSIZE]; 
-  if ( (FileSize < ((signed int )FIBBICF_SIGSIZE)) )
-   { ErrMsg="invalid cache file";
-     goto fail;
-   };
-  if ( 1!=fread(FileSignature, FIBBICF_SIGSIZE, 1, f) )
-   { ErrMsg="invalid cache file";
-     goto fail;
-   };
 
-  // check that the file signature is one that we recognize
-  if ( strcmp(FileSignature, FIBBICF_GSignature)  )
-   { ErrMsg="invalid cache file";
-     goto fail;
+  // files in the sorted format are mapped, not read
+  if ( fileStats.st_size >= (off_t)sizeof(FIBBICFHeader) )
+   { FIBBICFHeader Header;
+     if (    1==fread(&Header, sizeof(Header), 1, f)
+          && !memcmp(Header.Signature, FIBBICF_SortedSignature, FIBBICF_SORTED_SIGSIZE)
+        )
+      { 
+        FileKeySize = Header.KeyLen*sizeof(float);
+        if (    Header.DataLen!=DATALEN
+             || (FileKeySize!=KeySize && FileKeySize!=KEYSIZE)
+           )
+         { ErrMsg="cache file has incompatible record size";
+           goto fail;
+         };
+
+        if (FileKeySize==KeySize)
+         { int Status=MapSortedFile(fileno(f), FileName, fileStats.st_size,
+                                    (unsigned long)Header.NumRecords);
+           fclose(f);
+           if (Status==0)
+            { RecordsPreloaded += ReplayJournal(FileName, KeySize);
+              JournalEnabled=true;
+            };
+           return Status;
+         };
+
+        // a full-key file read by a compact-key cache: the keys
+        // must be converted, so the records are read into the table
+        FileSize=fileStats.st_size - sizeof(FIBBICFHeader);
+        goto readrecords;
+      };
+     rewind(f);
    };
+  
+  // files in the older unsorted format (signature FIBBI_GCACHE
+  // followed directly by the records) cannot be used; their
+  // records lack the higher-order terms of the current data
+  char FileSignature[FIBBICF_SIGSIZE];
+  if (    fileStats.st_size >= (off_t)FIBBICF_SIGSIZE
+       && 1==fread(FileSignature, FIBBICF_SIGSIZE, 1, f)
+       && !strcmp(FileSignature, FIBBICF_GSignature)
+     )
+   ErrMsg="cache file is in the obsolete unsorted format (delete it to regenerate)";
+  else
+   ErrMsg="invalid cache file";
+  goto fail;
 
-  // the file size, minus the portion taken up by the signature,
-  // should be an integer multiple of the size of a (Key,Data) pair
-  FileSize-=FIBBICF_SIGSIZE;
-  if ( (FileSize % RecordSize)!=0 )
+ readrecords:
+  if ( (FileSize % (KEYSIZE + DATASIZE))!=0 )
    { ErrMsg="cache file has incorrect size";
      goto fail;
    };
@@ -418,23 +1455,19 @@ int FIBBICache::PreLoad(const char *FileName)
   /*- them to the table.                                          */
   /*--------------------------------------------------------------*/
   Log("FC::P Preloading FIBBI records from file %s...",FileName);
-  NumRecords = FileSize / RecordSize;
+  NumRecords = FileSize / (KEYSIZE + DATASIZE);
   for(int nr=0; nr<NumRecords; nr++)
    { 
-     KeyStruct Key;
-     DataStruct Data; 
-     
-     if (    (fread( Key.Key,    KEYSIZE,  1, f) != 1)
-          || (fread( Data.Data,  DATASIZE, 1, f) != 1)
-        )
+     char Record[KEYSIZE + DATASIZE];
+     if ( fread(Record, KEYSIZE + DATASIZE, 1, f) != 1 )
       { Log("FC::P file %s: read only %i/%i records",FileName,RecordsRead,NumRecords);
         fclose(f);
 	return 1;
       };
-  
-     KDM->insert( KDPair(Key,Data) );
+     AddRecord(Record, KEYSIZE, 0);
      RecordsRead++;
    };
+  ConvertedFromFullKeys = UseCompactKeys;
 
   /*--------------------------------------------------------------*/
   /* the most recent file from which we preloaded, and the number */
@@ -462,14 +1495,73 @@ int FIBBICache::PreLoad(const char *FileName)
   return 1;
 }
 
+/*--------------------------------------------------------------*/
+/*- add to the in-memory table all records in cache file        */
+/*- FileName (in either format) that are not already present.   */
+/*- returns the number of records added, or -1 if the file      */
+/*- could not be read.                                          */
+/*--------------------------------------------------------------*/
+int FIBBICache::Merge(const char *FileName)
+{
+  FILE *f=fopen(FileName,"r");
+  if (!f)
+   { Log("FC::M could not open file %s (skipping merge)",FileName);
+     return -1;
+   };
+
+  // skip past the header
+  FIBBICFHeader Header;
+  char LegacySignature[FIBBICF_SIGSIZE];
+  int FileKeySize=KEYSIZE;
+  if (    1==fread(&Header, sizeof(Header), 1, f)
+       && !memcmp(Header.Signature, FIBBICF_SortedSignature, FIBBICF_SORTED_SIGSIZE)
+       && Header.DataLen==DATALEN
+       && (    (FileKeySize=Header.KeyLen*sizeof(float))==KEYSIZE
+            || FileKeySize==KeySize
+          )
+     )
+   ; 
+  else if (    !fseek(f, 0, SEEK_SET)
+            && 1==fread(LegacySignature, FIBBICF_SIGSIZE, 1, f)
+            && !strcmp(LegacySignature, FIBBICF_GSignature)
+          )
+   { Log("FC::M warning: %s is in the obsolete unsorted cache format (skipping merge)",FileName);
+     fclose(f);
+     return -1;
+   }
+  else
+   { Log("FC::M warning: %s is not a valid cache file (skipping merge)",FileName);
+     fclose(f);
+     return -1;
+   };
+
+  int NumRead=0, NumAdded=0;
+  char Record[KEYSIZE + DATASIZE];
+  while( fread(Record, FileKeySize + DATASIZE, 1, f)==1 )
+   { NumRead++;
+     if ( AddRecord(Record, FileKeySize, 0) )
+      NumAdded++;
+   };
+  fclose(f);
+
+  Log("FC::M Merged %i/%i FIBBI records from %s.",NumAdded,NumRead,FileName);
+  return NumAdded;
+}
+
 /*--------------------------------------------------------------*/
 /*--------------------------------------------------------------*/
 /*--------------------------------------------------------------*/
 int FIBBICache::Size()
 { 
   if (opTable==0) return -1;
-  KDMap *KDM = (KDMap *)opTable;
-  return KDM->size();
+  KDShard *Shards = (KDShard *)opTable;
+  int NumRecords=NumMappedRecords;
+  for(int ns=0; ns<NUMSHARDS; ns++)
+   { pthread_rwlock_rdlock(&(Shards[ns].Lock));
+     NumRecords += Shards[ns].NumRecords;
+     pthread_rwlock_unlock(&(Shards[ns].Lock));
+   };
+  return NumRecords;
 
 }
 
@@ -40,8 +40,12 @@
 
 using namespace scuff;
 
-// length of a FIBBI data record in units of sizeof(double)
-#define FIBBIDATALEN 6
+// a FIBBI data record holds the coefficients D^n, S^n of the
+// expansion of the static-kernel integrals in powers of ik
+// (see GTaylorSeries.cc) for n=0..FIBBI_MAXORDER, stored as
+// D0,S0,D1,S1,...; its length in units of sizeof(double) is
+#define FIBBI_MAXORDER 6
+#define FIBBIDATALEN (2*(FIBBI_MAXORDER+1))
 
 namespace buff { 
 
@@ -73,11 +77,57 @@ class FIBBICache
     // get the number of records
     int Size();
 
-    // store/retrieve cache to/from binary file
-    void Store(const char *FileName);
+    // store/retrieve cache to/from binary file; unless Compact is
+    // true, a Store() to the file from which the cache was loaded
+    // appends the new records to a journal instead of rewriting it
+    void Store(const char *FileName, bool Compact=false);
+    void StoreAs(const char *CacheFileName, bool Compact=false);
     int PreLoad(const char *FileName);
 
-    int Hits, Misses;
+    // memory used by the in-memory table, and eviction of records
+    // (least recently used first, approximately) until it fits in
+    // MaxBytes. Trim() may not be called concurrently with lookups.
+    size_t MemoryUsage();
+    int Trim(size_t MaxBytes);
+
+    // a backing cache is consulted before computing a record that
+    // is missing from this cache, and receives a copy of each
+    // record that this cache computes; it is used to share records
+    // between the caches of different meshes
+    void SetBackingCache(FIBBICache *B) { Backing=B; }
+    bool Lookup(const float *FullKey, double Data[FIBBIDATALEN]);
+    void Insert(const float *FullKey, const double Data[FIBBIDATALEN]);
+
+    // compute records for all touching BF pairs in O (optionally
+    // only those in one of NumShards disjoint shards), and merge
+    // records from another cache file into this one
+    int Precompute(SWGVolume *O, int NumShards=1, int WhichShard=0);
+    int Merge(const char *FileName);
+
+    // lookup statistics; updated atomically, so they are exact
+    // even when the cache is shared by many threads. a lookup that
+    // waits for another thread to finish computing the same record
+    // counts as a hit. Collisions counts lookups whose key
+    // fingerprint matched that of a different BF pair (only
+    // detected with VerifyKeys). BackingHits counts the hits that
+    // were satisfied by the backing cache.
+    int Hits, Misses, Collisions, BackingHits;
+
+    // relative tolerance below which geometrically different
+    // BF pairs share a cache key (0 = keys are only translation-
+    // invariant, not rotation- and reflection-invariant)
+    static double KeyTolerance;
+
+    // if CompactKeys is true, caches created subsequently index
+    // records by a 128-bit fingerprint of the key instead of the
+    // full 108-byte key, cutting the memory per record by more
+    // than half.
+    // if VerifyKeys is also true, the full keys of records computed
+    // in this run (or read from full-key cache files) are retained
+    // as well, and fingerprint collisions are detected and resolved
+    // by recomputing
+    static bool CompactKeys;
+    static bool VerifyKeys;
 
   private:
 
@@ -85,10 +135,41 @@ class FIBBICache
     // storage table, but to allow maximal flexibility in implementation
     // i am just going to store an opaque pointer to this table
     // in the class body, with all the details left up to the
-    // implementation
+    // implementation (currently an array of independently-locked
+    // shards)
     void *opTable;
-
-    pthread_rwlock_t lock;
+    FIBBICache *Backing;
+
+    // size in bytes of the keys in the table and in cache files
+    // written by this cache, and of a (key, data) record
+    bool UseCompactKeys;
+    int KeySize, RecordSize;
+    void MakeLookupKey(const float *FullKey, char *Key);
+    bool AddRecord(const char *FileRecord, int FileKeySize,
+                   unsigned char Flags);
+
+    // records preloaded from a cache file in the sorted format
+    // are not copied into the table; instead the file is mapped
+    // read-only and searched in place, and the table holds only
+    // records computed since the preload
+    void *MappedRegion;
+    size_t MappedLength;
+    const char *MappedRecords;
+    unsigned long NumMappedRecords;
+    const char *FindMappedRecord(const char *Key);
+    int MapSortedFile(int fd, const char *FileName,
+                      size_t FileSize, unsigned long NumRecords);
+
+    // true if the sorted file named PreloadFileName holds every
+    // record not marked as journaled, so that Store() may append
+    // to the journal instead of rewriting the file
+    bool JournalEnabled;
+    int AppendToJournal(const char *JournalFileName);
+    int ReplayJournal(const char *FileName, int FileKeySize);
+
+    // true if the table was filled by converting the full keys in
+    // the cache file named PreloadFileName to fingerprints
+    bool ConvertedFromFullKeys;
 
     char *PreloadFileName;
     unsigned int RecordsPreloaded;
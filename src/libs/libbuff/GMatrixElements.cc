@@ -42,15 +42,26 @@
 #  include <omp.h>
 #endif
 
+/***************************************************************/
+/* glibc only declares the SIMD versions of exp, sin, and cos  */
+/* in libmvec when compiling with -ffast-math. we declare them */
+/* ourselves so that the omp simd loops in the batched kernels */
+/* below call the vector routines without changing the         */
+/* floating-point semantics of the rest of the file.           */
+/***************************************************************/
+#if defined(USE_OPENMP) && defined(HAVE_LIBMVEC) && defined(__GNUC__) && defined(__x86_64__)
+extern "C" {
+double exp(double) __THROW __attribute__((__simd__("notinbranch")));
+double sin(double) __THROW __attribute__((__simd__("notinbranch")));
+double cos(double) __THROW __attribute__((__simd__("notinbranch")));
+}
+#endif
+
 using namespace scuff;
 namespace buff {
 
 #define II cdouble(0.0,1.0)
 
-#define KERNEL_HELMHOLTZ 0
-#define KERNEL_DESINGULARIZED 1
-#define KERNEL_STATIC    2
-
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
@@ -167,24 +178,215 @@ void GMEIntegrand(double *xA, double *bA, double DivbA,
 }
 
 /***************************************************************/
-/* Use the Taylor-Duffy method to compute the contribution of  */
-/* a single tetrahedron-tetrahedron pair to the matrix         */
-/* element of G.                                               */
+/* batched versions of the kernel evaluations in GMEIntegrand. */
+/*                                                             */
+/* The point-by-point integrand above is called through a      */
+/* function pointer, branches on the kernel type and works in  */
+/* complex arithmetic, none of which the compiler can          */
+/* vectorize. The routines below instead take packets of up to */
+/* GME_PACKETSIZE cubature-point pairs in structure-of-arrays  */
+/* layout and evaluate the kernel in real arithmetic in loops  */
+/* that are compiled to SIMD instructions (AVX2/AVX-512 where  */
+/* the target supports them).                                  */
 /***************************************************************/
-cdouble GetGMETTI_TaylorDuffy(SWGVolume *OA, int OVIA[4], int iQA,
-                              SWGVolume *OB, int OVIB[4], int iQB,
-                              int WhichKernel, 
-                              cdouble k, int ncv, cdouble *TTI=0)
+
+// for |kr| below this threshold the desingularized kernel
+// e^{ikr} - 1 - ikr - (ikr)^2/2 suffers from cancellation and
+// is recomputed on the scalar path using its series expansion
+#define DESING_SERIES_THRESHOLD 0.5
+
+/***************************************************************/
+/* RePhi[n] + i*ImPhi[n] = Phi(r[n]) for n=0..N-1, where       */
+/*  Phi(r) = e^{ikr} / (4 pi r)                  (HELMHOLTZ)   */
+/*  Phi(r) = \sum_{n>=3} (ikr)^n/n! / (4 pi r)   (DESINGULARIZED)*/
+/* and Phi=0 for r<1e-12.                                      */
+/***************************************************************/
+void GetPhiBatch(int N, cdouble k, int WhichKernel, const double *r,
+                 double *RePhi, double *ImPhi)
 {
-  /*-----------------------------------------------------------*/
-  /* initialize Taylor-Duffy argument structure                */
-  /*-----------------------------------------------------------*/
-  TTDArgStruct MyArgs, *Args=&MyArgs;
-  InitTTDArgs(Args);
+  double kr=real(k), ki=imag(k);
+
+  // the cos and sin factors are computed in separate loops to keep
+  // the compiler from fusing them into a (non-vectorizable) sincos.
+  // the loops have no branches (which would keep them from being
+  // vectorized); as in GMEBatchIntegrate, points with r<1e-12 get
+  // a zero prefactor and a nonzero denominator, so that they yield
+  // Phi=0 without an inf*0 along the way
+#ifdef USE_OPENMP
+#pragma omp simd
+#endif
+  for(int n=0; n<N; n++)
+   { double rn     = r[n];
+     double Mask   = (rn < 1.0e-12) ? 0.0 : 1.0;
+     double rSafe  = rn + (1.0-Mask);
+     double Mag    = Mask*exp(-ki*rn)/(4.0*M_PI*rSafe);
+     RePhi[n]      = Mag*cos(kr*rn);
+     ImPhi[n]      = Mag;
+   };
+#ifdef USE_OPENMP
+#pragma omp simd
+#endif
+  for(int n=0; n<N; n++)
+   ImPhi[n] *= sin(kr*r[n]);
+
+  if (WhichKernel!=KERNEL_DESINGULARIZED)
+   return;
+
+  // subtract the first three terms in the expansion of e^{ikr}
+#ifdef USE_OPENMP
+#pragma omp simd
+#endif
+  for(int n=0; n<N; n++)
+   { double rn     = r[n];
+     double Mask   = (rn < 1.0e-12) ? 0.0 : 1.0;
+     double rSafe  = rn + (1.0-Mask);
+     double OO4PiR = Mask/(4.0*M_PI*rSafe);
+     double a      = -ki*rn, b = kr*rn; // ikr = a + ib
+     RePhi[n]     -= OO4PiR*(1.0 + a + 0.5*(a*a-b*b));
+     ImPhi[n]     -= OO4PiR*(b + a*b);
+   };
+
+  // scalar fallback for small |kr|, where the subtraction cancels
+  double AbsK=abs(k);
+  for(int n=0; n<N; n++)
+   { if ( r[n]<1.0e-12 || AbsK*r[n]>=DESING_SERIES_THRESHOLD )
+      continue;
+     cdouble ExpFac[1];
+     GetExpRelTable(II*k*r[n], 3, 3, ExpFac);
+     cdouble Phi = ExpFac[0] / (4.0*M_PI*r[n]);
+     RePhi[n] = real(Phi);
+     ImPhi[n] = imag(Phi);
+   };
+}
 
+/***************************************************************/
+/* Result += \sum_n W[n] * K(r[n]) where K is the GMEIntegrand */
+/* kernel for the given DotProduct[n]=b_A\cdot b_B and         */
+/* ScalarProduct=(Div b_A)(Div b_B) (which is constant for     */
+/* SWG functions over a pair of tetrahedra).                   */
+/*                                                             */
+/* Result has the same layout as the output of GMEIntegrand:   */
+/* 2 doubles (1 cdouble) for the HELMHOLTZ and DESINGULARIZED  */
+/* kernels, 6 doubles for the STATIC kernel.                   */
+/***************************************************************/
+void GMEBatchIntegrate(int N, cdouble k, int WhichKernel,
+                       const double *r, const double *W,
+                       const double *DotProduct, double ScalarProduct,
+                       double *Result)
+{
+  if (WhichKernel==KERNEL_STATIC)
+   {
+     double S0D=0.0, S0S=0.0, S1D=0.0, S1S=0.0, S2D=0.0, S2S=0.0;
+#ifdef USE_OPENMP
+#pragma omp simd reduction(+:S0D,S0S,S1D,S1S,S2D,S2S)
+#endif
+     for(int n=0; n<N; n++)
+      { // a single select between constants keeps the loop
+        // branch-free, so that it vectorizes; points with r<1e-12
+        // get zero weight and a nonzero denominator
+        double rn    = r[n];
+        double Mask  = (rn < 1.0e-12) ? 0.0 : 1.0;
+        double rSafe = rn + (1.0-Mask);
+        double Wn    = Mask*W[n];
+        double rPower0 = Wn/(4.0*M_PI*rSafe);
+        double rPower1 = Wn/(4.0*M_PI);
+        double rPower2 = Wn*rn/(8.0*M_PI);
+        S0D += rPower0*DotProduct[n];  S0S += rPower0;
+        S1D += rPower1*DotProduct[n];  S1S += rPower1;
+        S2D += rPower2*DotProduct[n];  S2S += rPower2;
+      };
+     Result[0] += S0D;  Result[1] += S0S*ScalarProduct;
+     Result[2] += S1D;  Result[3] += S1S*ScalarProduct;
+     Result[4] += S2D;  Result[5] += S2S*ScalarProduct;
+     return;
+   };
+
+  double RePhi[GME_PACKETSIZE], ImPhi[GME_PACKETSIZE];
+  GetPhiBatch(N, k, WhichKernel, r, RePhi, ImPhi);
+
+  double ReSD=0.0, ImSD=0.0, ReSS=0.0, ImSS=0.0;
+#ifdef USE_OPENMP
+#pragma omp simd reduction(+:ReSD,ImSD,ReSS,ImSS)
+#endif
+  for(int n=0; n<N; n++)
+   { ReSD += W[n]*DotProduct[n]*RePhi[n];
+     ImSD += W[n]*DotProduct[n]*ImPhi[n];
+     ReSS += W[n]*RePhi[n];
+     ImSS += W[n]*ImPhi[n];
+   };
+
+  cdouble Sum = cdouble(ReSD,ImSD) - ScalarProduct*cdouble(ReSS,ImSS)/(k*k);
+  Result[0] += real(Sum);
+  Result[1] += imag(Sum);
+}
+
+/***************************************************************/
+/* fixed-order cubature over a pair of tetrahedra of the       */
+/* GMEIntegrand kernel for the SWG functions with source       */
+/* vertices iQA, iQB, using the batched kernels above; this is */
+/* equivalent to (but faster than) calling TetTetInt with      */
+/* GMEIntegrand and NumPts!=0.                                 */
+/***************************************************************/
+void TetTetGMEInt(SWGVolume *OA, int ntA, int iQA, double SignA,
+                  SWGVolume *OB, int ntB, int iQB, double SignB,
+                  int WhichKernel, cdouble k, int NumPts,
+                  double *Result)
+{
+  int fdim = (WhichKernel==KERNEL_STATIC) ? 3 : 1;
+  memset(Result, 0, 2*fdim*sizeof(double));
+
+  /***************************************************************/
+  /* get cubature points and SWG function values on both tets    */
   /***************************************************************/
-  /* specify tetrahedra geometry *********************************/
+  SWGTet *TA=OA->Tets[ntA], *TB=OB->Tets[ntB];
+  double PreFacA=SignA*(OA->Faces[TA->FI[iQA]]->Area) / (3.0 * TA->Volume);
+  double PreFacB=SignB*(OB->Faces[TB->FI[iQB]]->Area) / (3.0 * TB->Volume);
+  double ScalarProduct = 9.0*PreFacA*PreFacB;
+  double SignAB = SignA*SignB;
+
+  const double *XA, *BA, *WA, *XB, *BB, *WB;
+  double BufferA[7*33], BufferB[7*33];
+  GetTetCubatureData(OA, ntA, iQA, NumPts, &XA, &BA, &WA, BufferA);
+  GetTetCubatureData(OB, ntB, iQB, NumPts, &XB, &BB, &WB, BufferB);
+  const double *XA0=XA, *XA1=XA+NumPts, *XA2=XA+2*NumPts;
+  const double *XB0=XB, *XB1=XB+NumPts, *XB2=XB+2*NumPts;
+  const double *BA0=BA, *BA1=BA+NumPts, *BA2=BA+2*NumPts;
+  const double *BB0=BB, *BB1=BB+NumPts, *BB2=BB+2*NumPts;
+
   /***************************************************************/
+  /* fill packets of point pairs and hand them off to the batch  */
+  /* kernel                                                      */
+  /***************************************************************/
+  double r[GME_PACKETSIZE], W[GME_PACKETSIZE], DotProduct[GME_PACKETSIZE];
+  int N=0;
+  for(int npA=0; npA<NumPts; npA++)
+   for(int npB=0; npB<NumPts; npB++)
+    { 
+      double R0=XA0[npA]-XB0[npB], R1=XA1[npA]-XB1[npB], R2=XA2[npA]-XB2[npB];
+      r[N]          = sqrt(R0*R0 + R1*R1 + R2*R2);
+      W[N]          = WA[npA]*WB[npB];
+      DotProduct[N] = SignAB*(BA0[npA]*BB0[npB] + BA1[npA]*BB1[npB] + BA2[npA]*BB2[npB]);
+      if (++N==GME_PACKETSIZE)
+       { GMEBatchIntegrate(N, k, WhichKernel, r, W, DotProduct,
+                           ScalarProduct, Result);
+         N=0;
+       };
+    };
+  if (N>0)
+   GMEBatchIntegrate(N, k, WhichKernel, r, W, DotProduct,
+                     ScalarProduct, Result);
+}
+
+/***************************************************************/
+/* initialize a Taylor-Duffy argument structure with the       */
+/* geometry of a pair of tetrahedra with ncv common vertices   */
+/***************************************************************/
+static void InitGMETTDArgs(TTDArgStruct *Args,
+                           SWGVolume *OA, int OVIA[4], int iQA,
+                           SWGVolume *OB, int OVIB[4], int iQB,
+                           int ncv)
+{
+  InitTTDArgs(Args);
   Args->WhichCase=ncv;
   Args->V1     = OA->Vertices             + 3*OVIA[0];
   Args->V2     = Args->V2P = OA->Vertices + 3*OVIA[1];
@@ -197,6 +399,31 @@ cdouble GetGMETTI_TaylorDuffy(SWGVolume *OA, int OVIA[4], int iQA,
   Args->QP     = OB->Vertices + 3*iQB;
   if (OA->OTGT) OA->OTGT->Apply(Args->XTorque);
   if (OA->GT) OA->GT->Apply(Args->XTorque);
+  Args->RelTol  = SWGGeometry::TaylorDuffyTolerance;
+  Args->MaxEval = SWGGeometry::MaxTaylorDuffyEvals;
+  Args->CubaturePoints = SWGGeometry::TaylorDuffyOrder;
+}
+
+/***************************************************************/
+/* Use the Taylor-Duffy method to compute the contribution of  */
+/* a single tetrahedron-tetrahedron pair to the matrix         */
+/* element of G.                                               */
+/***************************************************************/
+cdouble GetGMETTI_TaylorDuffy(SWGVolume *OA, int OVIA[4], int iQA,
+                              SWGVolume *OB, int OVIB[4], int iQB,
+                              int WhichKernel, 
+                              cdouble k, int ncv, cdouble *TTI=0)
+{
+  /***************************************************************/
+  /* static integrals for a pair of the same shape as one we have*/
+  /* already done are taken from the table in StaticTTITable.cc  */
+  /***************************************************************/
+  if ( WhichKernel==KERNEL_STATIC && TTI
+       && GetStaticTTI(OA, OVIA, iQA, OB, OVIB, iQB, ncv, (double *)TTI)
+     ) return 0.0;
+
+  TTDArgStruct MyArgs, *Args=&MyArgs;
+  InitGMETTDArgs(Args, OA, OVIA, iQA, OB, OVIB, iQB, ncv);
  
   /***************************************************************/
   /* specify the components of the Taylor-Duffy integrand vector */
@@ -209,8 +436,6 @@ cdouble GetGMETTI_TaylorDuffy(SWGVolume *OA, int OVIA[4], int iQA,
   Args->KParam  = KParam;
   Args->Result  = TDI;
   Args->Error   = Error;
-  Args->RelTol  = SWGGeometry::TaylorDuffyTolerance;
-  Args->MaxEval = SWGGeometry::MaxTaylorDuffyEvals;
 
   if (WhichKernel==KERNEL_HELMHOLTZ)
    { 
@@ -241,7 +466,9 @@ cdouble GetGMETTI_TaylorDuffy(SWGVolume *OA, int OVIA[4], int iQA,
   if (WhichKernel==KERNEL_HELMHOLTZ)
    { 
      cdouble NOK2=9.0/(k*k);
-     return TDI[0] - NOK2*TDI[1];
+     cdouble GME=TDI[0] - NOK2*TDI[1];
+     if (TTI) TTI[0]=GME;
+     return GME;
    }
   else
    {
@@ -255,6 +482,7 @@ cdouble GetGMETTI_TaylorDuffy(SWGVolume *OA, int OVIA[4], int iQA,
       { dTTI[npk] = GPreFactor[nrPower]*real(TDI[npk]);      npk++;
         dTTI[npk] = 9.0*GPreFactor[nrPower]*real(TDI[npk]);  npk++;
       };
+     AddStaticTTI(OA, OVIA, iQA, OB, OVIB, iQB, ncv, dTTI);
 
      return 0.0;
 
@@ -268,21 +496,29 @@ cdouble GetGMETTI_TaylorDuffy(SWGVolume *OA, int OVIA[4], int iQA,
 /* supports of each basis function                             */
 /***************************************************************/
 cdouble GetGME_BFBFInt(SWGVolume *OA, int nfA, SWGVolume *OB, int nfB,
-                       int WhichKernel, cdouble Omega, cdouble *Result=0)
+                       int WhichKernel, cdouble Omega, cdouble *Result=0,
+                       int NumPts=4)
 {
-  GMEData MyData, *Data = &MyData;
-  Data->k               = Omega;
-  Data->WhichKernel     = WhichKernel;
-
   int fdim = (WhichKernel==KERNEL_STATIC) ? 3 : 1;
   cdouble ResultBuffer[3];
   if (Result==0) Result=ResultBuffer;
   memset(Result, 0, 2*fdim*sizeof(double));
 
-  int NumPts=4;
-  cdouble Error[3];
-  BFBFInt(OA, nfA, OB, nfB, GMEIntegrand, (void *)Data, 2*fdim,
-          (double *)Result, (double *)Error, NumPts, 0, 0.0);
+  SWGFace *FA = OA->Faces[nfA];
+  SWGFace *FB = OB->Faces[nfB];
+  cdouble TTI[3];
+  for(int ASign=0; ASign<2; ASign++)
+   for(int BSign=0; BSign<2; BSign++)
+    { int ntA    = (ASign==0) ? FA->iPTet  : FA->iMTet;
+      int ntB    = (BSign==0) ? FB->iPTet  : FB->iMTet;
+      int iQA    = (ASign==0) ? FA->PIndex : FA->MIndex;
+      int iQB    = (BSign==0) ? FB->PIndex : FB->MIndex;
+      double Sign = (ASign==BSign) ? 1.0 : -1.0;
+      TetTetGMEInt(OA, ntA, iQA, 1.0, OB, ntB, iQB, 1.0,
+                   WhichKernel, Omega, NumPts, (double *)TTI);
+      for(int nf=0; nf<fdim; nf++)
+       Result[nf] += Sign*TTI[nf];
+    };
 
   return Result[0];
 }
@@ -295,13 +531,6 @@ cdouble GetGME_BFBFInt(SWGVolume *OA, int nfA, SWGVolume *OB, int nfB,
 cdouble GetGME_TetTetInt(SWGVolume *OA, int nfA, SWGVolume *OB, int nfB,
                       int WhichKernel, cdouble Omega, cdouble *Result=0)
 {
-  /***************************************************************/
-  /***************************************************************/
-  /***************************************************************/
-  GMEData MyData, *Data = &MyData;
-  Data->k               = Omega;
-  Data->WhichKernel     = WhichKernel;
-
   int fdim = (WhichKernel==KERNEL_STATIC) ? 3 : 1;
   cdouble ResultBuffer[3];
   if (Result==0) Result=ResultBuffer;
@@ -312,7 +541,7 @@ cdouble GetGME_TetTetInt(SWGVolume *OA, int nfA, SWGVolume *OB, int nfB,
   /***************************************************************/
   SWGFace *FA = OA->Faces[nfA];
   SWGFace *FB = OB->Faces[nfB];
-  cdouble TTI[3], Error[3];
+  cdouble TTI[3];
   double AreaFactor=FA->Area * FB->Area;
   for(int ASign=0; ASign<2; ASign++)
    for(int BSign=0; BSign<2; BSign++)
@@ -332,10 +561,8 @@ cdouble GetGME_TetTetInt(SWGVolume *OA, int nfA, SWGVolume *OB, int nfB,
          int iQA = (ASign==0) ? FA->PIndex : FA->MIndex;
          int iQB = (BSign==0) ? FB->PIndex : FB->MIndex;
          double Elapsed=Secs();
-         memset(TTI, 0, fdim*sizeof(cdouble));
-         TetTetInt(OA, ntA, iQA, 1.0, OB, ntB, iQB, 1.0,
-                   GMEIntegrand, (void *)Data, 2*fdim,
-                   (double *)TTI, (double *)Error, NumPts, 0, 0);
+         TetTetGMEInt(OA, ntA, iQA, 1.0, OB, ntB, iQB, 1.0,
+                      WhichKernel, Omega, NumPts, (double *)TTI);
          Elapsed=Secs()-Elapsed;
          //AddTaskTiming(1,Elapsed);
        }
@@ -364,6 +591,144 @@ cdouble GetGME_TetTetInt(SWGVolume *OA, int nfA, SWGVolume *OB, int nfB,
 
 } // void SumTetTetInts(...)
 
+/***************************************************************/
+/* get the dipole and quadupole moments of the current         */
+/* distribution described by a single SWG basis function:      */
+/*  J[Mu]     = \int b_Mu dV                                   */
+/*  Q[Mu][Nu] = \int b_Mu (x_Nu - X0_Nu) dV                    */
+/* with X0 the centroid of the face.                           */
+/***************************************************************/
+void GetDQMoments(SWGVolume *O, int nf, double J[3], double Q[3][3],
+                  bool NeedQ)
+{
+  SWGFace *F = O->Faces[nf];
+  double A= F->Area;
+
+  double *QP = O->Vertices + 3*F->iQP;
+  double *QM = O->Vertices + 3*F->iQM;
+
+  J[0] = 0.25*A*(QM[0] - QP[0]);
+  J[1] = 0.25*A*(QM[1] - QP[1]);
+  J[2] = 0.25*A*(QM[2] - QP[2]);
+
+  if (!NeedQ) return;
+
+  double PreFac = A/20.0;
+  double *x0 = F->Centroid;
+  for(int Mu=0; Mu<3; Mu++)
+   for(int Nu=0; Nu<3; Nu++)
+    Q[Mu][Nu] = PreFac * (   QM[Mu]*(QM[Nu]-x0[Nu])
+                            -QP[Mu]*(QP[Nu]-x0[Nu])
+                            +x0[Mu]*(QP[Nu]-QM[Nu])
+                         );
+}
+
+/***************************************************************/
+/* G-matrix element between well-separated basis functions in  */
+/* the dipole approximation: each BF is replaced by a point    */
+/* current J (its dipole moment) at its face centroid, so that */
+/* G_{ab} = J_a \cdot G(x_a-x_b) \cdot J_b with G the dyadic    */
+/* Green's function                                            */
+/*  G = e^{ikr}/(4 pi r) * [ P(kr) 1 + Q(kr) \hat{R}\hat{R} ]   */
+/***************************************************************/
+cdouble GetGME_Dipole(SWGVolume *OA, int nfA, SWGVolume *OB, int nfB,
+                      cdouble Omega)
+{
+  double JA[3], JB[3], QDummy[3][3];
+  GetDQMoments(OA, nfA, JA, QDummy, false);
+  GetDQMoments(OB, nfB, JB, QDummy, false);
+
+  double R[3];
+  VecSub(OA->Faces[nfA]->Centroid, OB->Faces[nfB]->Centroid, R);
+  double r = VecNorm(R);
+
+  cdouble ikr  = II*Omega*r;
+  cdouble ikr2 = ikr*ikr;
+  cdouble P = 1.0 - 1.0/ikr + 1.0/ikr2;
+  cdouble Q = -1.0 + 3.0/ikr - 3.0/ikr2;
+
+  double JAJB = VecDot(JA, JB);
+  double JARJBR = VecDot(JA, R) * VecDot(JB, R) / (r*r);
+
+  return exp(ikr) * (P*JAJB + Q*JARJBR) / (4.0*M_PI*r);
+}
+
+/***************************************************************/
+/* quadrature policy for G-matrix elements.                    */
+/*                                                             */
+/* the relative error of each rule for non-touching pairs is   */
+/* modeled as                                                  */
+/*                                                             */
+/*  E = A / rRel^p + B (kR)^q                                  */
+/*                                                             */
+/* where rRel is the center-center distance in units of the    */
+/* larger BF radius R. the first term is the error due to the  */
+/* variation of 1/r over the BF supports, the second the error */
+/* due to the variation of the phase e^{ikr}.                  */
+/*                                                             */
+/* the exponents come from the degree of each rule: expanding  */
+/* the kernel about the two centroids, a rule that integrates  */
+/* (BF component) x (kernel) exactly through the first d terms */
+/* of the expansion leaves an error that starts at the term    */
+/* of order (R/r)^d in the 1/r part and (kR)^d in the phase    */
+/* part. the dipole approximation keeps only the leading term  */
+/* (d=1); for the 4- and 16-point rules the model takes d=2    */
+/* and d=4. the coefficients A, B are not derived from the     */
+/* rules: they are round numbers set by hand, so the estimate  */
+/* is a heuristic model, not a guaranteed bound. the cheapest  */
+/* rule whose estimated error is below Tolerance is chosen;    */
+/* the 33-point rule is the last resort.                       */
+/*                                                             */
+/* for touching pairs, only the smooth (desingularized) part   */
+/* of the integrand is computed by cubature, so only the phase */
+/* term applies.                                               */
+/*                                                             */
+/* Tolerance=0 selects the fixed rules (4 points per tet) that */
+/* were used before the policy was introduced.                 */
+/***************************************************************/
+#define GME_NUMRULES 3
+static int    GMERuleNumPts[GME_NUMRULES] = {   0,      4,      16   };
+static double GMERuleA[GME_NUMRULES]      = { 1.0,    0.1,    2.0e-2 };
+static double GMERuleP[GME_NUMRULES]      = { 1.0,    2.0,    4.0    };
+static double GMERuleB[GME_NUMRULES]      = { 0.2,    5.0e-3, 1.0e-4 };
+static double GMERuleQ[GME_NUMRULES]      = { 1.0,    2.0,    4.0    };
+
+GMEQuadraturePolicy::GMEQuadraturePolicy(double pTolerance)
+{
+  SetTolerance(pTolerance);
+}
+
+void GMEQuadraturePolicy::SetTolerance(double pTolerance)
+{
+  Tolerance = pTolerance;
+}
+
+double GMEQuadraturePolicy::GetErrorEstimate(int NumPts, double rRel,
+                                             double kR, int ncv)
+{
+  for(int nr=0; nr<GME_NUMRULES; nr++)
+   if (GMERuleNumPts[nr]==NumPts)
+    { double E = GMERuleB[nr]*pow(kR, GMERuleQ[nr]);
+      if (ncv==0)
+       E += GMERuleA[nr]*pow(rRel, -GMERuleP[nr]);
+      return E;
+    };
+  return 0.0;
+}
+
+int GMEQuadraturePolicy::GetNumPts(double rRel, double kR, int ncv)
+{
+  if (Tolerance<=0.0)
+   return 4;
+
+  // the dipole approximation is not available for touching pairs
+  for(int nr=(ncv==0 ? 0 : 1); nr<GME_NUMRULES; nr++)
+   if ( GetErrorEstimate(GMERuleNumPts[nr], rRel, kR, ncv) < Tolerance )
+    return GMERuleNumPts[nr];
+
+  return 33;
+}
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
@@ -371,7 +736,45 @@ void ComputeFIBBIData(SWGVolume *OA, int nfA,
                       SWGVolume *OB, int nfB,
                       double GFI[FIBBIDATALEN])
 { 
+  // the singular n=0,1,2 terms by Taylor-Duffy
   GetGME_TetTetInt(OA, nfA, OB, nfB, KERNEL_STATIC, 0.0, (cdouble *)GFI);
+
+  // the smooth n>=3 terms by 16-point cubature
+  double D[FIBBI_MAXORDER+1], S[FIBBI_MAXORDER+1];
+  memset(D, 0, (FIBBI_MAXORDER+1)*sizeof(double));
+  memset(S, 0, (FIBBI_MAXORDER+1)*sizeof(double));
+  AddGSeriesCubature(OA, nfA, OB, nfB, 3, FIBBI_MAXORDER, 16, D, S);
+  for(int n=3; n<=FIBBI_MAXORDER; n++)
+   { GFI[2*n+0] = D[n];
+     GFI[2*n+1] = S[n];
+   };
+}
+
+/***************************************************************/
+/* for a touching BF pair, the smallest order N<=FIBBI_MAXORDER*/
+/* at which the polynomial sum_{n<=N} (ik)^n [D^n - S^n/k^2]   */
+/* approximates the full matrix element to within              */
+/* TouchingSeriesTolerance, or -1 if there is none.            */
+/*                                                             */
+/* with R an upper bound on r over both BF supports, the       */
+/* truncation error relative to the n=0 term is bounded by     */
+/* sum_{n>N} (kR)^n/n! <= e^{kR} (kR)^{N+1}/(N+1)!.            */
+/***************************************************************/
+static int GetTouchingSeriesOrder(SWGFace *FA, SWGFace *FB, cdouble Omega)
+{
+  double Tol = SWGGeometry::TouchingSeriesTolerance;
+  if (Tol<=0.0)
+   return -1;
+
+  double R  = VecDistance(FA->Centroid, FB->Centroid) + FA->Radius + FB->Radius;
+  double kR = abs(Omega)*R;
+  double Bound = exp(kR)*kR*kR*kR/6.0;
+  for(int N=2; N<=FIBBI_MAXORDER; N++)
+   { if (Bound<Tol)
+      return N;
+     Bound *= kR/((double)(N+2));
+   };
+  return -1;
 }
 
 /***************************************************************/
@@ -379,23 +782,36 @@ void ComputeFIBBIData(SWGVolume *OA, int nfA,
 /***************************************************************/
 cdouble GetGMatrixElement(SWGVolume *OA, int nfA,
                           SWGVolume *OB, int nfB,
-                          cdouble Omega, FIBBICache *GCache)
+                          cdouble Omega, FIBBICache *GCache,
+                          int ncv)
 {
   bool HaveCache = (GCache!=0);
 
   /*--------------------------------------------------------------*/
-  /*- count common vertices  -------------------------------------*/
+  /*- count common vertices if the caller didn't -----------------*/
+  /*--------------------------------------------------------------*/
+  if (ncv<0)
+   ncv = CompareBFs(OA, nfA, OB, nfB);
+
+  /*--------------------------------------------------------------*/
+  /*- choose the cubature rule from the relative distance ---------*/
   /*--------------------------------------------------------------*/
-  double rRel;
-  int ncv = CompareBFs(OA, nfA, OB, nfB, &rRel);
+  SWGFace *FA = OA->Faces[nfA], *FB = OB->Faces[nfB];
+  double Radius = fmax(FA->Radius, FB->Radius);
+  double rRel = VecDistance(FA->Centroid, FB->Centroid) / Radius;
+  int NumPts = SWGGeometry::QuadraturePolicy.GetNumPts(rRel, abs(Omega)*Radius, ncv);
 
   /***************************************************************/
   /***************************************************************/
   /***************************************************************/
   cdouble GME=0.0;
-  if ( ncv==0 )
+  if ( ncv==0 && NumPts==0 )
+   {
+     GME=GetGME_Dipole(OA, nfA, OB, nfB, Omega);
+   }
+  else if ( ncv==0 )
    {
-     GME=GetGME_BFBFInt(OA, nfA, OB, nfB, KERNEL_HELMHOLTZ, Omega);
+     GME=GetGME_BFBFInt(OA, nfA, OB, nfB, KERNEL_HELMHOLTZ, Omega, 0, NumPts);
    }
   else if (!HaveCache)
    { 
@@ -404,19 +820,24 @@ cdouble GetGMatrixElement(SWGVolume *OA, int nfA,
   else
    { 
      /***************************************************************/
+     /* at low enough frequency the cached expansion terms suffice; */
+     /* otherwise the terms beyond n=2 come from cubature of the    */
+     /* desingularized kernel                                       */
      /***************************************************************/
-     /***************************************************************/
-     GME=GetGME_BFBFInt(OA, nfA, OB, nfB, KERNEL_DESINGULARIZED, Omega);
+     int N = GetTouchingSeriesOrder(FA, FB, Omega);
+     if (N<0)
+      GME=GetGME_BFBFInt(OA, nfA, OB, nfB, KERNEL_DESINGULARIZED, Omega, 0, NumPts);
 
      /***************************************************************/
      /* now look up or compute the desingularized contributions     */
      /* and add those in.                                           */
      /***************************************************************/
-     double GFI[6];
+     double GFI[FIBBIDATALEN];
      GCache->GetFIBBIData(OA, nfA, OB, nfB, GFI);
      cdouble k2=Omega*Omega;
-     cdouble IK=II*Omega, IK2=IK*IK;
-     GME += (GFI[0]-GFI[1]/k2) + IK*(GFI[2]-GFI[3]/k2) + IK2*(GFI[4]-GFI[5]/k2);
+     cdouble IK=II*Omega, IKn=1.0;
+     for(int n=0; n<=(N<2 ? 2 : N); n++, IKn*=IK)
+      GME += IKn*(GFI[2*n+0]-GFI[2*n+1]/k2);
    };
 
   return GME;
@@ -0,0 +1,358 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * GTaylorSeries.cc -- low-frequency representation of G-matrix blocks
+ *                  -- as series in powers of ik
+ *
+ * Expanding e^{ikr}/(4 pi r) in powers of ik gives
+ *
+ *  G_{ab}(k) = \sum_{n>=0} (ik)^n [ D^n_{ab} + (ik)^{-2} S^n_{ab} ]
+ *
+ *  D^n_{ab} = (1/(4 pi n!)) \int\int r^{n-1} b_a \cdot b_b
+ *  S^n_{ab} = (1/(4 pi n!)) \int\int r^{n-1} (Div b_a)(Div b_b)
+ *
+ * so that G(k) = \sum_{m=-2}^{MaxOrder} (ik)^m C_m with the
+ * real-valued, frequency-independent coefficient matrices
+ * C_m = D^m + S^{m+2}. Once these are computed, each new frequency
+ * costs only a linear combination of the C_m.
+ *
+ * For BF pairs with common vertices the n=0..FIBBI_MAXORDER terms
+ * are exactly the FIBBI data; any higher terms, like the non-touching
+ * pairs, use the same fixed-order cubature as direct assembly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <libhrutil.h>
+
+#include "libbuff.h"
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#ifdef USE_OPENMP
+#  include <omp.h>
+#endif
+
+using namespace scuff;
+
+namespace buff {
+
+#define II cdouble(0.0,1.0)
+
+/***************************************************************/
+/* compute D^n and S^n (above) for n=0..NMax for a single pair */
+/* of basis functions.                                         */
+/***************************************************************/
+void GetGSeriesCoefficients(SWGVolume *OA, int nfA,
+                            SWGVolume *OB, int nfB,
+                            int NMax, FIBBICache *GCache,
+                            double *D, double *S)
+{
+  memset(D, 0, (NMax+1)*sizeof(double));
+  memset(S, 0, (NMax+1)*sizeof(double));
+
+  /***************************************************************/
+  /* low-order terms for touching pairs from the FIBBI data      */
+  /***************************************************************/
+  int nMin=0;
+  if ( CompareBFs(OA, nfA, OB, nfB) > 0 )
+   { double GFI[FIBBIDATALEN];
+     if (GCache)
+      GCache->GetFIBBIData(OA, nfA, OB, nfB, GFI);
+     else
+      ComputeFIBBIData(OA, nfA, OB, nfB, GFI);
+     for(int n=0; n<=FIBBI_MAXORDER && n<=NMax; n++)
+      { D[n] = GFI[2*n+0];
+        S[n] = GFI[2*n+1];
+      };
+     nMin=FIBBI_MAXORDER+1;
+   };
+
+  /***************************************************************/
+  /* remaining terms by 4-point cubature over each tet pair, as  */
+  /* in GetGME_BFBFInt                                           */
+  /***************************************************************/
+  AddGSeriesCubature(OA, nfA, OB, nfB, nMin, NMax, 4, D, S);
+}
+
+/***************************************************************/
+/* add to D[n], S[n] the contributions of NumPts-point cubature*/
+/* over each pair of tetrahedra for n=nMin..NMax               */
+/***************************************************************/
+void AddGSeriesCubature(SWGVolume *OA, int nfA,
+                        SWGVolume *OB, int nfB,
+                        int nMin, int NMax, int NumPts,
+                        double *D, double *S)
+{
+  if (nMin>NMax)
+   return;
+  if (NMax>GSERIES_MAXORDER+2)
+   ErrExit("%s:%i: internal error (NMax=%i)",__FILE__,__LINE__,NMax);
+
+  // PreFac[n] = 1/(4 pi n!)
+  double PreFac[GSERIES_MAXORDER+3];
+  PreFac[0]=1.0/(4.0*M_PI);
+  for(int n=1; n<=NMax; n++)
+   PreFac[n] = PreFac[n-1]/((double)n);
+
+  SWGFace *FA = OA->Faces[nfA];
+  SWGFace *FB = OB->Faces[nfB];
+  for(int ASign=0; ASign<2; ASign++)
+   for(int BSign=0; BSign<2; BSign++)
+    {
+      int ntA = (ASign==0) ? FA->iPTet  : FA->iMTet;
+      int iQA = (ASign==0) ? FA->PIndex : FA->MIndex;
+      int ntB = (BSign==0) ? FB->iPTet  : FB->iMTet;
+      int iQB = (BSign==0) ? FB->PIndex : FB->MIndex;
+      double Sign = (ASign==BSign) ? 1.0 : -1.0;
+      double PA = FA->Area / (3.0*OA->Tets[ntA]->Volume);
+      double PB = FB->Area / (3.0*OB->Tets[ntB]->Volume);
+      double ScalarProduct = 9.0*Sign*PA*PB;
+
+      const double *XA, *BA, *WA, *XB, *BB, *WB;
+      double BufferA[7*33], BufferB[7*33];
+      GetTetCubatureData(OA, ntA, iQA, NumPts, &XA, &BA, &WA, BufferA);
+      GetTetCubatureData(OB, ntB, iQB, NumPts, &XB, &BB, &WB, BufferB);
+
+      for(int npA=0; npA<NumPts; npA++)
+       for(int npB=0; npB<NumPts; npB++)
+        { double R0 = XA[npA]          - XB[npB];
+          double R1 = XA[npA+NumPts]   - XB[npB+NumPts];
+          double R2 = XA[npA+2*NumPts] - XB[npB+2*NumPts];
+          double r = sqrt(R0*R0 + R1*R1 + R2*R2);
+          if (r<1.0e-12) continue;
+          double Weight = WA[npA]*WB[npB];
+          double DotProduct = Sign*(  BA[npA]*BB[npB]
+                                    + BA[npA+NumPts]*BB[npB+NumPts]
+                                    + BA[npA+2*NumPts]*BB[npB+2*NumPts] );
+          double rPower = Weight*pow(r, nMin-1);
+          for(int n=nMin; n<=NMax; n++, rPower*=r)
+           { D[n] += PreFac[n]*rPower*DotProduct;
+             S[n] += PreFac[n]*rPower*ScalarProduct;
+           };
+        };
+    };
+}
+
+/***************************************************************/
+/* the diameter of the smallest sphere centered at the         */
+/* centroid of the bounding box of both objects that encloses  */
+/* both objects; an upper bound on r for all point pairs is    */
+/* twice this radius.                                          */
+/***************************************************************/
+static double GetMaxSeparation(SWGVolume *OA, SWGVolume *OB)
+{
+  double BoxMin[3], BoxMax[3];
+  for(int Mu=0; Mu<3; Mu++)
+   { BoxMin[Mu]=HUGE_VAL; BoxMax[Mu]=-HUGE_VAL; };
+  SWGVolume *O[2]={OA, OB};
+  for(int i=0; i<2; i++)
+   for(int nv=0; nv<O[i]->NumVertices; nv++)
+    for(int Mu=0; Mu<3; Mu++)
+     { BoxMin[Mu]=fmin(BoxMin[Mu], O[i]->Vertices[3*nv+Mu]);
+       BoxMax[Mu]=fmax(BoxMax[Mu], O[i]->Vertices[3*nv+Mu]);
+     };
+  return VecDistance(BoxMin, BoxMax);
+}
+
+/***************************************************************/
+/* memory needed for the coefficient matrices of a series of   */
+/* order MaxOrder for an NRxNC block                           */
+/***************************************************************/
+static size_t GetGSeriesBytes(int NR, int NC, int MaxOrder)
+{
+  if (MaxOrder>GSERIES_MAXORDER)
+   MaxOrder=GSERIES_MAXORDER;
+  return ((size_t)(MaxOrder+3))*((size_t)NR)*((size_t)NC)*sizeof(double);
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+GTaylorSeries::GTaylorSeries(SWGGeometry *pG, int pnoa, int pnob,
+                             int pMaxOrder)
+{
+  G        = pG;
+  noa      = pnoa;
+  nob      = pnob;
+  MaxOrder = pMaxOrder;
+  if (MaxOrder>GSERIES_MAXORDER)
+   { Warn("low-frequency series order %i too high (reducing to %i)",MaxOrder,GSERIES_MAXORDER);
+     MaxOrder=GSERIES_MAXORDER;
+   };
+
+  SWGVolume *OA = G->Objects[noa];
+  SWGVolume *OB = G->Objects[nob];
+  NR = OA->NumInteriorFaces;
+  NC = OB->NumInteriorFaces;
+  bool SameObject = (noa==nob);
+  MaxSeparation = GetMaxSeparation(OA, OB);
+  GetPlacementSignature(OA, OB, Signature);
+
+  Log("Computing order-%i low-frequency series for G(%i,%i)...",MaxOrder,noa,nob);
+
+  /***************************************************************/
+  /* C[m+2] = coefficient of (ik)^m for m=-2..MaxOrder           */
+  /***************************************************************/
+  NumTerms = MaxOrder+3;
+  Bytes = GetGSeriesBytes(NR, NC, MaxOrder);
+  C = (HMatrix **)mallocEC(NumTerms*sizeof(HMatrix *));
+  for(int nt=0; nt<NumTerms; nt++)
+   C[nt] = new HMatrix(NR, NC, LHM_REAL);
+
+  FIBBICache *GCache = G->GetGCache(noa, nob);
+  int NMax = MaxOrder+2;
+
+#ifdef USE_OPENMP
+  int NumThreads=GetNumThreads();
+#pragma omp parallel for schedule(dynamic,1),		\
+                         num_threads(NumThreads)
+#endif
+  for(int nfa=0; nfa<NR; nfa++)
+   { double D[GSERIES_MAXORDER+3], S[GSERIES_MAXORDER+3];
+     for(int nfb=(SameObject ? nfa : 0); nfb<NC; nfb++)
+      {
+        GetGSeriesCoefficients(OA, nfa, OB, nfb, NMax, GCache, D, S);
+        for(int m=-2; m<=MaxOrder; m++)
+         { double Cm = (m>=0 ? D[m] : 0.0) + S[m+2];
+           C[m+2]->SetEntry(nfa, nfb, Cm);
+           if (SameObject && nfb>nfa)
+            C[m+2]->SetEntry(nfb, nfa, Cm);
+         };
+      };
+   };
+
+  if (GCache)
+   G->StoreGCache(noa);
+}
+
+GTaylorSeries::~GTaylorSeries()
+{
+  for(int nt=0; nt<NumTerms; nt++)
+   delete C[nt];
+  free(C);
+}
+
+/***************************************************************/
+/* estimated relative error of the truncated series at         */
+/* frequency Omega: the series for e^{ikr} truncated after     */
+/* the (ik)^N term has relative error bounded by               */
+/* |kr|^{N+1}/(N+1)! * e^{|kr|}, with r at most MaxSeparation. */
+/***************************************************************/
+double GTaylorSeries::GetErrorEstimate(cdouble Omega)
+{
+  double kD = abs(Omega)*MaxSeparation;
+  double Bound = exp(kD);
+  for(int n=1; n<=MaxOrder+1; n++)
+   Bound *= kD/((double)n);
+  return Bound;
+}
+
+/***************************************************************/
+/* if the estimated error at this frequency is below Tolerance,*/
+/* form the G-matrix block as the linear combination of the    */
+/* coefficient matrices and return true; otherwise return      */
+/* false without touching GBlock.                              */
+/***************************************************************/
+bool GTaylorSeries::Evaluate(cdouble Omega, HMatrix *GBlock,
+                             int RowOffset, int ColOffset,
+                             double *pErrorEstimate)
+{
+  double ErrorEstimate = GetErrorEstimate(Omega);
+  if (pErrorEstimate) *pErrorEstimate=ErrorEstimate;
+  if ( ErrorEstimate > SWGGeometry::GSeriesTolerance || Omega==0.0 )
+   return false;
+
+  cdouble IK = II*Omega;
+  cdouble IKPower[GSERIES_MAXORDER+3];
+  IKPower[0] = 1.0/(IK*IK);
+  for(int nt=1; nt<NumTerms; nt++)
+   IKPower[nt] = IKPower[nt-1]*IK;
+
+#ifdef USE_OPENMP
+  int NumThreads=GetNumThreads();
+#pragma omp parallel for schedule(static), num_threads(NumThreads)
+#endif
+  for(int nc=0; nc<NC; nc++)
+   for(int nr=0; nr<NR; nr++)
+    { cdouble GAB=0.0;
+      for(int nt=0; nt<NumTerms; nt++)
+       GAB += IKPower[nt]*C[nt]->DM[nr + nc*NR];
+      GBlock->SetEntry(RowOffset+nr, ColOffset+nc, GAB);
+    };
+
+  return true;
+}
+
+/***************************************************************/
+/* get the low-frequency series for block (noa,nob), computing */
+/* it if necessary. as for frequency-sweep data, self blocks   */
+/* are shared with duplicate objects and blocks for distinct   */
+/* objects are recomputed if the objects have moved relative   */
+/* to each other. the series count towards SweepMemoryBudget;  */
+/* if a new one would exceed it, returns 0 and the caller      */
+/* assembles the block directly.                               */
+/***************************************************************/
+GTaylorSeries *SWGGeometry::GetGSeries(int noa, int nob)
+{
+  if (GSeriesBlocks==0)
+   GSeriesBlocks=(GTaylorSeries **)mallocEC(NumObjects*NumObjects*sizeof(GTaylorSeries *));
+
+  int nb;
+  if (noa==nob)
+   { int noCache = (Mate[noa]==-1) ? noa : Mate[noa];
+     nb = noCache*NumObjects + noCache;
+   }
+  else
+   nb = noa*NumObjects + nob;
+
+  GTaylorSeries *S=GSeriesBlocks[nb];
+  if (S && noa!=nob)
+   { double Signature[24];
+     GetPlacementSignature(Objects[noa], Objects[nob], Signature);
+     if ( memcmp(Signature, S->Signature, 24*sizeof(double)) )
+      { SweepBytes -= S->Bytes;
+        delete S;
+        S=GSeriesBlocks[nb]=0;
+      };
+   };
+
+  if (S==0)
+   { size_t Bytes  = GetGSeriesBytes(Objects[noa]->NumInteriorFaces,
+                                     Objects[nob]->NumInteriorFaces,
+                                     GSeriesOrder);
+     size_t Budget = (size_t)(SweepMemoryBudget*1048576.0);
+     if ( SweepBytes + Bytes > Budget )
+      { Log("AGB low-frequency series for (%i,%i) (%.1f MB) exceeds memory budget",
+             noa, nob, Bytes/1048576.0);
+        return 0;
+      };
+     S=GSeriesBlocks[nb]=new GTaylorSeries(this, noa, nob, GSeriesOrder);
+     SweepBytes += S->Bytes;
+   };
+
+  return S;
+}
+
+} // namespace buff
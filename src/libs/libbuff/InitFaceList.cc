@@ -31,6 +31,8 @@
 #include "libscuff.h"
 #include "libbuff.h"
 
+#include <algorithm>
+
 using namespace scuff;
 namespace buff{
 
@@ -278,4 +280,107 @@ void SWGVolume::InitFaceList()
 
 }
 
+/***************************************************************/
+/* InitBFNeighborLists: build two incidence structures used to */
+/* enumerate pairs of basis functions with common vertices     */
+/* without comparing every pair:                               */
+/*                                                             */
+/*  (a) for each vertex nv, VertexBFList[VertexBFStart[nv]...  */
+/*      VertexBFStart[nv+1]-1] are the indices of the interior */
+/*      faces (basis functions) whose support (both tets)      */
+/*      contains that vertex.                                  */
+/*                                                             */
+/*  (b) for each basis function nf, NeighborList[NeighborStart */
+/*      [nf]...NeighborStart[nf+1]-1] are the indices, in      */
+/*      ascending order, of all basis functions (including nf  */
+/*      itself) with at least one vertex in common with nf,    */
+/*      and NeighborNCV[...] is the number of common vertices  */
+/*      as counted by CompareBFs.                              */
+/***************************************************************/
+void SWGVolume::InitBFNeighborLists()
+{
+  int NF = NumInteriorFaces;
+
+  /*--------------------------------------------------------------*/
+  /*- vertex-to-BF incidence -------------------------------------*/
+  /*--------------------------------------------------------------*/
+  VertexBFStart = (int *)mallocEC((NumVertices+1)*sizeof(int));
+  for(int nf=0; nf<NF; nf++)
+   { SWGFace *F=Faces[nf];
+     VertexBFStart[F->iQP+1]++;
+     VertexBFStart[F->iV1+1]++;
+     VertexBFStart[F->iV2+1]++;
+     VertexBFStart[F->iV3+1]++;
+     VertexBFStart[F->iQM+1]++;
+   };
+  for(int nv=0; nv<NumVertices; nv++)
+   VertexBFStart[nv+1]+=VertexBFStart[nv];
+
+  VertexBFList = (int *)mallocEC(VertexBFStart[NumVertices]*sizeof(int));
+  int *Fill = (int *)mallocEC(NumVertices*sizeof(int));
+  memcpy(Fill, VertexBFStart, NumVertices*sizeof(int));
+  for(int nf=0; nf<NF; nf++)
+   { SWGFace *F=Faces[nf];
+     VertexBFList[ Fill[F->iQP]++ ] = nf;
+     VertexBFList[ Fill[F->iV1]++ ] = nf;
+     VertexBFList[ Fill[F->iV2]++ ] = nf;
+     VertexBFList[ Fill[F->iV3]++ ] = nf;
+     VertexBFList[ Fill[F->iQM]++ ] = nf;
+   };
+
+  /*--------------------------------------------------------------*/
+  /*- BF neighbor lists: each visit of BF nfb via one of the      */
+  /*- vertices of BF nfa accounts for one common vertex; since    */
+  /*- the five vertices of a BF are distinct, the number of visits*/
+  /*- is the common-vertex count.                                 */
+  /*--------------------------------------------------------------*/
+  int *Count = (int *)mallocEC(NF*sizeof(int));
+  int *Touched = (int *)mallocEC(5*NF*sizeof(int));
+  NeighborStart = (int *)mallocEC((NF+1)*sizeof(int));
+  int MaxNeighbors = 0, NumNeighbors=0, *NBList=0;
+  char *NCVList=0;
+  for(int nfa=0; nfa<NF; nfa++)
+   { SWGFace *F=Faces[nfa];
+     int VI[5]={F->iQP, F->iV1, F->iV2, F->iV3, F->iQM};
+     int NumTouched=0;
+     for(int n=0; n<5; n++)
+      for(int m=VertexBFStart[VI[n]]; m<VertexBFStart[VI[n]+1]; m++)
+       { int nfb=VertexBFList[m];
+         if (Count[nfb]++ == 0)
+          Touched[NumTouched++]=nfb;
+       };
+     std::sort(Touched, Touched + NumTouched);
+
+     if (NumNeighbors + NumTouched > MaxNeighbors)
+      { MaxNeighbors = 2*MaxNeighbors + NumTouched + 5*NF;
+        NBList  = (int *)reallocEC(NBList, MaxNeighbors*sizeof(int));
+        NCVList = (char *)reallocEC(NCVList, MaxNeighbors*sizeof(char));
+      };
+     for(int n=0; n<NumTouched; n++)
+      { NBList[NumNeighbors]    = Touched[n];
+        NCVList[NumNeighbors++] = (char)Count[Touched[n]];
+        Count[Touched[n]]=0;
+      };
+     NeighborStart[nfa+1]=NumNeighbors;
+   };
+  NeighborList = NBList;
+  NeighborNCV  = NCVList;
+
+  free(Fill);
+  free(Count);
+  free(Touched);
+}
+
+/***************************************************************/
+/* number of vertices common to basis functions nfA and nfB,   */
+/* looked up in the neighbor list of nfA.                      */
+/***************************************************************/
+int SWGVolume::GetNumCommonVertices(int nfA, int nfB)
+{
+  int *Begin = NeighborList + NeighborStart[nfA];
+  int *End   = NeighborList + NeighborStart[nfA+1];
+  int *p = std::lower_bound(Begin, End, nfB);
+  return (p==End || *p!=nfB) ? 0 : NeighborNCV[p - NeighborList];
+}
+
 } // namespace buff
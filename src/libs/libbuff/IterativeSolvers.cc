@@ -0,0 +1,456 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * IterativeSolvers.cc -- krylov-subspace solvers for VIE systems
+ *                     -- in which the matrix is only available
+ *                     -- through its action on vectors, and the
+ *                     -- matrix-free VIE operator
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <libhrutil.h>
+
+#include "libbuff.h"
+
+using namespace scuff;
+
+namespace buff {
+
+/***************************************************************/
+/* conjugate-linear inner product and norm of complex vectors  */
+/***************************************************************/
+static cdouble ZVecHDot(int N, cdouble *X, cdouble *Y)
+{ cdouble Sum=0.0;
+  for(int n=0; n<N; n++)
+   Sum += conj(X[n])*Y[n];
+  return Sum;
+}
+
+static double ZVecNorm(int N, cdouble *X)
+{ return sqrt( real(ZVecHDot(N, X, X)) ); }
+
+/***************************************************************/
+/* restarted GMRES with right preconditioning.                 */
+/*                                                             */
+/* On entry, X is the initial guess; on return it contains the */
+/* solution. If PInv is non-null, it is applied as a right     */
+/* preconditioner, i.e. we solve (A*PInv)*Y = B and then set   */
+/* X = PInv*Y.                                                 */
+/*                                                             */
+/* The return value is the number of iterations; the relative  */
+/* residual at the final iteration is returned in *pResidual.  */
+/***************************************************************/
+int GMRES(LinearOperator A, void *AData,
+          LinearOperator PInv, void *PData,
+          HVector *B, HVector *X,
+          double RelTol, int MaxIters, int Restart,
+          double *pResidual)
+{
+  int N = B->N;
+  int M = Restart;
+
+  /*--------------------------------------------------------------*/
+  /*- allocate Krylov basis and Hessenberg matrix ----------------*/
+  /*--------------------------------------------------------------*/
+  HVector **V = (HVector **)mallocEC( (M+1)*sizeof(HVector *) );
+  for(int m=0; m<=M; m++)
+   V[m] = new HVector(N, LHM_COMPLEX);
+  HVector *W = new HVector(N, LHM_COMPLEX);
+  HVector *Z = new HVector(N, LHM_COMPLEX);
+
+  cdouble *H  = (cdouble *)mallocEC( (M+1)*M*sizeof(cdouble) );
+  cdouble *g  = (cdouble *)mallocEC( (M+1)*sizeof(cdouble) );
+  cdouble *y  = (cdouble *)mallocEC( M*sizeof(cdouble) );
+  cdouble *sn = (cdouble *)mallocEC( M*sizeof(cdouble) );
+  double  *cs = (double  *)mallocEC( M*sizeof(double) );
+#define HH(i,j) H[ (i) + (j)*(M+1) ]
+
+  double BNorm = ZVecNorm(N, B->ZV);
+  if (BNorm==0.0)
+   BNorm=1.0;
+
+  int Iter=0;
+  double Residual=1.0;
+  bool Converged=false;
+  while( !Converged && Iter<MaxIters )
+   {
+     /*--------------------------------------------------------------*/
+     /*- R = B - A*X ------------------------------------------------*/
+     /*--------------------------------------------------------------*/
+     A(X, W, AData);
+     for(int n=0; n<N; n++)
+      W->ZV[n] = B->ZV[n] - W->ZV[n];
+     double Beta = ZVecNorm(N, W->ZV);
+     Residual = Beta / BNorm;
+     if (Residual<RelTol)
+      { Converged=true;
+        break;
+      };
+
+     for(int n=0; n<N; n++)
+      V[0]->ZV[n] = W->ZV[n] / Beta;
+     for(int m=0; m<=M; m++)
+      g[m]=0.0;
+     g[0]=Beta;
+
+     /*--------------------------------------------------------------*/
+     /*- Arnoldi iteration ------------------------------------------*/
+     /*--------------------------------------------------------------*/
+     int NumVecs=0;
+     for(int j=0; j<M && Iter<MaxIters; j++)
+      {
+        if (PInv)
+         { PInv(V[j], Z, PData);
+           A(Z, W, AData);
+         }
+        else
+         A(V[j], W, AData);
+
+        // modified Gram-Schmidt
+        for(int i=0; i<=j; i++)
+         { HH(i,j) = ZVecHDot(N, V[i]->ZV, W->ZV);
+           for(int n=0; n<N; n++)
+            W->ZV[n] -= HH(i,j) * V[i]->ZV[n];
+         };
+        double WNorm = ZVecNorm(N, W->ZV);
+        HH(j+1,j) = WNorm;
+        if (WNorm!=0.0)
+         for(int n=0; n<N; n++)
+          V[j+1]->ZV[n] = W->ZV[n] / WNorm;
+
+        // apply previous Givens rotations to the new column
+        for(int i=0; i<j; i++)
+         { cdouble h1 = HH(i,j), h2 = HH(i+1,j);
+           HH(i,j)   =  cs[i]*h1 + sn[i]*h2;
+           HH(i+1,j) = -conj(sn[i])*h1 + cs[i]*h2;
+         };
+
+        // compute and apply a new rotation to zero out HH(j+1,j)
+        cdouble a=HH(j,j), b=HH(j+1,j);
+        double Denom = sqrt( norm(a) + norm(b) );
+        if (abs(a)==0.0)
+         { cs[j]=0.0; sn[j]=1.0; }
+        else
+         { cs[j] = abs(a) / Denom;
+           sn[j] = (a/abs(a)) * conj(b) / Denom;
+         };
+        HH(j,j)   = cs[j]*a + sn[j]*b;
+        HH(j+1,j) = 0.0;
+        g[j+1]    = -conj(sn[j])*g[j];
+        g[j]      = cs[j]*g[j];
+
+        Iter++;
+        NumVecs=j+1;
+        Residual = abs(g[j+1]) / BNorm;
+        if (Residual<RelTol || WNorm==0.0)
+         { Converged=true;
+           break;
+         };
+      };
+
+     /*--------------------------------------------------------------*/
+     /*- solve the triangular system and update X -------------------*/
+     /*--------------------------------------------------------------*/
+     for(int i=NumVecs-1; i>=0; i--)
+      { y[i]=g[i];
+        for(int k=i+1; k<NumVecs; k++)
+         y[i] -= HH(i,k)*y[k];
+        y[i] /= HH(i,i);
+      };
+
+     W->Zero();
+     for(int i=0; i<NumVecs; i++)
+      for(int n=0; n<N; n++)
+       W->ZV[n] += y[i]*V[i]->ZV[n];
+
+     if (PInv)
+      { PInv(W, Z, PData);
+        for(int n=0; n<N; n++)
+         X->ZV[n] += Z->ZV[n];
+      }
+     else
+      for(int n=0; n<N; n++)
+       X->ZV[n] += W->ZV[n];
+
+     Log(" GMRES iteration %i: residual %e",Iter,Residual);
+   };
+
+  if (!Converged)
+   Warn("GMRES did not converge in %i iterations (residual %e)",Iter,Residual);
+
+  if (pResidual)
+   *pResidual=Residual;
+
+  /*--------------------------------------------------------------*/
+  /*--------------------------------------------------------------*/
+  /*--------------------------------------------------------------*/
+  for(int m=0; m<=M; m++)
+   delete V[m];
+  free(V);
+  delete W;
+  delete Z;
+  free(H);
+  free(g);
+  free(y);
+  free(sn);
+  free(cs);
+
+  return Iter;
+
+}
+
+/***************************************************************/
+/* BiCGStab with right preconditioning; arguments and return   */
+/* value as for GMRES above.                                   */
+/***************************************************************/
+int BiCGStab(LinearOperator A, void *AData,
+             LinearOperator PInv, void *PData,
+             HVector *B, HVector *X,
+             double RelTol, int MaxIters,
+             double *pResidual)
+{
+  int N = B->N;
+  HVector *R    = new HVector(N, LHM_COMPLEX);
+  HVector *RHat = new HVector(N, LHM_COMPLEX);
+  HVector *P    = new HVector(N, LHM_COMPLEX);
+  HVector *PHat = new HVector(N, LHM_COMPLEX);
+  HVector *V    = new HVector(N, LHM_COMPLEX);
+  HVector *S    = new HVector(N, LHM_COMPLEX);
+  HVector *SHat = new HVector(N, LHM_COMPLEX);
+  HVector *T    = new HVector(N, LHM_COMPLEX);
+
+  double BNorm = ZVecNorm(N, B->ZV);
+  if (BNorm==0.0)
+   BNorm=1.0;
+
+  // R = RHat = B - A*X
+  A(X, R, AData);
+  for(int n=0; n<N; n++)
+   R->ZV[n] = B->ZV[n] - R->ZV[n];
+  RHat->Copy(R);
+  P->Zero();
+  V->Zero();
+
+  cdouble Rho=1.0, Alpha=1.0, Omega=1.0;
+  double Residual = ZVecNorm(N, R->ZV) / BNorm;
+  bool Converged = (Residual<RelTol);
+  int Iter=0;
+  while( !Converged && Iter<MaxIters )
+   {
+     Iter++;
+
+     cdouble RhoNew = ZVecHDot(N, RHat->ZV, R->ZV);
+     if (RhoNew==0.0)
+      { Warn("BiCGStab breakdown (rho=0) at iteration %i",Iter);
+        break;
+      };
+     cdouble Beta = (RhoNew/Rho) * (Alpha/Omega);
+     Rho = RhoNew;
+     for(int n=0; n<N; n++)
+      P->ZV[n] = R->ZV[n] + Beta*(P->ZV[n] - Omega*V->ZV[n]);
+
+     if (PInv)
+      PInv(P, PHat, PData);
+     else
+      PHat->Copy(P);
+     A(PHat, V, AData);
+     Alpha = Rho / ZVecHDot(N, RHat->ZV, V->ZV);
+
+     for(int n=0; n<N; n++)
+      S->ZV[n] = R->ZV[n] - Alpha*V->ZV[n];
+     Residual = ZVecNorm(N, S->ZV) / BNorm;
+     if (Residual<RelTol)
+      { for(int n=0; n<N; n++)
+         X->ZV[n] += Alpha*PHat->ZV[n];
+        Converged=true;
+        break;
+      };
+
+     if (PInv)
+      PInv(S, SHat, PData);
+     else
+      SHat->Copy(S);
+     A(SHat, T, AData);
+     Omega = ZVecHDot(N, T->ZV, S->ZV) / ZVecHDot(N, T->ZV, T->ZV);
+
+     for(int n=0; n<N; n++)
+      { X->ZV[n] += Alpha*PHat->ZV[n] + Omega*SHat->ZV[n];
+        R->ZV[n]  = S->ZV[n] - Omega*T->ZV[n];
+      };
+     Residual = ZVecNorm(N, R->ZV) / BNorm;
+     Converged = (Residual<RelTol);
+
+     Log(" BiCGStab iteration %i: residual %e",Iter,Residual);
+   };
+
+  if (!Converged)
+   Warn("BiCGStab did not converge in %i iterations (residual %e)",Iter,Residual);
+
+  if (pResidual)
+   *pResidual=Residual;
+
+  delete R;
+  delete RHat;
+  delete P;
+  delete PHat;
+  delete V;
+  delete S;
+  delete SHat;
+  delete T;
+
+  return Iter;
+
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+VIEOperator::VIEOperator(SWGGeometry *pG, int pSolver, int pPreconditioner)
+{
+  G              = pG;
+  Solver         = pSolver;
+  Preconditioner = pPreconditioner;
+  RelTol         = 1.0e-6;
+  MaxIters       = 1000;
+  Restart        = 50;
+
+  if (Solver!=BUFF_SOLVER_GMRES && Solver!=BUFF_SOLVER_BICGSTAB)
+   ErrExit("%s:%i: invalid solver type %i",__FILE__,__LINE__,Solver);
+
+  GMatrix = new ACAMatrix(G);
+
+  int NO = G->NumObjects;
+  VInvBlocks = (SMatrix **)mallocEC(NO*sizeof(SMatrix *));
+  XBlocks    = (HVector **)mallocEC(NO*sizeof(HVector *));
+  YBlocks    = (HVector **)mallocEC(NO*sizeof(HVector *));
+  for(int no=0; no<NO; no++)
+   { int NBF = G->Objects[no]->NumInteriorFaces;
+     VInvBlocks[no] = new SMatrix(NBF, NBF, LHM_COMPLEX);
+     VInvBlocks[no]->BeginAssembly(MAXOVERLAP);
+     XBlocks[no] = new HVector(NBF, LHM_COMPLEX);
+     YBlocks[no] = new HVector(NBF, LHM_COMPLEX);
+   };
+  VInvAssembled=false;
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+VIEOperator::~VIEOperator()
+{
+  for(int no=0; no<G->NumObjects; no++)
+   { delete VInvBlocks[no];
+     delete XBlocks[no];
+     delete YBlocks[no];
+   };
+  free(VInvBlocks);
+  free(XBlocks);
+  free(YBlocks);
+  delete GMatrix;
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+void VIEOperator::Assemble(cdouble Omega)
+{
+  GMatrix->Assemble(Omega);
+
+  for(int no=0; no<G->NumObjects; no++)
+   { Log("Assembling VInv(%i)",no);
+     G->AssembleOverlapBlocks(no, Omega, 0, 0.0, 0.0, 0, VInvBlocks[no], 0);
+   };
+  if (!VInvAssembled)
+   { for(int no=0; no<G->NumObjects; no++)
+      VInvBlocks[no]->EndAssembly();
+     VInvAssembled=true;
+   };
+
+  if (Preconditioner==BUFF_PRECOND_OVERLAP)
+   GMatrix->Factorize(VInvBlocks, false);
+  else if (Preconditioner==BUFF_PRECOND_NEARFIELD)
+   GMatrix->Factorize(VInvBlocks, true);
+}
+
+/***************************************************************/
+/* Y = G*X + VInv*X, with VInv applied one object at a time    */
+/***************************************************************/
+void VIEOperator::Apply(HVector *X, HVector *Y)
+{
+  GMatrix->Apply(X, Y);
+
+  for(int no=0; no<G->NumObjects; no++)
+   { int Offset = G->BFIndexOffset[no];
+     int NBF    = G->Objects[no]->NumInteriorFaces;
+     memcpy(XBlocks[no]->ZV, X->ZV + Offset, NBF*sizeof(cdouble));
+     VInvBlocks[no]->Apply(XBlocks[no], YBlocks[no]);
+     for(int nbf=0; nbf<NBF; nbf++)
+      Y->ZV[Offset + nbf] += YBlocks[no]->ZV[nbf];
+   };
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+void VIEOperator::ApplyPreconditioner(HVector *X, HVector *Y)
+{
+  if (Preconditioner==BUFF_PRECOND_NONE)
+   Y->Copy(X);
+  else
+   GMatrix->ApplyPreconditioner(X, Y);
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+static void VIEOperatorApply(HVector *X, HVector *Y, void *UserData)
+{ ((VIEOperator *)UserData)->Apply(X, Y); }
+
+static void VIEOperatorPreconditioner(HVector *X, HVector *Y, void *UserData)
+{ ((VIEOperator *)UserData)->ApplyPreconditioner(X, Y); }
+
+int VIEOperator::Solve(HVector *J)
+{
+  HVector *RHS = new HVector(J->N, LHM_COMPLEX);
+  RHS->Copy(J);
+  J->Zero();
+
+  LinearOperator PInv
+   = (Preconditioner==BUFF_PRECOND_NONE) ? 0 : VIEOperatorPreconditioner;
+
+  double Residual;
+  int NumIters;
+  if (Solver==BUFF_SOLVER_BICGSTAB)
+   NumIters=BiCGStab(VIEOperatorApply, (void *)this, PInv, (void *)this,
+                     RHS, J, RelTol, MaxIters, &Residual);
+  else
+   NumIters=GMRES(VIEOperatorApply, (void *)this, PInv, (void *)this,
+                  RHS, J, RelTol, MaxIters, Restart, &Residual);
+  Log("Iterative solve: %i iterations (residual %e)",NumIters,Residual);
+
+  delete RHS;
+  return NumIters;
+}
+
+} // namespace buff
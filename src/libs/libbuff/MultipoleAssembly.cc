@@ -0,0 +1,174 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * MultipoleAssembly.cc -- assembly of G-matrix blocks for pairs of
+ *                      -- distinct, well-separated objects from the
+ *                      -- multipole moments of the basis functions
+ *
+ * Expanding the dyadic Green's function about the face centroids
+ * x_a, x_b of two basis functions to first order in the displacements
+ * gives
+ *
+ *  G_{ab} = J^a_Mu G_{MuNu}(R) J^b_Nu
+ *          + dG_{MuNu}/dR_Rho (Q^a_{MuRho} J^b_Nu - J^a_Mu Q^b_{NuRho})
+ *
+ * with R = x_a - x_b, J^a = \int b_a the dipole moment of BF a and
+ * Q^a_{MuRho} = \int b_{a,Mu} (x-x_a)_Rho its quadrupole moment.
+ *
+ * The relative error of this approximation is of order
+ * (Rho/r)^2 + (k Rho)^2, with Rho the larger of the two BF radii and
+ * r = |R|; BF pairs for which this exceeds MultipoleTolerance are
+ * computed by full cubature instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <libhrutil.h>
+
+#include "libscuff.h"
+#include "libbuff.h"
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#ifdef USE_OPENMP
+#  include <omp.h>
+#endif
+
+namespace scuff {
+
+void CalcGC(double R1[3], double R2[3],
+            cdouble Omega, cdouble EpsR, cdouble MuR,
+            cdouble GMuNu[3][3], cdouble CMuNu[3][3],
+            cdouble GMuNuRho[3][3][3], cdouble CMuNuRho[3][3][3]);
+
+}
+
+using namespace scuff;
+
+namespace buff {
+
+/***************************************************************/
+/* dipole and quadrupole moments of all BFs in one object,     */
+/* each about its own face centroid                            */
+/***************************************************************/
+typedef struct BFMoments
+ { double J[3];
+   double Q[3][3];
+ } BFMoments;
+
+static BFMoments *GetBFMoments(SWGVolume *O)
+{
+  int NF = O->NumInteriorFaces;
+  BFMoments *M = new BFMoments[NF];
+  for(int nf=0; nf<NF; nf++)
+   GetDQMoments(O, nf, M[nf].J, M[nf].Q);
+  return M;
+}
+
+/***************************************************************/
+/* estimated relative error of the multipole approximation for */
+/* BF pair (a,b), with Rho the larger BF radius and r the      */
+/* centroid distance. with dipole and quadrupole moments kept, */
+/* the first neglected terms of the expansion of G about the   */
+/* centroids are of second order in the source offsets, i.e.   */
+/* relative size (Rho/r)^2 from the static part and (k Rho)^2  */
+/* from the phase. the prefactors 2 and 0.1 are hand-chosen    */
+/* safety factors, not computed values.                        */
+/***************************************************************/
+static double GetMultipoleErrorEstimate(SWGFace *FA, SWGFace *FB, cdouble Omega)
+{
+  double Rho = fmax(FA->Radius, FB->Radius);
+  double r   = VecDistance(FA->Centroid, FB->Centroid);
+  double kRho = abs(Omega)*Rho;
+  return 2.0*(Rho*Rho)/(r*r) + 0.1*kRho*kRho;
+}
+
+/***************************************************************/
+/* G_{ab} from the multipole moments of a and b                */
+/***************************************************************/
+static cdouble GetGME_Multipole(SWGFace *FA, BFMoments *MA,
+                                SWGFace *FB, BFMoments *MB,
+                                cdouble Omega)
+{
+  cdouble GMuNu[3][3], CMuNu[3][3], GMuNuRho[3][3][3], CMuNuRho[3][3][3];
+  CalcGC(FA->Centroid, FB->Centroid, Omega, 1.0, 1.0,
+         GMuNu, CMuNu, GMuNuRho, CMuNuRho);
+
+  cdouble GAB=0.0;
+  for(int Mu=0; Mu<3; Mu++)
+   for(int Nu=0; Nu<3; Nu++)
+    { GAB += MA->J[Mu]*GMuNu[Mu][Nu]*MB->J[Nu];
+      for(int Rho=0; Rho<3; Rho++)
+       GAB += GMuNuRho[Mu][Nu][Rho]
+               *( MA->Q[Mu][Rho]*MB->J[Nu] - MA->J[Mu]*MB->Q[Nu][Rho] );
+    };
+
+  return GAB;
+}
+
+/***************************************************************/
+/* assemble the G-matrix block for distinct objects noa, nob   */
+/***************************************************************/
+void SWGGeometry::AssembleGBlockByMultipoles(int noa, int nob, cdouble Omega,
+                                             HMatrix *G,
+                                             int RowOffset, int ColOffset)
+{
+  SWGVolume *OA = Objects[noa];
+  SWGVolume *OB = Objects[nob];
+  int NFA = OA->NumInteriorFaces;
+  int NFB = OB->NumInteriorFaces;
+
+  BFMoments *MA = GetBFMoments(OA);
+  BFMoments *MB = GetBFMoments(OB);
+
+  int NumNearPairs=0;
+#ifdef USE_OPENMP
+  int NumThreads=GetNumThreads();
+#pragma omp parallel for schedule(dynamic,1),		\
+                         reduction(+:NumNearPairs),     \
+                         num_threads(NumThreads)
+#endif
+  for(int nfa=0; nfa<NFA; nfa++)
+   for(int nfb=0; nfb<NFB; nfb++)
+    {
+      SWGFace *FA = OA->Faces[nfa];
+      SWGFace *FB = OB->Faces[nfb];
+      cdouble GAB;
+      if ( GetMultipoleErrorEstimate(FA, FB, Omega) < MultipoleTolerance )
+       GAB=GetGME_Multipole(FA, MA+nfa, FB, MB+nfb, Omega);
+      else
+       { GAB=GetGMatrixElement(OA, nfa, OB, nfb, Omega, 0, 0);
+         NumNearPairs++;
+       };
+      G->SetEntry(RowOffset+nfa, ColOffset+nfb, GAB);
+    };
+
+  Log("AGB multipole assembly of G(%i,%i): %i/%i BF pairs by cubature",
+       noa, nob, NumNearPairs, NFA*NFB);
+
+  delete[] MA;
+  delete[] MB;
+}
+
+} // namespace buff
@@ -190,38 +190,27 @@ void GetOverlapIntegrals(SWGVolume *O, int nt,
   /***************************************************/
   SWGTet *T     = O->Tets[nt];
   double *QA    = O->Vertices + 3*(T->VI[ nQA ]);
-  double *V1    = O->Vertices + 3*(T->VI[ (nQA+1)%4 ]);
-  double *V2    = O->Vertices + 3*(T->VI[ (nQA+2)%4 ]);
-  double *V3    = O->Vertices + 3*(T->VI[ (nQA+3)%4 ]);
   double *QB    = O->Vertices + 3*iQB;
 
-  double L1[3], L2[3], L3[3];
-  VecSub(V1, QA, L1);
-  VecSub(V2, QA, L2);
-  VecSub(V3, QA, L3);
-
   SVTensor *EpsSVT= O->SVT;
 
   /***************************************************/
   /***************************************************/
   /***************************************************/
-  double *TetCR = GetTetCR(NumPts);
+  const double *X, *B, *W;
+  double Buffer[7*33];
+  GetTetCubatureData(O, nt, nQA, NumPts, &X, &B, &W, Buffer);
   memset(Integrals,0,fdim*sizeof(double));
   double *dI = new double[fdim];
   for(int np=0; np<NumPts; np++)
    { 
-     double u1=TetCR[4*np + 0];
-     double u2=TetCR[4*np + 1];
-     double u3=TetCR[4*np + 2];
-     double w=(6.0*T->Volume)*TetCR[4*np + 3];
+     double w=W[np];
 
      double x[3], bA[3], bB[3];
      for(int Mu=0; Mu<3; Mu++)
-      { bA[Mu] = u1*L1[Mu] + u2*L2[Mu] + u3*L3[Mu];
-        x[Mu]  = bA[Mu] + QA[Mu];
-        bB[Mu] = x[Mu]  - QB[Mu];
-        bA[Mu] *= PreFacA;
-        bB[Mu] *= PreFacB;
+      { x[Mu]  = X[Mu*NumPts + np];
+        bA[Mu] = PreFacA*(x[Mu] - QA[Mu]);
+        bB[Mu] = PreFacB*(x[Mu] - QB[Mu]);
       };
 
      Integrand(x, bA, 3.0*PreFacA, bB, 3.0*PreFacB,
@@ -0,0 +1,192 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * QuadTables.cc -- precomputed cubature points, weights, and SWG
+ *               -- function values for the fixed-order tetrahedral
+ *               -- cubature rules
+ *
+ * The fixed-order cubature routines evaluate the same affine map
+ * from the reference tetrahedron for every call on a given tet, and
+ * they are called many millions of times per matrix assembly. If
+ * SWGVolume::UseQuadTables is true, the results of the map for each
+ * rule are computed once per object and stored in an SWGQuadTable
+ * (see libbuff.h). A table costs 128*NumPts bytes per tetrahedron.
+ *
+ * All three rules are invariant under relabeling of the vertices of
+ * the tetrahedron, so one set of points serves all four SWG functions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <libhrutil.h>
+
+#include "libbuff.h"
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+using namespace scuff;
+
+namespace buff {
+
+bool SWGVolume::UseQuadTables=false;
+
+// serializes the (one-time) construction of tables
+static pthread_mutex_t QuadTableMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/***************************************************************/
+/* index of the table for a given rule in SWGVolume::QuadTables*/
+/***************************************************************/
+static int GetQuadTableIndex(int NumPts)
+{
+  switch(NumPts)
+   { case  4: return 0;
+     case 16: return 1;
+     case 33: return 2;
+     default: ErrExit("unsupported numpts %i in GetQuadTable",NumPts);
+   };
+  return 0;
+}
+
+/***************************************************************/
+/* fill in cubature points, weights, and the values of the     */
+/* unsigned SWG function with source vertex #iQ for a single   */
+/* tetrahedron, in the SoA layout of SWGQuadTable; if iQ<0 the */
+/* values of all four SWG functions are computed.              */
+/***************************************************************/
+static void FillTetCubatureData(SWGVolume *O, int nt, int iQ, int NumPts,
+                                double *X, double *B, double *W)
+{
+  SWGTet *T     = O->Tets[nt];
+  double *TetCR = GetTetCR(NumPts);
+  double *V0    = O->Vertices + 3*(T->VI[0]);
+  double *V1    = O->Vertices + 3*(T->VI[1]);
+  double *V2    = O->Vertices + 3*(T->VI[2]);
+  double *V3    = O->Vertices + 3*(T->VI[3]);
+
+  double L1[3], L2[3], L3[3];
+  VecSub(V1, V0, L1);
+  VecSub(V2, V0, L2);
+  VecSub(V3, V0, L3);
+  for(int np=0; np<NumPts; np++)
+   { double u1=TetCR[4*np+0], u2=TetCR[4*np+1], u3=TetCR[4*np+2];
+     for(int Mu=0; Mu<3; Mu++)
+      X[Mu*NumPts + np] = V0[Mu] + u1*L1[Mu] + u2*L2[Mu] + u3*L3[Mu];
+     W[np] = (6.0*T->Volume)*TetCR[4*np+3];
+   };
+
+  int iQMin = (iQ<0) ? 0 : iQ;
+  int iQMax = (iQ<0) ? 3 : iQ;
+  for(int i=iQMin; i<=iQMax; i++, B+=3*NumPts)
+   { double *Q    = O->Vertices + 3*(T->VI[i]);
+     double PreFac = O->Faces[T->FI[i]]->Area / (3.0*T->Volume);
+     for(int Mu=0; Mu<3; Mu++)
+      for(int np=0; np<NumPts; np++)
+       B[Mu*NumPts + np] = PreFac*(X[Mu*NumPts + np] - Q[Mu]);
+   };
+}
+
+/***************************************************************/
+/* get the table for the NumPts-point rule, building it if     */
+/* necessary; returns 0 if tables are disabled.                */
+/***************************************************************/
+SWGQuadTable *SWGVolume::GetQuadTable(int NumPts)
+{
+  if (!UseQuadTables)
+   return 0;
+
+  int nr = GetQuadTableIndex(NumPts);
+  SWGQuadTable *Table = QuadTables[nr];
+  if (Table)
+   return Table;
+
+  pthread_mutex_lock(&QuadTableMutex);
+  Table = QuadTables[nr];
+  if (Table==0)
+   { Table = new SWGQuadTable;
+     Table->NumPts = NumPts;
+     Table->X = (double *)mallocEC(3*NumTets*NumPts*sizeof(double));
+     Table->W = (double *)mallocEC(NumTets*NumPts*sizeof(double));
+     Table->B = (double *)mallocEC(12*NumTets*NumPts*sizeof(double));
+     for(int nt=0; nt<NumTets; nt++)
+      FillTetCubatureData(this, nt, -1, NumPts,
+                          Table->X + 3*nt*NumPts,
+                          Table->B + 12*nt*NumPts,
+                          Table->W + nt*NumPts);
+     Log("Built %i-point cubature table for %s (%lu kB).",
+          NumPts, Label, (16UL*NumTets*NumPts*sizeof(double))>>10);
+     __sync_synchronize();
+     QuadTables[nr] = Table;
+   };
+  pthread_mutex_unlock(&QuadTableMutex);
+  return Table;
+}
+
+/***************************************************************/
+/* discard all tables (e.g. after the vertices have moved);    */
+/* not safe to call concurrently with GetQuadTable.            */
+/***************************************************************/
+void SWGVolume::ClearQuadTables()
+{
+  for(int nr=0; nr<3; nr++)
+   { SWGQuadTable *Table = QuadTables[nr];
+     if (Table==0) continue;
+     free(Table->X);
+     free(Table->W);
+     free(Table->B);
+     delete Table;
+     QuadTables[nr]=0;
+   };
+}
+
+/***************************************************************/
+/* get pointers to the cubature points X, weights W, and the   */
+/* values B of the unsigned SWG function with source vertex    */
+/* #iQ on tetrahedron #nt, in the SoA layout of SWGQuadTable.  */
+/* the pointers refer to O's table if there is one, and are    */
+/* otherwise computed into Buffer, which must have room for    */
+/* 7*NumPts doubles.                                           */
+/***************************************************************/
+void GetTetCubatureData(SWGVolume *O, int nt, int iQ, int NumPts,
+                        const double **X, const double **B,
+                        const double **W, double *Buffer)
+{
+  SWGQuadTable *Table = O->GetQuadTable(NumPts);
+  if (Table)
+   { *X = Table->GetX(nt);
+     *B = Table->GetB(nt, iQ);
+     *W = Table->GetW(nt);
+     return;
+   };
+
+  double *XBuffer = Buffer;
+  double *BBuffer = Buffer + 3*NumPts;
+  double *WBuffer = Buffer + 6*NumPts;
+  FillTetCubatureData(O, nt, iQ, NumPts, XBuffer, BBuffer, WBuffer);
+  *X = XBuffer;
+  *B = BBuffer;
+  *W = WBuffer;
+}
+
+} // namespace buff
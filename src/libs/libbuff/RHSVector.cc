@@ -29,6 +29,7 @@
 #include <libhrutil.h>
 
 #include "libbuff.h"
+#include "TetCubature.h"
 
 #ifdef HAVE_CONFIG_H
 #  include "config.h"
@@ -52,32 +53,28 @@ HVector *SWGGeometry::AllocateRHSVector()
 }
 
 /***************************************************************/
+/* integrand functor for TetCubature.h                         */
 /***************************************************************/
-/***************************************************************/
-typedef struct RHSVectorIntegrandData 
+struct RHSVectorIntegrand
  {
    IncField *IF;
- } RHSVectorIntegrandData;
-
-void RHSVectorIntegrand(double *x, double *b, double Divb,
-                        void *UserData, double *I)
-{
-  (void )Divb; // unused
 
-  RHSVectorIntegrandData *Data = (RHSVectorIntegrandData *)UserData;
-  IncField *IF = Data->IF;
+   void operator()(double *x, double *b, double Divb, double *I)
+    {
+      (void )Divb; // unused
 
-  cdouble EH[6];
-  IF->GetFields(x, EH);
-  for(IncField *IFNode=IF->Next; IFNode!=0; IFNode=IFNode->Next)
-   { cdouble PartialEH[6];
-     IFNode->GetFields(x, PartialEH);
-     VecPlusEquals(EH, 1.0, PartialEH, 6);
-   };
+      cdouble EH[6];
+      IF->GetFields(x, EH);
+      for(IncField *IFNode=IF->Next; IFNode!=0; IFNode=IFNode->Next)
+       { cdouble PartialEH[6];
+         IFNode->GetFields(x, PartialEH);
+         VecPlusEquals(EH, 1.0, PartialEH, 6);
+       };
 
-  cdouble *zI = (cdouble *)I;
-  zI[0] = b[0]*EH[0] + b[1]*EH[1] + b[2]*EH[2];
-}
+      cdouble *zI = (cdouble *)I;
+      zI[0] = b[0]*EH[0] + b[1]*EH[1] + b[2]*EH[2];
+    }
+ };
 
 /***************************************************************/
 /***************************************************************/
@@ -86,8 +83,8 @@ HVector *SWGGeometry::AssembleRHSVector(cdouble Omega, IncField *IF, HVector *RH
 {
   IF->SetFrequency(Omega, true);
 
-  RHSVectorIntegrandData MyData, *Data=&MyData;
-  Data->IF = IF;
+  RHSVectorIntegrand Integrand;
+  Integrand.IF = IF;
  
   cdouble PreFactor = -1.0 / (II*Omega*ZVAC);
 
@@ -110,8 +107,7 @@ HVector *SWGGeometry::AssembleRHSVector(cdouble Omega, IncField *IF, HVector *RH
       { 
         cdouble Entry;
 
-        BFInt(O, nf, RHSVectorIntegrand, (void *)Data,
-              2, (double *)&Entry, 0, 33, 0, 0);
+        BFIntT<2>(O, nf, Integrand, (double *)&Entry, 33);
 
         RHS->SetEntry( Offset + nf, PreFactor * Entry);
 
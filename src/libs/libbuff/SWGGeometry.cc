@@ -45,6 +45,19 @@ namespace buff{
 /***************************************************************/
 double SWGGeometry::TaylorDuffyTolerance=1.0e-6;
 int SWGGeometry::MaxTaylorDuffyEvals=10000;
+int SWGGeometry::TaylorDuffyOrder=0;
+GMEQuadraturePolicy SWGGeometry::QuadraturePolicy;
+bool SWGGeometry::UseSymmetricStorage=true;
+double SWGGeometry::ACATolerance=1.0e-4;
+int SWGGeometry::ACALeafSize=64;
+double SWGGeometry::ACAEta=1.0;
+double SWGGeometry::SweepMemoryBudget=1024.0;
+int SWGGeometry::GSeriesOrder=8;
+double SWGGeometry::GSeriesTolerance=1.0e-4;
+double SWGGeometry::MultipoleTolerance=1.0e-3;
+double SWGGeometry::TouchingSeriesTolerance=1.0e-6;
+double SWGGeometry::GCacheMemoryBudget=0.0;
+bool SWGGeometry::UseSharedGCache=false;
 
 /***********************************************************************/
 /* parser subroutine for OBJECT...ENDOBJECT section in file ************/
@@ -220,6 +233,13 @@ SWGGeometry::SWGGeometry(const char *pGeoFileName)
   NumObjects=0;
   Objects=0;
   LogLevel=BUFF_TERSE_LOGGING;
+  UseHMatrix=false;
+  TetPairAssembly=false;
+  SweepBlocks=0;
+  SweepBytes=0;
+  UseGSeries=false;
+  UseMultipoleBlocks=false;
+  GSeriesBlocks=0;
 
   /***************************************************************/
   /***************************************************************/
@@ -242,6 +262,83 @@ SWGGeometry::SWGGeometry(const char *pGeoFileName)
      if (LogLevel>0)
       Log("Setting TaylorDuffy tolerance=%e.",TaylorDuffyTolerance);
    };
+  if ( (s=getenv("BUFF_TAYLORDUFFY_ORDER")) )
+   { if (!strcasecmp(s,"auto"))
+      TaylorDuffyOrder=-1;
+     else
+      sscanf(s,"%i",&TaylorDuffyOrder);
+     if (LogLevel>0)
+      Log("Setting TaylorDuffy cubature order=%s.",s);
+   };
+  if ( (s=getenv("BUFF_STATIC_TTI_TABLE")) )
+   { sscanf(s,"%lu",&StaticTTITableSize);
+     if (LogLevel>0)
+      Log("Setting static tet-pair integral table size=%lu.",StaticTTITableSize);
+   };
+  if ( (s=getenv("BUFF_SYMMETRIC_STORAGE")) )
+   { UseSymmetricStorage = (s[0]!='0');
+     if (LogLevel>0)
+      Log("%s symmetric storage of VIE matrices.",UseSymmetricStorage ? "Enabling" : "Disabling");
+   };
+  if ( (s=getenv("BUFF_QUADRATURE_TABLES")) )
+   { SWGVolume::UseQuadTables = (s[0]!='0');
+     if (LogLevel>0)
+      Log("%s precomputed cubature tables.",SWGVolume::UseQuadTables ? "Enabling" : "Disabling");
+   };
+  if ( (s=getenv("BUFF_GME_TOLERANCE")) )
+   { double GMETolerance;
+     sscanf(s,"%le",&GMETolerance);
+     QuadraturePolicy.SetTolerance(GMETolerance);
+     if (LogLevel>0)
+      Log("Setting G-matrix element tolerance=%e.",GMETolerance);
+   };
+  if ( (s=getenv("BUFF_ACA_TOLERANCE")) )
+   { sscanf(s,"%le",&ACATolerance);
+     if (LogLevel>0)
+      Log("Setting ACA tolerance=%e.",ACATolerance);
+   };
+  if ( (s=getenv("BUFF_TETPAIR_ASSEMBLY")) )
+   { TetPairAssembly = (s[0]!='0');
+     if (LogLevel>0)
+      Log("%s tet-pair G-matrix assembly.",TetPairAssembly ? "Enabling" : "Disabling");
+   };
+  if ( (s=getenv("BUFF_SWEEP_MEMORY")) )
+   { sscanf(s,"%le",&SweepMemoryBudget);
+     if (LogLevel>0)
+      Log("Setting frequency-sweep memory budget=%g MB.",SweepMemoryBudget);
+   };
+  if ( (s=getenv("BUFF_GSERIES_ORDER")) )
+   { sscanf(s,"%i",&GSeriesOrder);
+     UseGSeries = (GSeriesOrder>=0);
+     if (LogLevel>0)
+      Log("Setting low-frequency series order=%i.",GSeriesOrder);
+   };
+  if ( (s=getenv("BUFF_MULTIPOLE_TOLERANCE")) )
+   { sscanf(s,"%le",&MultipoleTolerance);
+     UseMultipoleBlocks = (MultipoleTolerance>0.0);
+     if (LogLevel>0)
+      Log("Setting multipole tolerance=%e.",MultipoleTolerance);
+   };
+  if ( (s=getenv("BUFF_TOUCHING_SERIES_TOLERANCE")) )
+   { sscanf(s,"%le",&TouchingSeriesTolerance);
+     if (LogLevel>0)
+      Log("Setting touching-pair series tolerance=%e.",TouchingSeriesTolerance);
+   };
+  if ( (s=getenv("BUFF_GCACHE_MEMORY")) )
+   { sscanf(s,"%le",&GCacheMemoryBudget);
+     if (LogLevel>0)
+      Log("Setting FIBBI cache memory budget=%g MB.",GCacheMemoryBudget);
+   };
+  if ( (s=getenv("BUFF_SHARED_GCACHE")) )
+   { UseSharedGCache = (s[0]!='0');
+     if (LogLevel>0)
+      Log("%s shared FIBBI cache.",UseSharedGCache ? "Enabling" : "Disabling");
+   };
+  if ( (s=getenv("BUFF_GSERIES_TOLERANCE")) )
+   { sscanf(s,"%le",&GSeriesTolerance);
+     if (LogLevel>0)
+      Log("Setting low-frequency series tolerance=%e.",GSeriesTolerance);
+   };
 
   /***************************************************************/
   /* try to open input file **************************************/
@@ -379,6 +476,7 @@ SWGGeometry::SWGGeometry(const char *pGeoFileName)
   /***************************************************************/
   /***************************************************************/
   ObjectGCaches  = (FIBBICache **)mallocEC(NumObjects * sizeof(FIBBICache *));
+  SharedGCache   = 0;
 
 }
 
@@ -387,6 +485,11 @@ SWGGeometry::SWGGeometry(const char *pGeoFileName)
 /***************************************************************/
 SWGGeometry::~SWGGeometry()
 {
+  EndFrequencySweep();
+  for(int no=0; no<NumObjects; no++)
+   if (ObjectGCaches[no]) delete ObjectGCaches[no];
+  free(ObjectGCaches);
+  if (SharedGCache) delete SharedGCache;
   for(int no=0; no<NumObjects; no++)
    delete Objects[no];
   free(Objects);
@@ -114,12 +114,16 @@ SWGVolume::SWGVolume(char *pMeshFileName,
   Vertices=0;
   Tets=0;
   Faces=0;
+  VertexBFStart=VertexBFList=0;
+  NeighborStart=NeighborList=0;
+  NeighborNCV=0;
   if (pLabel==0)
    Label=strdup(MeshFileName);
   else
    Label=strdup(pLabel);
   Index=0;
   Origin[0]=Origin[1]=Origin[2]=0.0;
+  QuadTables[0]=QuadTables[1]=QuadTables[2]=0;
 
   if (pMatFileName==0)
    { MatFileName=0;
@@ -178,6 +182,13 @@ SWGVolume::SWGVolume(char *pMeshFileName,
   /* complicated enough to warrant its own separate routine.    */
   /*------------------------------------------------------------*/
   InitFaceList();
+
+  /*------------------------------------------------------------*/
+  /* precompute lists of touching basis functions, which tell   */
+  /* the matrix-assembly routines which pairs need singular     */
+  /* integration.                                               */
+  /*------------------------------------------------------------*/
+  InitBFNeighborLists();
 } 
 
 /***************************************************************/
@@ -195,11 +206,19 @@ SWGVolume::~SWGVolume()
    free(Tets[nt]);
   free(Tets);
 
+  if (VertexBFStart) free(VertexBFStart);
+  if (VertexBFList) free(VertexBFList);
+  if (NeighborStart) free(NeighborStart);
+  if (NeighborList) free(NeighborList);
+  if (NeighborNCV) free(NeighborNCV);
+
   if (MeshFileName) free(MeshFileName);
   if (Label) free(Label);
   if (GT) delete GT;
   if (ErrMsg) free(ErrMsg);
 
+  ClearQuadTables();
+
 }
 
 /***************************************************************/
@@ -226,6 +245,9 @@ void SWGVolume::Transform(const GTransformation *DeltaGT)
   /* origin of coordinates */
   DeltaGT->Apply(Origin);
 
+  /* cubature tables are rebuilt on next use */
+  ClearQuadTables();
+
   /***************************************************************/
   /* update the internally stored GTransformation ****************/
   /***************************************************************/
@@ -279,6 +301,9 @@ void SWGVolume::UnTransform()
   /* origin of coordinates */
   GT->UnApply(Origin);
 
+  /* cubature tables are rebuilt on next use */
+  ClearQuadTables();
+
   /***************************************************************/
   /***************************************************************/
   /***************************************************************/
@@ -306,7 +331,12 @@ int CompareBFs(SWGVolume *OA, int nfA, SWGVolume *OB, int nfB,
 
   if (OA!=OB)
    return 0;
- 
+
+  // for pairs of interior faces the answer is in the precomputed
+  // neighbor lists
+  if (OA->NeighborList && nfA<OA->NumInteriorFaces && nfB<OA->NumInteriorFaces)
+   return OA->GetNumCommonVertices(nfA, nfB);
+
   int ncv=0;
 
   if (FA->iQP == FB->iQP ) ncv++;
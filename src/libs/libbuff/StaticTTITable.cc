@@ -0,0 +1,228 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * StaticTTITable.cc -- process-wide table of the static (r^p)
+ *                   -- Taylor-Duffy integrals over pairs of tetrahedra
+ *                   -- with 3 or 4 common vertices, keyed on the shape
+ *                   -- of the pair
+ *
+ * The six static tet-pair integrals computed by GetGMETTI_TaylorDuffy
+ * for the FIBBI data,
+ *
+ *  \int\int r^p (x-Q)\cdot(x'-Q') du du',   \int\int r^p du du'
+ *
+ * for p=-1,0,1 (integrated over the reference coordinates u, u'), are
+ * unchanged by rotations, reflections, and translations of the pair
+ * and scale as L^{p+2} and L^p under a scaling x -> L x. They are
+ * therefore functions only of the shape of the pair, which is fixed
+ * by the ordered list of distances between its vertices, and of the
+ * positions of the source vertices Q, Q' in that list.
+ *
+ * Here we key the integrals on those distances, normalized by the
+ * largest of them, so that tet pairs that are congruent or similar to
+ * a pair we have already done are looked up instead of recomputed.
+ * Meshes produced by structured generators contain only a handful of
+ * distinct shapes, so in those cases nearly all ncv=3,4 Taylor-Duffy
+ * calculations for FIBBI records are skipped. Distances are rounded
+ * to about 1 part in 10^9 before comparison, so only shapes that are
+ * identical to that precision are matched; there is no interpolation
+ * between shapes.
+ *
+ * The table holds at most SWGGeometry::StaticTTITableSize entries
+ * (0 disables it).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <map>
+
+#include <libhrutil.h>
+
+#include "libbuff.h"
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+using namespace scuff;
+
+namespace buff {
+
+unsigned long SWGGeometry::StaticTTITableSize=1UL<<20;
+
+#define STTI_MAXPOINTS 5
+#define STTI_MAXDISTS  (STTI_MAXPOINTS*(STTI_MAXPOINTS-1)/2)
+#define STTI_DATALEN   6
+
+// normalized distances are stored as integers in units of 1/STTI_SCALE
+#define STTI_SCALE     1.0e9
+
+/***************************************************************/
+/* shape key: the case (number of common vertices), the        */
+/* positions of Q and Q' among the vertices of the pair, and   */
+/* the normalized rounded distances between all vertices       */
+/***************************************************************/
+typedef struct STTIKey
+ { int ncv, iQ, iQP;
+   int Dists[STTI_MAXDISTS];
+
+   bool operator<(const STTIKey &K) const
+    { if (ncv!=K.ncv) return ncv<K.ncv;
+      if (iQ!=K.iQ)   return iQ<K.iQ;
+      if (iQP!=K.iQP) return iQP<K.iQP;
+      return memcmp(Dists, K.Dists, sizeof(Dists)) < 0;
+    }
+ } STTIKey;
+
+typedef struct STTIData
+ { double TTI[STTI_DATALEN];
+ } STTIData;
+
+typedef std::map<STTIKey, STTIData> STTIMap;
+
+static STTIMap STTITable;
+static pthread_rwlock_t STTILock = PTHREAD_RWLOCK_INITIALIZER;
+
+/***************************************************************/
+/* index of vertex #iV in a list of NumV vertex indices, or -1 */
+/***************************************************************/
+static int FindVertex(int iV, const int *VIs, int NumV)
+{ for(int n=0; n<NumV; n++)
+   if (VIs[n]==iV) return n;
+  return -1;
+}
+
+/***************************************************************/
+/* compute the shape key for a tet pair, as ordered by         */
+/* CompareTets, and the length scale L; returns false if the   */
+/* pair is not one we handle.                                  */
+/***************************************************************/
+static bool GetSTTIKey(SWGVolume *OA, int OVIA[4], int iQA,
+                       SWGVolume *OB, int OVIB[4], int iQB,
+                       int ncv, STTIKey *Key, double *L)
+{
+  if ( ncv<3 || ncv>4 || OA!=OB )
+   return false;
+
+  // vertices V1..V4 of tet A, followed (for ncv=3) by V4' of tet B
+  double *V[STTI_MAXPOINTS];
+  int NumPoints=4;
+  for(int n=0; n<4; n++)
+   V[n] = OA->Vertices + 3*OVIA[n];
+  if (ncv==3)
+   V[NumPoints++] = OB->Vertices + 3*OVIB[3];
+
+  memset(Key, 0, sizeof(*Key));
+  Key->ncv = ncv;
+  Key->iQ  = FindVertex(iQA, OVIA, 4);
+  Key->iQP = FindVertex(iQB, OVIB, 4);
+  if (Key->iQ<0 || Key->iQP<0)
+   return false;
+
+  double D[STTI_MAXDISTS], DMax=0.0;
+  int NumDists=0;
+  for(int m=0; m<NumPoints; m++)
+   for(int n=m+1; n<NumPoints; n++)
+    { D[NumDists] = VecDistance(V[m], V[n]);
+      if (D[NumDists]>DMax) DMax=D[NumDists];
+      NumDists++;
+    };
+  if (DMax==0.0)
+   return false;
+
+  for(int nd=0; nd<NumDists; nd++)
+   Key->Dists[nd] = (int)lround(STTI_SCALE*D[nd]/DMax);
+
+  *L=DMax;
+  return true;
+}
+
+/***************************************************************/
+/* scaling exponents of the six entries of the static TTI      */
+/* vector (see GetGMETTI_TaylorDuffy): the (b.b', p) entries   */
+/* scale like L^{p+2}, the (unity, p) entries like L^p         */
+/***************************************************************/
+static const int STTIScalePower[STTI_DATALEN]={ 1, -1, 2, 0, 3, 1 };
+
+/***************************************************************/
+/* look up the static tet-pair integrals for a pair of tets;   */
+/* returns true and fills in TTI if a pair of the same shape   */
+/* has been computed before.                                   */
+/***************************************************************/
+bool GetStaticTTI(SWGVolume *OA, int OVIA[4], int iQA,
+                  SWGVolume *OB, int OVIB[4], int iQB,
+                  int ncv, double *TTI)
+{
+  if (SWGGeometry::StaticTTITableSize==0)
+   return false;
+
+  STTIKey Key;
+  double L;
+  if (!GetSTTIKey(OA, OVIA, iQA, OB, OVIB, iQB, ncv, &Key, &L))
+   return false;
+
+  pthread_rwlock_rdlock(&STTILock);
+  STTIMap::iterator it=STTITable.find(Key);
+  bool Found = (it!=STTITable.end());
+  if (Found)
+   memcpy(TTI, it->second.TTI, STTI_DATALEN*sizeof(double));
+  pthread_rwlock_unlock(&STTILock);
+
+  if (Found)
+   for(int n=0; n<STTI_DATALEN; n++)
+    TTI[n]*=pow(L, STTIScalePower[n]);
+
+  return Found;
+}
+
+/***************************************************************/
+/* add the static tet-pair integrals for a pair of tets to the */
+/* table                                                       */
+/***************************************************************/
+void AddStaticTTI(SWGVolume *OA, int OVIA[4], int iQA,
+                  SWGVolume *OB, int OVIB[4], int iQB,
+                  int ncv, double *TTI)
+{
+  if (SWGGeometry::StaticTTITableSize==0)
+   return;
+
+  STTIKey Key;
+  double L;
+  if (!GetSTTIKey(OA, OVIA, iQA, OB, OVIB, iQB, ncv, &Key, &L))
+   return;
+
+  STTIData Data;
+  for(int n=0; n<STTI_DATALEN; n++)
+   Data.TTI[n] = TTI[n]*pow(L, -STTIScalePower[n]);
+
+  pthread_rwlock_wrlock(&STTILock);
+  if (STTITable.size() < SWGGeometry::StaticTTITableSize)
+   { STTITable.insert( std::make_pair(Key, Data) );
+     if (STTITable.size()==SWGGeometry::StaticTTITableSize)
+      Log("Static tet-pair integral table is full (%lu shapes).",
+           SWGGeometry::StaticTTITableSize);
+   };
+  pthread_rwlock_unlock(&STTILock);
+}
+
+} // namespace buff
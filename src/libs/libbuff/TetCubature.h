@@ -0,0 +1,279 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * TetCubature.h -- templated versions of the cubature routines in
+ *               -- Cubature.cc
+ *
+ * TetIntT, BFIntT, TetTetIntT, and BFBFIntT take the integrand as
+ * a functor instead of a function pointer plus void *UserData, so
+ * that the integrand can be inlined into the cubature loop, and the
+ * number of integrand components FDIM as a template parameter, so
+ * that all buffers live on the stack. A functor for single-tet
+ * integrals has the signature
+ *
+ *   void operator()(double *x, double *b, double Divb, double *I);
+ *
+ * and one for tet-pair integrals
+ *
+ *   void operator()(double *xA, double *bA, double DivbA,
+ *                   double *xB, double *bB, double DivbB, double *I);
+ *
+ * with the same meaning of the arguments as for UserTIntegrand and
+ * UserTTIntegrand. FDIM=0 means that the number of components is
+ * given at runtime by the fdim argument.
+ *
+ * NumPts=0 requests adaptive cubature, which goes through the
+ * function-pointer routines in Cubature.cc.
+ */
+#ifndef TETCUBATURE_H
+#define TETCUBATURE_H
+
+#include <string.h>
+
+#include "libbuff.h"
+
+namespace buff {
+
+// largest runtime fdim for which FDIM=0 instantiations use stack buffers
+#define TETCUBATURE_MAXFDIM 32
+
+/***************************************************************/
+/* adapters that let a functor be passed to the function-      */
+/* pointer routines                                            */
+/***************************************************************/
+template<typename Integrand>
+void TIntegrandAdapter(double *x, double *b, double Divb,
+                       void *UserData, double *I)
+{
+  (*(Integrand *)UserData)(x, b, Divb, I);
+}
+
+template<typename Integrand>
+void TTIntegrandAdapter(double *xA, double *bA, double DivbA,
+                        double *xB, double *bB, double DivbB,
+                        void *UserData, double *I)
+{
+  (*(Integrand *)UserData)(xA, bA, DivbA, xB, bB, DivbB, I);
+}
+
+/***************************************************************/
+/* functors that wrap function-pointer integrands              */
+/***************************************************************/
+struct UserTIntegrandFunctor
+ {
+   UserTIntegrand Integrand;
+   void *UserData;
+   void operator()(double *x, double *b, double Divb, double *I)
+    { Integrand(x, b, Divb, UserData, I); }
+ };
+
+struct UserTTIntegrandFunctor
+ {
+   UserTTIntegrand Integrand;
+   void *UserData;
+   void operator()(double *xA, double *bA, double DivbA,
+                   double *xB, double *bB, double DivbB, double *I)
+    { Integrand(xA, bA, DivbA, xB, bB, DivbB, UserData, I); }
+ };
+
+/***************************************************************/
+/* integral over a single tetrahedron (see TetInt)             */
+/***************************************************************/
+template<int FDIM, typename Integrand>
+void TetIntT(SWGVolume *V, int nt, int iQ, double Sign,
+             Integrand &F, double *Result, int NumPts,
+             double *Error=0, int MaxEvals=0, double RelTol=0.0,
+             int fdim=FDIM)
+{
+  if (FDIM>0) fdim=FDIM;
+
+  if (NumPts==0)
+   { TetInt(V, nt, iQ, Sign, TIntegrandAdapter<Integrand>, (void *)&F,
+            fdim, Result, Error, NumPts, MaxEvals, RelTol);
+     return;
+   };
+
+  SWGTet *T     = V->Tets[nt];
+  double PreFac = Sign*V->Faces[T->FI[iQ]]->Area / (3.0 * T->Volume);
+
+  const double *X, *B, *W;
+  double Buffer[7*33];
+  GetTetCubatureData(V, nt, iQ, NumPts, &X, &B, &W, Buffer);
+
+  double dIBuffer[ FDIM>0 ? FDIM : TETCUBATURE_MAXFDIM ];
+  double *dI = (FDIM>0 || fdim<=TETCUBATURE_MAXFDIM) ? dIBuffer : new double[fdim];
+
+  memset(Result, 0, fdim*sizeof(double));
+  for(int np=0; np<NumPts; np++)
+   {
+     double x[3], b[3];
+     for(int Mu=0; Mu<3; Mu++)
+      { x[Mu] = X[Mu*NumPts + np];
+        b[Mu] = Sign*B[Mu*NumPts + np];
+      };
+
+     F(x, b, 3.0*PreFac, dI);
+
+     double w=W[np];
+     for(int nf=0; nf<fdim; nf++)
+      Result[nf]+=w*dI[nf];
+   };
+  if (Error)
+   memset(Error, 0, fdim*sizeof(double));
+
+  if (dI!=dIBuffer)
+   delete[] dI;
+}
+
+/***************************************************************/
+/* integral over the support of an SWG function (see BFInt)    */
+/***************************************************************/
+template<int FDIM, typename Integrand>
+void BFIntT(SWGVolume *V, int nf, Integrand &F, double *Result,
+            int NumPts, double *Error=0, int MaxEvals=0, double RelTol=0.0,
+            int fdim=FDIM)
+{
+  if (FDIM>0) fdim=FDIM;
+
+  SWGFace *Face = V->Faces[nf];
+  TetIntT<FDIM>(V, Face->iPTet, Face->PIndex, +1.0, F, Result, NumPts,
+                Error, MaxEvals, RelTol, fdim);
+
+  double MBuffer[ 2*(FDIM>0 ? FDIM : TETCUBATURE_MAXFDIM) ];
+  double *MResult = (FDIM>0 || fdim<=TETCUBATURE_MAXFDIM) ? MBuffer : new double[2*fdim];
+  double *MError  = MResult + fdim;
+  TetIntT<FDIM>(V, Face->iMTet, Face->MIndex, -1.0, F, MResult, NumPts,
+                MError, MaxEvals, RelTol, fdim);
+
+  for(int n=0; n<fdim; n++)
+   { Result[n] += MResult[n];
+     if (Error) Error[n] += MError[n];
+   };
+
+  if (MResult!=MBuffer)
+   delete[] MResult;
+}
+
+/***************************************************************/
+/* integral over a pair of tetrahedra (see TetTetInt)          */
+/***************************************************************/
+template<int FDIM, typename Integrand>
+void TetTetIntT(SWGVolume *VA, int ntA, int iQA, double SignA,
+                SWGVolume *VB, int ntB, int iQB, double SignB,
+                Integrand &F, double *Result, int NumPts,
+                double *Error=0, int MaxEvals=0, double RelTol=0.0,
+                int fdim=FDIM)
+{
+  if (FDIM>0) fdim=FDIM;
+
+  if (NumPts==0)
+   { TetTetInt(VA, ntA, iQA, SignA, VB, ntB, iQB, SignB,
+               TTIntegrandAdapter<Integrand>, (void *)&F,
+               fdim, Result, Error, NumPts, MaxEvals, RelTol);
+     return;
+   };
+
+  SWGTet *TA     = VA->Tets[ntA];
+  SWGTet *TB     = VB->Tets[ntB];
+  double PreFacA = SignA*(VA->Faces[TA->FI[iQA]]->Area) / (3.0 * TA->Volume);
+  double PreFacB = SignB*(VB->Faces[TB->FI[iQB]]->Area) / (3.0 * TB->Volume);
+
+  const double *XA, *BA, *WA, *XB, *BB, *WB;
+  double BufferA[7*33], BufferB[7*33];
+  GetTetCubatureData(VA, ntA, iQA, NumPts, &XA, &BA, &WA, BufferA);
+  GetTetCubatureData(VB, ntB, iQB, NumPts, &XB, &BB, &WB, BufferB);
+
+  double dIBuffer[ FDIM>0 ? FDIM : TETCUBATURE_MAXFDIM ];
+  double *dI = (FDIM>0 || fdim<=TETCUBATURE_MAXFDIM) ? dIBuffer : new double[fdim];
+
+  memset(Result, 0, fdim*sizeof(double));
+  for(int npA=0; npA<NumPts; npA++)
+   {
+     double xA[3], bA[3];
+     for(int Mu=0; Mu<3; Mu++)
+      { xA[Mu] = XA[Mu*NumPts + npA];
+        bA[Mu] = SignA*BA[Mu*NumPts + npA];
+      };
+
+     for(int npB=0; npB<NumPts; npB++)
+      {
+        double xB[3], bB[3];
+        for(int Mu=0; Mu<3; Mu++)
+         { xB[Mu] = XB[Mu*NumPts + npB];
+           bB[Mu] = SignB*BB[Mu*NumPts + npB];
+         };
+
+        F(xA, bA, 3.0*PreFacA, xB, bB, 3.0*PreFacB, dI);
+
+        double w=WA[npA]*WB[npB];
+        for(int nf=0; nf<fdim; nf++)
+         Result[nf]+=w*dI[nf];
+      };
+   };
+  if (Error)
+   memset(Error, 0, fdim*sizeof(double));
+
+  if (dI!=dIBuffer)
+   delete[] dI;
+}
+
+/***************************************************************/
+/* integral over the product of the supports of two SWG        */
+/* functions (see BFBFInt)                                     */
+/***************************************************************/
+template<int FDIM, typename Integrand>
+void BFBFIntT(SWGVolume *VA, int nfA, SWGVolume *VB, int nfB,
+              Integrand &F, double *Result, int NumPts,
+              double *Error=0, int MaxEvals=0, double RelTol=0.0,
+              int fdim=FDIM)
+{
+  if (FDIM>0) fdim=FDIM;
+
+  SWGFace *FA = VA->Faces[nfA];
+  SWGFace *FB = VB->Faces[nfB];
+
+  double PBuffer[ 2*(FDIM>0 ? FDIM : TETCUBATURE_MAXFDIM) ];
+  double *PResult = (FDIM>0 || fdim<=TETCUBATURE_MAXFDIM) ? PBuffer : new double[2*fdim];
+  double *PError  = PResult + fdim;
+
+  memset(Result, 0, fdim*sizeof(double));
+  if (Error) memset(Error, 0, fdim*sizeof(double));
+  for(int ASign=0; ASign<2; ASign++)
+   for(int BSign=0; BSign<2; BSign++)
+    { int ntA    = (ASign==0) ? FA->iPTet  : FA->iMTet;
+      int iQA    = (ASign==0) ? FA->PIndex : FA->MIndex;
+      int ntB    = (BSign==0) ? FB->iPTet  : FB->iMTet;
+      int iQB    = (BSign==0) ? FB->PIndex : FB->MIndex;
+      TetTetIntT<FDIM>(VA, ntA, iQA, (ASign==0) ? 1.0 : -1.0,
+                       VB, ntB, iQB, (BSign==0) ? 1.0 : -1.0,
+                       F, PResult, NumPts, PError, MaxEvals, RelTol, fdim);
+      for(int n=0; n<fdim; n++)
+       { Result[n] += PResult[n];
+         if (Error) Error[n] += PError[n];
+       };
+    };
+
+  if (PResult!=PBuffer)
+   delete[] PResult;
+}
+
+} // namespace buff
+
+#endif // #ifndef TETCUBATURE_H
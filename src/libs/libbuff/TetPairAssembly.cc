@@ -0,0 +1,556 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * TetPairAssembly.cc -- assembly of G-matrix blocks by looping over
+ *                    -- pairs of tetrahedra instead of pairs of
+ *                    -- basis functions
+ *
+ * Each tetrahedron lies in the support of up to 4 SWG basis functions,
+ * so the BF-pair loop in AssembleGBlock evaluates the kernel at the
+ * same pair of cubature points up to 16 times. Here we visit each
+ * non-touching tet pair once, compute a handful of kernel-weighted
+ * moments of the cubature points, and obtain the contributions to all
+ * 4x4 (source BF, destination BF) combinations from those moments.
+ *
+ * BF pairs with common vertices need singular integration and are
+ * computed one at a time by GetGMatrixElement as before; they are
+ * enumerated from the per-object BF neighbor lists.
+ *
+ * In frequency-sweep mode (BeginFrequencySweep) the frequency-
+ * independent data computed here -- per-tet cubature data, the tet
+ * coloring, and the table of cubature-point separations for each
+ * tet pair -- are retained across calls, so that subsequent
+ * frequencies only re-evaluate the kernel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include <libhrutil.h>
+
+#include "libbuff.h"
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#ifdef USE_OPENMP
+#  include <omp.h>
+#endif
+
+using namespace scuff;
+
+namespace buff {
+
+// number of cubature points per tetrahedron; this must agree with
+// the NumPts value used by GetGME_BFBFInt for non-touching BF pairs
+#define TPA_NUMPTS 4
+
+/***************************************************************/
+/* per-tetrahedron data: cubature points and weights, and the  */
+/* source vertex, prefactor, and face index of each of the 4   */
+/* SWG functions supported on the tet. all coordinates are     */
+/* relative to the tet centroid to limit cancellation in the   */
+/* moment formulas below.                                      */
+/***************************************************************/
+typedef struct TPATet
+ { double Centroid[3];
+   double X[TPA_NUMPTS][3];
+   double W[TPA_NUMPTS];
+   double Q[4][3];
+   double PreFac[4];   /* = +- Area / (3*Volume); zero for exterior faces */
+   int nf[4];          /* face index, or -1 for exterior faces */
+ } TPATet;
+
+static void InitTPATet(SWGVolume *O, int nt, TPATet *TD)
+{
+  SWGTet *T = O->Tets[nt];
+  double *C = T->Centroid;
+  memcpy(TD->Centroid, C, 3*sizeof(double));
+
+  double *Q  = O->Vertices + 3*(T->VI[0]);
+  double *V1 = O->Vertices + 3*(T->VI[1]);
+  double *V2 = O->Vertices + 3*(T->VI[2]);
+  double *V3 = O->Vertices + 3*(T->VI[3]);
+  double L1[3], L2[3], L3[3];
+  VecSub(V1, Q, L1);
+  VecSub(V2, Q, L2);
+  VecSub(V3, Q, L3);
+
+  double *TetCR = GetTetCR(TPA_NUMPTS);
+  for(int np=0; np<TPA_NUMPTS; np++)
+   { double u1=TetCR[4*np+0], u2=TetCR[4*np+1], u3=TetCR[4*np+2];
+     for(int Mu=0; Mu<3; Mu++)
+      TD->X[np][Mu] = Q[Mu] + u1*L1[Mu] + u2*L2[Mu] + u3*L3[Mu] - C[Mu];
+     TD->W[np] = (6.0*T->Volume)*TetCR[4*np+3];
+   };
+
+  for(int i=0; i<4; i++)
+   {
+     VecSub(O->Vertices + 3*(T->VI[i]), C, TD->Q[i]);
+     int nf=T->FI[i];
+     if (nf >= O->NumInteriorFaces)
+      { TD->nf[i]=-1;
+        TD->PreFac[i]=0.0;
+        continue;
+      };
+     SWGFace *F = O->Faces[nf];
+     double Sign = (F->iPTet==nt) ? 1.0 : -1.0;
+     TD->nf[i] = nf;
+     TD->PreFac[i] = Sign*F->Area / (3.0*T->Volume);
+   };
+}
+
+/***************************************************************/
+/* greedy coloring of the tetrahedra in an object such that no */
+/* two tets of the same color share a basis function; the tets */
+/* of a single color may then be processed concurrently        */
+/* without two threads touching the same matrix row.           */
+/* returns the number of colors (at most 5).                   */
+/***************************************************************/
+static int ColorTets(SWGVolume *O, int *Color)
+{
+  int NumColors=0;
+  for(int nt=0; nt<O->NumTets; nt++)
+   Color[nt]=-1;
+
+  for(int nt=0; nt<O->NumTets; nt++)
+   {
+     SWGTet *T=O->Tets[nt];
+     bool Used[5]={false, false, false, false, false};
+     for(int i=0; i<4; i++)
+      { int nf=T->FI[i];
+        if (nf >= O->NumInteriorFaces) continue;
+        SWGFace *F=O->Faces[nf];
+        int ntMate = (F->iPTet==nt) ? F->iMTet : F->iPTet;
+        if (Color[ntMate]>=0) Used[Color[ntMate]]=true;
+      };
+     int c=0;
+     while(Used[c]) c++;
+     Color[nt]=c;
+     if (c>=NumColors) NumColors=c+1;
+   };
+
+  return NumColors;
+}
+
+/***************************************************************/
+/* separations between the cubature points of two tets.        */
+/***************************************************************/
+#define TPA_NPP (TPA_NUMPTS*TPA_NUMPTS)
+static void GetTetPairDistances(TPATet *TA, TPATet *TB, double r[TPA_NPP])
+{
+  double DC[3];
+  VecSub(TA->Centroid, TB->Centroid, DC);
+
+  int N=0;
+  for(int npA=0; npA<TPA_NUMPTS; npA++)
+   for(int npB=0; npB<TPA_NUMPTS; npB++, N++)
+    { double *XA=TA->X[npA], *XB=TB->X[npB];
+      double R0 = DC[0] + XA[0] - XB[0];
+      double R1 = DC[1] + XA[1] - XB[1];
+      double R2 = DC[2] + XA[2] - XB[2];
+      r[N] = sqrt( R0*R0 + R1*R1 + R2*R2 );
+    };
+}
+
+/***************************************************************/
+/* compute the contributions of a single non-touching tet pair */
+/* to the G-matrix entries of all BF pairs supported on it.    */
+/*                                                             */
+/* with b_i(x) = P_i (x-Q_i) and Div b_i = 3P_i we have        */
+/*                                                             */
+/*  G_ij = P_i P_j \sum w w' Phi(x,x')                         */
+/*          * [ (x-Q_i)\cdot(x'-Q_j) - 9/k^2 ]                  */
+/*                                                             */
+/* which we evaluate from the moments                          */
+/*  S0=\sum w w' Phi, SA=\sum w w' Phi x, SB=\sum w w' Phi x', */
+/*  SAB=\sum w w' Phi x\cdot x'.                               */
+/***************************************************************/
+static void GetTetPairContributions(TPATet *TA, TPATet *TB, cdouble k,
+                                    double r[TPA_NPP], cdouble GIJ[4][4])
+{
+  double RePhi[TPA_NPP], ImPhi[TPA_NPP];
+  GetPhiBatch(TPA_NPP, k, KERNEL_HELMHOLTZ, r, RePhi, ImPhi);
+
+  cdouble S0=0.0, SA[3]={0.0,0.0,0.0}, SB[3]={0.0,0.0,0.0}, SAB=0.0;
+  int N=0;
+  for(int npA=0; npA<TPA_NUMPTS; npA++)
+   for(int npB=0; npB<TPA_NUMPTS; npB++, N++)
+    {
+      double *XA=TA->X[npA], *XB=TB->X[npB];
+      cdouble Phi = TA->W[npA]*TB->W[npB]*cdouble(RePhi[N], ImPhi[N]);
+      S0  += Phi;
+      SA[0] += Phi*XA[0]; SA[1] += Phi*XA[1]; SA[2] += Phi*XA[2];
+      SB[0] += Phi*XB[0]; SB[1] += Phi*XB[1]; SB[2] += Phi*XB[2];
+      SAB += Phi*(XA[0]*XB[0] + XA[1]*XB[1] + XA[2]*XB[2]);
+    };
+
+  cdouble NineOverK2 = 9.0/(k*k);
+  for(int i=0; i<4; i++)
+   {
+     if (TA->nf[i]==-1) continue;
+     double *QA=TA->Q[i];
+     cdouble QASB = QA[0]*SB[0] + QA[1]*SB[1] + QA[2]*SB[2];
+     for(int j=0; j<4; j++)
+      {
+        if (TB->nf[j]==-1) continue;
+        double *QB=TB->Q[j];
+        cdouble QBSA = QB[0]*SA[0] + QB[1]*SA[1] + QB[2]*SA[2];
+        double QAQB  = QA[0]*QB[0] + QA[1]*QB[1] + QA[2]*QB[2];
+        GIJ[i][j] = TA->PreFac[i]*TB->PreFac[j]
+                     *( SAB - QBSA - QASB + QAQB*S0 - NineOverK2*S0 );
+      };
+   };
+}
+
+/***************************************************************/
+/* frequency-independent data for the tet-pair assembly of one */
+/* G-matrix block. in frequency-sweep mode these are retained  */
+/* across calls to AssembleGBlock, together with the tables of */
+/* cubature-point separations for as many rows of tet pairs as */
+/* the memory budget allows.                                   */
+/***************************************************************/
+struct TPABlock
+ { int NTA, NTB;
+   TPATet *TDA, *TDB;
+   int NumColors;
+   std::vector<int> *ColorTetList;
+   double Signature[24];    /* vertices of first tet in each object      */
+   int NumTableRows;        /* RTable[ntA] is allocated for ntA<NumTableRows */
+   double **RTable;         /* RTable[ntA][ntB*TPA_NPP + n]; r<0 = touching */
+   bool *RTableValid;       /* true once row ntA of RTable has been filled   */
+   size_t Bytes;
+ };
+
+/***************************************************************/
+/* the positions of the vertices of the first tet of each      */
+/* object; since objects move rigidly, these determine whether */
+/* the relative placement of two objects has changed.          */
+/***************************************************************/
+void GetPlacementSignature(SWGVolume *OA, SWGVolume *OB,
+                           double Signature[24])
+{
+  for(int i=0; i<4; i++)
+   { memcpy(Signature + 3*i,     OA->Vertices + 3*(OA->Tets[0]->VI[i]), 3*sizeof(double));
+     memcpy(Signature + 3*(4+i), OB->Vertices + 3*(OB->Tets[0]->VI[i]), 3*sizeof(double));
+   };
+}
+
+/***************************************************************/
+/* MaxTableBytes is the amount of memory that may be used for  */
+/* tables of point separations (0 for none).                   */
+/***************************************************************/
+static TPABlock *CreateTPABlock(SWGVolume *OA, SWGVolume *OB,
+                                bool SameObject, size_t MaxTableBytes)
+{
+  TPABlock *B = new TPABlock;
+  int NTA = B->NTA = OA->NumTets;
+  int NTB = B->NTB = OB->NumTets;
+
+  /***************************************************************/
+  /* per-tet data and a tet coloring for object A                */
+  /***************************************************************/
+  B->TDA = new TPATet[NTA];
+  for(int nt=0; nt<NTA; nt++)
+   InitTPATet(OA, nt, B->TDA + nt);
+
+  B->TDB = B->TDA;
+  if (!SameObject)
+   { B->TDB = new TPATet[NTB];
+     for(int nt=0; nt<NTB; nt++)
+      InitTPATet(OB, nt, B->TDB + nt);
+   };
+
+  int *Color = new int[NTA];
+  B->NumColors = ColorTets(OA, Color);
+  B->ColorTetList = new std::vector<int>[B->NumColors];
+  for(int nt=0; nt<NTA; nt++)
+   B->ColorTetList[Color[nt]].push_back(nt);
+  delete[] Color;
+
+  B->Bytes = (NTA + (SameObject ? 0 : NTB))*sizeof(TPATet) + NTA*sizeof(int);
+
+  GetPlacementSignature(OA, OB, B->Signature);
+
+  /***************************************************************/
+  /* tables of point separations                                 */
+  /***************************************************************/
+  size_t RowBytes = NTB*TPA_NPP*sizeof(double);
+  size_t MaxRows  = MaxTableBytes / RowBytes;
+  B->NumTableRows = (MaxRows < (size_t)NTA) ? (int)MaxRows : NTA;
+  B->RTable=0;
+  B->RTableValid=0;
+  if (B->NumTableRows>0)
+   { B->RTable = new double *[NTA];
+     B->RTableValid = new bool[NTA];
+     for(int nt=0; nt<NTA; nt++)
+      { B->RTable[nt] = (nt<B->NumTableRows) ? new double[NTB*TPA_NPP] : 0;
+        B->RTableValid[nt] = false;
+      };
+     B->Bytes += B->NumTableRows * RowBytes;
+   };
+
+  return B;
+}
+
+static void DestroyTPABlock(TPABlock *B)
+{
+  if (!B) return;
+  if (B->RTable)
+   { for(int nt=0; nt<B->NTA; nt++)
+      if (B->RTable[nt]) delete[] B->RTable[nt];
+     delete[] B->RTable;
+     delete[] B->RTableValid;
+   };
+  delete[] B->ColorTetList;
+  if (B->TDB!=B->TDA) delete[] B->TDB;
+  delete[] B->TDA;
+  delete B;
+}
+
+/***************************************************************/
+/* frequency-sweep mode: retain the frequency-independent data */
+/* for tet-pair assembly of each G-matrix block until          */
+/* EndFrequencySweep() is called. SweepMemoryBudget (in MB)    */
+/* bounds the memory used for tables of point separations.     */
+/***************************************************************/
+void SWGGeometry::BeginFrequencySweep()
+{
+  if (SweepBlocks) 
+   return;
+  SweepBlocks=(TPABlock **)mallocEC(NumObjects*NumObjects*sizeof(TPABlock *));
+  SweepBytes=0;
+  Log("Beginning frequency sweep (memory budget %g MB).",SweepMemoryBudget);
+}
+
+void SWGGeometry::EndFrequencySweep()
+{
+  if (SweepBlocks)
+   { for(int nb=0; nb<NumObjects*NumObjects; nb++)
+      DestroyTPABlock(SweepBlocks[nb]);
+     free(SweepBlocks);
+     SweepBlocks=0;
+   };
+
+  // the low-frequency series are retained on the same terms
+  if (GSeriesBlocks)
+   { for(int nb=0; nb<NumObjects*NumObjects; nb++)
+      if (GSeriesBlocks[nb]) delete GSeriesBlocks[nb];
+     free(GSeriesBlocks);
+     GSeriesBlocks=0;
+   };
+
+  SweepBytes=0;
+}
+
+/***************************************************************/
+/* get the tet-pair data for block (noa,nob), either from the  */
+/* frequency-sweep store or by creating it from scratch.       */
+/***************************************************************/
+TPABlock *SWGGeometry::GetTPABlock(int noa, int nob)
+{
+  SWGVolume *OA = Objects[noa];
+  SWGVolume *OB = Objects[nob];
+  bool SameObject = (noa==nob);
+
+  if (SweepBlocks==0)
+   return CreateTPABlock(OA, OB, SameObject, 0);
+
+  // self blocks are unaffected by rigid motions of the object and
+  // are shared with duplicate objects; blocks for distinct objects
+  // are discarded if the objects have moved relative to each other
+  int nb;
+  if (SameObject)
+   { int noCache = (Mate[noa]==-1) ? noa : Mate[noa];
+     nb = noCache*NumObjects + noCache;
+   }
+  else
+   nb = noa*NumObjects + nob;
+
+  TPABlock *B=SweepBlocks[nb];
+  if (B && !SameObject)
+   { double Signature[24];
+     GetPlacementSignature(OA, OB, Signature);
+     if ( memcmp(Signature, B->Signature, 24*sizeof(double)) )
+      { SweepBytes -= B->Bytes;
+        DestroyTPABlock(B);
+        B=SweepBlocks[nb]=0;
+      };
+   };
+
+  if (B==0)
+   { size_t Budget = (size_t)(SweepMemoryBudget*1048576.0);
+     size_t Available = (Budget > SweepBytes) ? Budget-SweepBytes : 0;
+     B = SweepBlocks[nb] = CreateTPABlock(OA, OB, SameObject, Available);
+     SweepBytes += B->Bytes;
+     Log("AGB caching %i/%i rows of tet-pair data for (%i,%i) (%.1f MB total)",
+          B->NumTableRows, B->NTA, noa, nob, SweepBytes/1048576.0);
+   };
+
+  return B;
+}
+
+/***************************************************************/
+/* assemble the G-matrix block for objects (noa,nob) by        */
+/* looping over tetrahedron pairs.                             */
+/***************************************************************/
+void SWGGeometry::AssembleGBlockByTetPairs(int noa, int nob, cdouble Omega,
+                                           HMatrix *G,
+                                           int RowOffset, int ColOffset,
+                                           FIBBICache *GCache)
+{
+  SWGVolume *OA = Objects[noa];
+  SWGVolume *OB = Objects[nob];
+  int NFA = OA->NumInteriorFaces;
+  int NFB = OB->NumInteriorFaces;
+  int SameObject = (noa==nob) ? 1 : 0;
+
+  TPABlock *B = GetTPABlock(noa, nob);
+  int NTB = B->NTB;
+  Log("AGB tet-pair assembly (%ix%i tets, %i colors)",B->NTA,NTB,B->NumColors);
+
+  /***************************************************************/
+  /* zero out the block, then accumulate contributions of all    */
+  /* non-touching tet pairs                                      */
+  /***************************************************************/
+  for(int nfb=0; nfb<NFB; nfb++)
+   for(int nfa=0; nfa<NFA; nfa++)
+    G->SetEntry(RowOffset+nfa, ColOffset+nfb, 0.0);
+
+  // in symmetric (packed) storage (r,c) and (c,r) are the same
+  // slot, so only the upper triangle is accumulated; the coloring
+  // then also guarantees that each slot has a single writer
+  bool Packed = (G->StorageType==LHM_SYMMETRIC);
+
+#ifdef USE_OPENMP
+  int NumThreads=GetNumThreads();
+#endif
+  for(int nc=0; nc<B->NumColors; nc++)
+   {
+     int NumColorTets = B->ColorTetList[nc].size();
+     int *TetList     = &(B->ColorTetList[nc][0]);
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic,1),		\
+                         num_threads(NumThreads)
+#endif
+     for(int n=0; n<NumColorTets; n++)
+      {
+        int ntA = TetList[n];
+        TPATet *TA = B->TDA + ntA;
+        double *RRow = B->RTable ? B->RTable[ntA] : 0;
+        bool HaveRow = (RRow && B->RTableValid[ntA]);
+        double rBuffer[TPA_NPP];
+        for(int ntB=0; ntB<NTB; ntB++)
+         {
+           TPATet *TB = B->TDB + ntB;
+           double *r = RRow ? RRow + ntB*TPA_NPP : rBuffer;
+           if (!HaveRow)
+            { if ( SameObject && CompareTets(OA, ntA, OB, ntB)>0 )
+               r[0]=-1.0;
+              else
+               GetTetPairDistances(TA, TB, r);
+            };
+           if (r[0]<0.0)
+            continue;
+
+           cdouble GIJ[4][4];
+           GetTetPairContributions(TA, TB, Omega, r, GIJ);
+
+           for(int i=0; i<4; i++)
+            for(int j=0; j<4; j++)
+             { if ( TA->nf[i]==-1 || TB->nf[j]==-1 )
+                continue;
+               int Row = RowOffset + TA->nf[i], Col = ColOffset + TB->nf[j];
+               if (Packed && Row>Col)
+                continue;
+               G->AddEntry(Row, Col, GIJ[i][j]);
+             };
+         };
+        if (RRow)
+         B->RTableValid[ntA]=true;
+      };
+   };
+
+  /***************************************************************/
+  /* BF pairs with common vertices (which exist only within a    */
+  /* single object) received partial contributions above from    */
+  /* their non-touching tet pairs; overwrite them with the full  */
+  /* matrix elements computed by singular integration.           */
+  /***************************************************************/
+  if (SameObject)
+   {
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic,1),		\
+                         num_threads(NumThreads)
+#endif
+     for(int nfa=0; nfa<NFA; nfa++)
+      {
+        if (LogLevel>=BUFF_VERBOSE_LOGGING)
+         LogPercent(nfa, NFA);
+
+        for(int n=OA->NeighborStart[nfa]; n<OA->NeighborStart[nfa+1]; n++)
+         { int nfb=OA->NeighborList[n];
+           if (nfb<nfa) continue;
+           cdouble GAB=GetGMatrixElement(OA, nfa, OB, nfb, Omega, GCache,
+                                         OA->NeighborNCV[n]);
+           G->SetEntry(RowOffset+nfa, ColOffset+nfb, GAB);
+           if (nfb>nfa)
+            G->SetEntry(RowOffset+nfb, ColOffset+nfa, GAB);
+         };
+      };
+   };
+
+  /***************************************************************/
+  /* if the quadrature policy calls for more than the 4 points   */
+  /* per tet used above for some non-touching pairs, recompute   */
+  /* those pairs. (pairs for which the policy would settle for   */
+  /* the dipole approximation keep the 4-point values.)          */
+  /***************************************************************/
+  if (QuadraturePolicy.Tolerance>0.0)
+   {
+#ifdef USE_OPENMP
+#pragma omp parallel for schedule(dynamic,1),		\
+                         num_threads(NumThreads)
+#endif
+     for(int nfa=0; nfa<NFA; nfa++)
+      for(int nfb=(SameObject ? nfa : 0); nfb<NFB; nfb++)
+       { SWGFace *FA = OA->Faces[nfa], *FB = OB->Faces[nfb];
+         double Radius = fmax(FA->Radius, FB->Radius);
+         double rRel = VecDistance(FA->Centroid, FB->Centroid) / Radius;
+         if ( QuadraturePolicy.GetNumPts(rRel, abs(Omega)*Radius, 0) <= 4 )
+          continue;
+         if ( SameObject && OA->GetNumCommonVertices(nfa, nfb)>0 )
+          continue;
+         cdouble GAB=GetGMatrixElement(OA, nfa, OB, nfb, Omega, GCache, 0);
+         G->SetEntry(RowOffset+nfa, ColOffset+nfb, GAB);
+         if (SameObject && nfb>nfa)
+          G->SetEntry(RowOffset+nfb, ColOffset+nfa, GAB);
+       };
+   };
+
+  if (SweepBlocks==0)
+   DestroyTPABlock(B);
+
+}
+
+} // namespace buff
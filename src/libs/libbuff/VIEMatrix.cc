@@ -31,6 +31,7 @@
 #include "libSGJC.h"
 #include "libscuff.h"
 #include "libbuff.h"
+#include "TetCubature.h"
 
 #ifdef HAVE_CONFIG_H
 #  include "config.h"
@@ -103,10 +104,9 @@ double GetAverageTemperature(SWGVolume *O, SVTensor *TemperatureSVT)
 
 
 /***************************************************************/
-/* user data structure and integrand function for              */
-/* GetOverlaps                                                 */
+/* integrand functor for GetOverlaps (see TetCubature.h)       */
 /***************************************************************/
-typedef struct GOData
+struct GetOverlapIntegrand
  { 
    double *QA;
    double PreFacA;
@@ -117,67 +117,56 @@ typedef struct GOData
    SVTensor *TemperatureSVT;
    double ThetaEnvironment;
    double DeltaThetaHat;
- } GOData;
 
-void GetOverlapIntegrand(double *x, double *b, double DivB,
-                         void *UserData, double *I)
-{
-  (void) DivB;
-  (void) b;
- 
-  GOData *Data             = (GOData *)UserData;
-  double *QA               = Data->QA;
-  double PreFacA           = Data->PreFacA;
-  double *QB               = Data->QB;
-  double PreFacB           = Data->PreFacB;
-  double Omega             = real(Data->Omega);
-  SVTensor *EpsSVT         = Data->EpsSVT;
-  SVTensor *TemperatureSVT = Data->TemperatureSVT;
-  double ThetaEnvironment  = Data->ThetaEnvironment;
-  double DeltaThetaHat     = Data->DeltaThetaHat;
-
-  cdouble EpsM1[3][3], InvEpsM1[3][3];
-  EpsSVT->Evaluate( Omega, x, EpsM1 );
-  EpsM1[0][0] -= 1.0;
-  EpsM1[1][1] -= 1.0;
-  EpsM1[2][2] -= 1.0;
-  Invert3x3Matrix(EpsM1, InvEpsM1);
-
-  double FA[3], FB[3];
-  FA[0] = PreFacA * (x[0] - QA[0]);
-  FA[1] = PreFacA * (x[1] - QA[1]);
-  FA[2] = PreFacA * (x[2] - QA[2]);
-  FB[0] = PreFacB * (x[0] - QB[0]);
-  FB[1] = PreFacB * (x[1] - QB[1]);
-  FB[2] = PreFacB * (x[2] - QB[2]);
-
-  double RelDeltaTheta=1.0;
-  if (TemperatureSVT)
-   { 
-     double T = TemperatureSVT->EvaluateD(0,x);
-     RelDeltaTheta = GetThetaFactor( Omega, T ) - ThetaEnvironment;
-     if (DeltaThetaHat!=0.0) RelDeltaTheta/=DeltaThetaHat;
-   };
+   void operator()(double *x, double *b, double DivB, double *I)
+    {
+      (void) DivB;
+      (void) b;
+
+      double OmegaR = real(this->Omega);
+
+      cdouble EpsM1[3][3], InvEpsM1[3][3];
+      EpsSVT->Evaluate( OmegaR, x, EpsM1 );
+      EpsM1[0][0] -= 1.0;
+      EpsM1[1][1] -= 1.0;
+      EpsM1[2][2] -= 1.0;
+      Invert3x3Matrix(EpsM1, InvEpsM1);
+
+      double FA[3], FB[3];
+      FA[0] = PreFacA * (x[0] - QA[0]);
+      FA[1] = PreFacA * (x[1] - QA[1]);
+      FA[2] = PreFacA * (x[2] - QA[2]);
+      FB[0] = PreFacB * (x[0] - QB[0]);
+      FB[1] = PreFacB * (x[1] - QB[1]);
+      FB[2] = PreFacB * (x[2] - QB[2]);
+
+      double RelDeltaTheta=1.0;
+      if (TemperatureSVT)
+       { 
+         double T = TemperatureSVT->EvaluateD(0,x);
+         RelDeltaTheta = GetThetaFactor( OmegaR, T ) - ThetaEnvironment;
+         if (DeltaThetaHat!=0.0) RelDeltaTheta/=DeltaThetaHat;
+       };
 
-  cdouble V=0.0, VInv=0.0;
-  double Rytov=0.0;
-  for(int Mu=0; Mu<3; Mu++)
-   for(int Nu=0; Nu<3; Nu++)
-    { V     += FA[Mu]*EpsM1[Mu][Nu]*FB[Nu];
-      VInv  += FA[Mu]*InvEpsM1[Mu][Nu]*FB[Nu];
-      Rytov += FA[Mu]*imag(EpsM1[Mu][Nu])*FB[Nu];
-    };
-  V     *= -1.0*Omega*Omega;
-  VInv  *= -1.0/(Omega*Omega);
-  Rytov *= 4.0*Omega*RelDeltaTheta/(M_PI*ZVAC);
- 
-  I[0] = real(V);
-  I[1] = imag(V);
-  I[2] = real(VInv);
-  I[3] = imag(VInv);
-  I[4] = Rytov; 
-  
-}
+      cdouble V=0.0, VInv=0.0;
+      double Rytov=0.0;
+      for(int Mu=0; Mu<3; Mu++)
+       for(int Nu=0; Nu<3; Nu++)
+        { V     += FA[Mu]*EpsM1[Mu][Nu]*FB[Nu];
+          VInv  += FA[Mu]*InvEpsM1[Mu][Nu]*FB[Nu];
+          Rytov += FA[Mu]*imag(EpsM1[Mu][Nu])*FB[Nu];
+        };
+      V     *= -1.0*OmegaR*OmegaR;
+      VInv  *= -1.0/(OmegaR*OmegaR);
+      Rytov *= 4.0*OmegaR*RelDeltaTheta/(M_PI*ZVAC);
+     
+      I[0] = real(V);
+      I[1] = imag(V);
+      I[2] = real(VInv);
+      I[3] = imag(VInv);
+      I[4] = Rytov; 
+    }
+ };
 
 /***************************************************************/
 /* For a given SWG basis function f_a, this routine computes   */
@@ -215,7 +204,7 @@ int GetOverlaps(SWGVolume *O, int nfA, cdouble Omega,
   double ThetaEnvironment = GetThetaFactor( real(Omega), TEnvironment);
 
   SWGFace *FA = O->Faces[nfA];
-  struct GOData MyGOData, *Data=&MyGOData;
+  GetOverlapIntegrand MyIntegrand, *Data=&MyIntegrand;
   Data->Omega            = Omega;
   Data->EpsSVT           = O->SVT;
   Data->TemperatureSVT   = TemperatureSVT;
@@ -249,8 +238,7 @@ int GetOverlaps(SWGVolume *O, int nfA, cdouble Omega,
      int Order=33;
      double RelTol=1.0e-4;
      double I[NFUN], E[NFUN];
-     TetInt(O, nt, 0, 1.0, GetOverlapIntegrand, (void *)Data,
-            NFUN, I, E, Order, 0, RelTol);
+     TetIntT<NFUN>(O, nt, 0, 1.0, *Data, I, Order, E, 0, RelTol);
 
      if (nfB==nfA)
       { VEntries[0]     += cdouble(I[0], I[1]);
@@ -292,8 +280,7 @@ int GetOverlaps(SWGVolume *O, int nfA, cdouble Omega,
      int Order=33;
      double RelTol=1.0e-4;
      double I[NFUN], E[NFUN];
-     TetInt(O, nt, 0, 1.0, GetOverlapIntegrand, (void *)Data,
-            NFUN, I, E, Order, 0, RelTol);
+     TetIntT<NFUN>(O, nt, 0, 1.0, *Data, I, Order, E, 0, RelTol);
 
      if (nfB==nfA)
       { 
@@ -352,13 +339,87 @@ void SWGGeometry::AssembleOverlapBlocks(int no, cdouble Omega,
            VInv->SetEntry(nr, nc, VInvEntries[nnz]);
           if (Rytov)
            Rytov->SetEntry(nr, nc, RytovEntries[nnz]);
-          if (TInv)
+          // in symmetric storage (nr,nc) and (nc,nr) are one slot
+          if (TInv && !(TInv->StorageType==LHM_SYMMETRIC && nc<nr) )
            TInv->AddEntry(Offset+nr, Offset+nc, VInvEntries[nnz]);
         };
     };
 
 }
 
+/***************************************************************/
+/* the shared FIBBI cache lives in ${BUFF_CACHE_PATH} if that  */
+/* is set, and otherwise in the current working directory      */
+/***************************************************************/
+static const char *GetSharedGCacheFileName()
+{
+  static char FileName[MAXSTR];
+  char *s=getenv("BUFF_CACHE_PATH");
+  if (s)
+   snprintf(FileName,MAXSTR,"%s/SharedFIBBI.cache",s);
+  else
+   snprintf(FileName,MAXSTR,"SharedFIBBI.cache");
+  return FileName;
+}
+
+/***************************************************************/
+/* get the FIBBI cache used for the G-matrix block (noa,nob),  */
+/* creating it if necessary. only self blocks are cached;      */
+/* duplicate objects share the cache of their mate.            */
+/***************************************************************/
+FIBBICache *SWGGeometry::GetGCache(int noa, int nob)
+{
+  if (noa!=nob)
+   return 0;
+
+  int noMate=Mate[noa];
+  int noCache = (noMate==-1) ? noa : noMate;
+  if (ObjectGCaches[noCache]==0)
+   { ObjectGCaches[noCache]=new FIBBICache(Objects[noa]->MeshFileName);
+     if (UseSharedGCache)
+      { if (SharedGCache==0)
+         { SharedGCache=new FIBBICache();
+           SharedGCache->PreLoad(GetSharedGCacheFileName());
+         };
+        ObjectGCaches[noCache]->SetBackingCache(SharedGCache);
+      };
+   };
+  return ObjectGCaches[noCache];
+}
+
+/***************************************************************/
+/* write the FIBBI cache for object no (and the shared cache,  */
+/* if any) to disk, then trim all caches to fit the memory     */
+/* budget, in proportion to their current sizes.               */
+/***************************************************************/
+void SWGGeometry::StoreGCache(int no)
+{
+  FIBBICache *GCache = GetGCache(no, no);
+  GCache->Store(Objects[no]->MeshFileName);
+  if (SharedGCache)
+   SharedGCache->StoreAs(GetSharedGCacheFileName());
+
+  if (GCacheMemoryBudget<=0.0)
+   return;
+
+  size_t Budget = (size_t)(GCacheMemoryBudget*1048576.0);
+  size_t Total  = SharedGCache ? SharedGCache->MemoryUsage() : 0;
+  for(int nc=0; nc<NumObjects; nc++)
+   if (ObjectGCaches[nc])
+    Total+=ObjectGCaches[nc]->MemoryUsage();
+  if (Total<=Budget)
+   return;
+
+  Log("FIBBI caches use %i MB (budget %g MB): trimming",
+       (int)(Total>>20), GCacheMemoryBudget);
+  double Fraction = ((double)Budget) / ((double)Total);
+  for(int nc=0; nc<NumObjects; nc++)
+   if (ObjectGCaches[nc])
+    ObjectGCaches[nc]->Trim( (size_t)(Fraction*ObjectGCaches[nc]->MemoryUsage()) );
+  if (SharedGCache)
+   SharedGCache->Trim( (size_t)(Fraction*SharedGCache->MemoryUsage()) );
+}
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
@@ -377,50 +438,99 @@ void SWGGeometry::AssembleGBlock(int noa, int nob, cdouble Omega,
   Log("AGB Assembling G(%i,%i)",noa,nob);
 
   /***************************************************************/
+  /* in hierarchical-matrix mode we assemble the block in        */
+  /* compressed form, which requires only a fraction of the      */
+  /* matrix-element evaluations, and then unpack it              */
+  /***************************************************************/
+  if (UseHMatrix)
+   { ACAMatrix *H = new ACAMatrix(this, noa, nob);
+     H->Assemble(Omega);
+     H->Unpack(G, RowOffset, ColOffset);
+     delete H;
+     return;
+   };
+
   /***************************************************************/
+  /* blocks for distinct, well-separated objects may be computed */
+  /* from the multipole moments of the BFs                       */
   /***************************************************************/
-  FIBBICache *GCache   = 0;
-  if (noa==nob)
-   {
-     int noMate=Mate[noa];
-     int noCache = (noMate==-1) ? noa : noMate;
-     if (ObjectGCaches[noCache]==0)
-      ObjectGCaches[noCache]=new FIBBICache(OA->MeshFileName);
-     GCache = ObjectGCaches[noCache];
-     Log("AGB initial cache size %i ",GCache->Size());
+  if (UseMultipoleBlocks && noa!=nob)
+   { AssembleGBlockByMultipoles(noa, nob, Omega, G, RowOffset, ColOffset);
+     return;
    };
 
   /***************************************************************/
+  /* at low frequencies we evaluate the block from its series    */
+  /* in powers of ik if the truncation error is small enough     */
   /***************************************************************/
+  GTaylorSeries *S = UseGSeries ? GetGSeries(noa, nob) : 0;
+  if (S)
+   { double ErrorEstimate;
+     if ( S->Evaluate(Omega, G, RowOffset, ColOffset, &ErrorEstimate) )
+      return;
+     Log("AGB series error estimate %.1e at Omega=%s exceeds tolerance: direct assembly",
+          ErrorEstimate, z2s(Omega));
+   };
+
+  /***************************************************************/
+  /***************************************************************/
+  /***************************************************************/
+  FIBBICache *GCache = GetGCache(noa, nob);
+  if (GCache)
+   Log("AGB initial cache size %i ",GCache->Size());
+
   /***************************************************************/
+  /***************************************************************/
+  /***************************************************************/
+  if (TetPairAssembly)
+   AssembleGBlockByTetPairs(noa, nob, Omega, G, RowOffset, ColOffset, GCache);
+  else
+   { 
 #ifndef USE_OPENMP
-  Log("AGB no multithreading...");
+     Log("AGB no multithreading...");
 #else
-  int NumThreads=GetNumThreads();
-  Log("AGB OpenMP multithreading (%i threads...)",NumThreads);
+     int NumThreads=GetNumThreads();
+     Log("AGB OpenMP multithreading (%i threads...)",NumThreads);
 #pragma omp parallel for schedule(dynamic,1),		\
                          num_threads(NumThreads)
 #endif
-  for(int nfa=0; nfa<NFA; nfa++)
-   for(int nfb=SameObject*nfa; nfb<NFB; nfb++)
-    { 
-      if (LogLevel>=BUFF_VERBOSE_LOGGING && nfb==SameObject*nfa)
-       LogPercent(nfa, NFA);
-
-      int Row=RowOffset + nfa;
-      int Col=ColOffset + nfb;
-      cdouble GAB=GetGMatrixElement(OA, nfa, OB, nfb, Omega, GCache);
-      G->SetEntry(Row, Col, GAB);
-      if (SameObject && nfb>nfa)
-       G->SetEntry(Col, Row, GAB);
-    };
+     for(int nfa=0; nfa<NFA; nfa++)
+      {
+        // walk the (sorted) neighbor list of nfa alongside nfb to
+        // get common-vertex counts without comparing every pair;
+        // BFs on distinct objects never touch
+        int nn=0, nnMax=0;
+        if (SameObject)
+         { nn    = OA->NeighborStart[nfa];
+           nnMax = OA->NeighborStart[nfa+1];
+           while( nn<nnMax && OA->NeighborList[nn]<nfa ) nn++;
+         };
+
+        for(int nfb=SameObject*nfa; nfb<NFB; nfb++)
+         {
+           if (LogLevel>=BUFF_VERBOSE_LOGGING && nfb==SameObject*nfa)
+            LogPercent(nfa, NFA);
+
+           int ncv=0;
+           if ( nn<nnMax && OA->NeighborList[nn]==nfb )
+            ncv=OA->NeighborNCV[nn++];
+
+           int Row=RowOffset + nfa;
+           int Col=ColOffset + nfb;
+           cdouble GAB=GetGMatrixElement(OA, nfa, OB, nfb, Omega, GCache, ncv);
+           G->SetEntry(Row, Col, GAB);
+           if (SameObject && nfb>nfa)
+            G->SetEntry(Col, Row, GAB);
+         };
+      };
+   };
 
   /***************************************************************/
   /***************************************************************/
   /***************************************************************/
   if (GCache)
    { Log("AGB final cache size %i ",GCache->Size());
-     GCache->Store(OA->MeshFileName);
+     StoreGCache(noa);
    };
 
 }
@@ -436,7 +546,7 @@ HMatrix *SWGGeometry::AssembleVIEMatrix(cdouble Omega, HMatrix *M)
      M=0;
    };
   if (!M)
-   M = new HMatrix(TotalBFs, TotalBFs, LHM_COMPLEX);
+   M = AllocateVIEMatrix();
 
   for(int noa=0; noa<NumObjects; noa++)
    for(int nob=noa; nob<NumObjects; nob++)
@@ -451,23 +561,56 @@ HMatrix *SWGGeometry::AssembleVIEMatrix(cdouble Omega, HMatrix *M)
        };
     };
 
-  for(int nr=1; nr<TotalBFs; nr++)
-   for(int nc=0; nc<nr; nc++)
-    M->SetEntry(nr, nc, M->GetEntry(nc,nr));
+  // the blocks above fill only the upper triangle; in symmetric
+  // storage that is the whole matrix
+  if (M->StorageType!=LHM_SYMMETRIC)
+   for(int nr=1; nr<TotalBFs; nr++)
+    for(int nc=0; nc<nr; nc++)
+     M->SetEntry(nr, nc, M->GetEntry(nc,nr));
 
   return M;
 
 }
 
+/***************************************************************/
+/* assemble the VIE matrix in hierarchical (ACA-compressed)    */
+/* form; the VInv overlap entries are added to the dense       */
+/* near-field blocks.                                          */
+/***************************************************************/
+ACAMatrix *SWGGeometry::AssembleVIEMatrix(cdouble Omega, ACAMatrix *H)
+{
+  if (!H)
+   H = new ACAMatrix(this);
+
+  H->Assemble(Omega, true);
+
+  return H;
+}
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
 HMatrix *SWGGeometry::AllocateVIEMatrix(bool PureImagFreq)
 {
+  int StorageType = VIEMatrixIsSymmetric() ? LHM_SYMMETRIC : LHM_NORMAL;
   if (PureImagFreq)
-   return new HMatrix(TotalBFs, TotalBFs, LHM_REAL);
+   return new HMatrix(TotalBFs, TotalBFs, LHM_REAL, StorageType);
   else
-   return new HMatrix(TotalBFs, TotalBFs, LHM_COMPLEX);
+   return new HMatrix(TotalBFs, TotalBFs, LHM_COMPLEX, StorageType);
+}
+
+/***************************************************************/
+/* the VIE matrix G + VInv is complex symmetric: G by          */
+/* reciprocity, and VInv because SVTensor symmetrizes the      */
+/* permittivity tensor of every object (SVTensor::Evaluate).   */
+/* it may then be stored in packed form and factorized by      */
+/* symmetric-indefinite (LDL^T) factorization, halving memory  */
+/* and factorization cost. UseSymmetricStorage=false restores  */
+/* full storage and LU factorization.                          */
+/***************************************************************/
+bool SWGGeometry::VIEMatrixIsSymmetric()
+{
+  return UseSymmetricStorage;
 }
 
 } // namespace buff
@@ -111,6 +111,32 @@ typedef struct SWGFace
 
 } SWGFace;
 
+/***************************************************************/
+/* SWGQuadTable holds, for one fixed-order cubature rule, the  */
+/* cubature points and weights on every tetrahedron of an      */
+/* SWGVolume, together with the values at those points of the  */
+/* four (unsigned) SWG functions b = (A/3V)(x-Q) with source   */
+/* vertex Q = VI[iQ], in structure-of-arrays layout:           */
+/*                                                             */
+/*  X[ (3*nt + Mu)*NumPts + np ]         point coordinates     */
+/*  W[ nt*NumPts + np ]                  weights (incl. 6V)    */
+/*  B[ (3*(4*nt+iQ) + Mu)*NumPts + np ]  SWG function values   */
+/***************************************************************/
+typedef struct SWGQuadTable
+ { 
+   int NumPts;
+   double *X, *W, *B;
+
+   const double *GetX(int nt)         { return X + 3*nt*NumPts; }
+   const double *GetW(int nt)         { return W + nt*NumPts; }
+   const double *GetB(int nt, int iQ) { return B + 3*(4*nt+iQ)*NumPts; }
+
+ } SWGQuadTable;
+
+class ACAMatrix;
+struct TPABlock;
+class GTaylorSeries;
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
@@ -146,6 +172,19 @@ class SWGVolume
    void Transform(const char *format,...);
    void UnTransform();
 
+   /*-------------------------------------------------------------------*/
+   /*- number of common vertices of two BFs (0 if not touching) --------*/
+   /*-------------------------------------------------------------------*/
+   int GetNumCommonVertices(int nfA, int nfB);
+
+   /*-------------------------------------------------------------------*/
+   /*- precomputed cubature tables (see QuadTables.cc); GetQuadTable   -*/
+   /*- returns 0 unless UseQuadTables is true                          -*/
+   /*-------------------------------------------------------------------*/
+   SWGQuadTable *GetQuadTable(int NumPts);
+   void ClearQuadTables();
+   static bool UseQuadTables;
+
 //  private:
 
    /*--------------------------------------------------------------*/
@@ -162,6 +201,12 @@ class SWGVolume
    SWGFace **Faces;                /* array of pointers to interior faces */
    SWGFace **ExteriorFaces;        /* array of pointers to exterior faces */
 
+   int *VertexBFStart;             /* BFs incident on vertex nv are VertexBFList[VertexBFStart[nv]...VertexBFStart[nv+1]-1] */
+   int *VertexBFList;
+   int *NeighborStart;             /* BFs touching BF nf are NeighborList[NeighborStart[nf]...NeighborStart[nf+1]-1] */
+   int *NeighborList;              /*  (ascending order, including nf itself) */
+   char *NeighborNCV;              /* NeighborNCV[n] = number of common vertices for NeighborList[n] */
+
    char *MeshFileName;             /* saved name of mesh file */
    char *Label;                    /* unique label identifying the volume*/
 
@@ -180,6 +225,10 @@ class SWGVolume
    GTransformation *OTGT;
    double Origin[3];
 
+   /* cubature tables for the 4-, 16-, and 33-point rules, built  */
+   /* on first use and discarded when the object is transformed   */
+   SWGQuadTable *QuadTables[3];
+
    // the following fields are used to pass some data items up to the
    // higher-level routine that calls the SWGVolume constructor
    char *ErrMsg;  /* used to indicate error to calling routine */
@@ -189,11 +238,31 @@ class SWGVolume
    /*--------------------------------------------------------------*/ 
    /* constructor subroutines */
    void InitFaceList();
+   void InitBFNeighborLists();
    void ReadGMSHFile(FILE *MeshFile);
    void InitSWGFace(SWGFace *F);
 
  }; // class SWGVolume
 
+/***************************************************************/
+/* GMEQuadraturePolicy chooses the cubature rule for the       */
+/* G-matrix element between two BFs from their relative        */
+/* distance rRel (center-center distance over the larger BF    */
+/* radius R), from kR, and from the number of common vertices. */
+/* GetNumPts returns 0 (dipole approximation) or the number of */
+/* cubature points per tetrahedron (4, 16, or 33).             */
+/***************************************************************/
+class GMEQuadraturePolicy
+ {
+  public:
+   GMEQuadraturePolicy(double Tolerance=0.0);
+   void SetTolerance(double Tolerance);
+   int GetNumPts(double rRel, double kR, int ncv);
+   double GetErrorEstimate(int NumPts, double rRel, double kR, int ncv);
+
+   double Tolerance; // target relative accuracy; 0 = fixed rules
+ };
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
@@ -228,7 +297,9 @@ class SWGGeometry
 
    // scattering API
    HMatrix *AllocateVIEMatrix(bool PureImagFreq=false);
+   bool VIEMatrixIsSymmetric();
    HMatrix *AssembleVIEMatrix(cdouble Omega, HMatrix *M);
+   ACAMatrix *AssembleVIEMatrix(cdouble Omega, ACAMatrix *H);
    HVector *AllocateRHSVector();
    HVector *AssembleRHSVector(cdouble Omega, IncField *IF, HVector *RHS);
    void GetFields(IncField *IF, HVector *J, cdouble Omega, double *X, cdouble *EH);
@@ -246,6 +317,23 @@ class SWGGeometry
                               int Offset=0);
    void AssembleGBlock(int noa, int nob, cdouble Omega, HMatrix *G,
                        int RowOffset=0, int ColOffset=0);
+   void AssembleGBlockByTetPairs(int noa, int nob, cdouble Omega,
+                                 HMatrix *G, int RowOffset, int ColOffset,
+                                 FIBBICache *GCache);
+   void AssembleGBlockByMultipoles(int noa, int nob, cdouble Omega,
+                                   HMatrix *G, int RowOffset, int ColOffset);
+   TPABlock *GetTPABlock(int noa, int nob);
+   GTaylorSeries *GetGSeries(int noa, int nob);
+   FIBBICache *GetGCache(int noa, int nob);
+   void StoreGCache(int no);
+
+   // frequency-sweep mode: between these calls, frequency-independent
+   // data for tet-pair assembly of G blocks are retained across
+   // frequencies, with tables of point separations limited to
+   // SweepMemoryBudget megabytes in total. EndFrequencySweep() also
+   // frees the low-frequency series (see UseGSeries below)
+   void BeginFrequencySweep();
+   void EndFrequencySweep();
 
    // miscellaneous routines
    SWGVolume *GetObjectByLabel(const char *Label, int *pno=0);
@@ -253,8 +341,74 @@ class SWGGeometry
    // directories within which to search for mesh files
    static double TaylorDuffyTolerance;
    static int MaxTaylorDuffyEvals;
+
+   // 0 for adaptive Taylor-Duffy cubature; N>0 for a fixed
+   // N-point Gauss-Legendre rule in each dimension; -1 to choose
+   // the fixed rule from TaylorDuffyTolerance
+   static int TaylorDuffyOrder;
+
+   // maximum number of tet-pair shapes in the table of static
+   // Taylor-Duffy integrals (see StaticTTITable.cc); 0 disables it
+   static unsigned long StaticTTITableSize;
+   static GMEQuadraturePolicy QuadraturePolicy;
+
+   // if UseSymmetricStorage is true, VIE matrices (and diagonal
+   // G blocks) are allocated in packed symmetric storage and
+   // factorized by symmetric-indefinite (LDL^T) factorization
+   static bool UseSymmetricStorage;
    int LogLevel;
 
+   // parameters for hierarchical-matrix (ACA) compression of G blocks;
+   // if UseHMatrix is true, AssembleGBlock assembles each block in
+   // compressed form and then unpacks it into the dense block
+   static double ACATolerance;
+   static int ACALeafSize;
+   static double ACAEta;
+   bool UseHMatrix;
+
+   // if TetPairAssembly is true, AssembleGBlock computes the
+   // contributions of non-touching BF pairs by looping over pairs
+   // of tetrahedra rather than pairs of basis functions (off by
+   // default; BUFF_TETPAIR_ASSEMBLY=1 turns it on)
+   bool TetPairAssembly;
+
+   static double SweepMemoryBudget;
+
+   // if UseGSeries is true, AssembleGBlock evaluates each block
+   // from its low-frequency series in powers of ik (truncated after
+   // the (ik)^GSeriesOrder term) whenever the estimated relative
+   // truncation error is below GSeriesTolerance. the series for
+   // each block is kept until EndFrequencySweep() and holds
+   // GSeriesOrder+3 real NRxNC matrices; it counts towards
+   // SweepMemoryBudget, and blocks whose series would exceed the
+   // budget are assembled directly
+   static int GSeriesOrder;
+   static double GSeriesTolerance;
+   bool UseGSeries;
+
+   // if UseMultipoleBlocks is true, G blocks for pairs of distinct
+   // objects are computed from the dipole and quadrupole moments of
+   // the BFs, except for BF pairs whose estimated relative error
+   // exceeds MultipoleTolerance
+   static double MultipoleTolerance;
+   bool UseMultipoleBlocks;
+
+   // G-matrix elements for touching BF pairs are evaluated as a
+   // polynomial in ik from the cached FIBBI data, without cubature
+   // of the desingularized kernel, if the estimated truncation
+   // error of the polynomial is below TouchingSeriesTolerance
+   // (0 = always use cubature)
+   static double TouchingSeriesTolerance;
+
+   // the FIBBI caches of all objects (and the shared cache) are
+   // trimmed to GCacheMemoryBudget megabytes in total (0=unlimited)
+   // each time a cache is stored. if UseSharedGCache is true, the
+   // caches of all objects are backed by a shared cache stored in
+   // ${BUFF_CACHE_PATH}/SharedFIBBI.cache, so that BF pairs recurring in
+   // different meshes are computed only once
+   static double GCacheMemoryBudget;
+   static bool UseSharedGCache;
+
 //  private:
    /*--------------------------------------------------------------*/
    /*- private data fields  ---------------------------------------*/
@@ -268,9 +422,187 @@ class SWGGeometry
    char *GeoFileName;
 
    FIBBICache **ObjectGCaches;
+   FIBBICache *SharedGCache;
+
+   TPABlock **SweepBlocks;
+   size_t SweepBytes;
+
+   GTaylorSeries **GSeriesBlocks;
 
  }; // class SWGGeometry
 
+/***************************************************************/
+/* GTaylorSeries is the low-frequency representation of the    */
+/* G-matrix block coupling objects noa and nob as a series in  */
+/* powers of ik:                                               */
+/*                                                             */
+/*  G(k) = \sum_{m=-2}^{MaxOrder} (ik)^m C_m                   */
+/*                                                             */
+/* with real, frequency-independent coefficient matrices C_m.  */
+/***************************************************************/
+#define GSERIES_MAXORDER 20
+class GTaylorSeries
+ {
+  public:
+   GTaylorSeries(SWGGeometry *G, int noa, int nob, int MaxOrder);
+   ~GTaylorSeries();
+
+   double GetErrorEstimate(cdouble Omega);
+   bool Evaluate(cdouble Omega, HMatrix *GBlock,
+                 int RowOffset=0, int ColOffset=0,
+                 double *pErrorEstimate=0);
+
+//  private:
+   SWGGeometry *G;
+   int noa, nob, NR, NC;
+   int MaxOrder, NumTerms;
+   HMatrix **C;          // C[m+2] = coefficient of (ik)^m
+   size_t Bytes;         // memory used by the C matrices
+   double MaxSeparation; // upper bound on point separations
+   double Signature[24];
+ };
+
+/***************************************************************/
+/* ACAMatrix is a hierarchical (H-matrix) representation of    */
+/* the G-matrix block coupling objects noa and nob, or of the  */
+/* full VIE matrix if noa=nob=-1.                              */
+/*                                                             */
+/* Basis functions are organized into a binary tree of         */
+/* geometric clusters. Pairs of well-separated clusters are    */
+/* stored as low-rank factors computed by adaptive cross       */
+/* approximation (ACA); only near-field pairs are stored as    */
+/* dense blocks. For square blocks (noa==nob) only the upper   */
+/* triangle of the cluster-pair partition is stored and the    */
+/* symmetry of G is used to apply the lower triangle.          */
+/***************************************************************/
+typedef struct BFCluster
+ { int Start, Num;              /* slots Start..Start+Num-1 in Perm array */
+   double BoxMin[3], BoxMax[3]; /* bounding box of BF supports */
+   int Child[2];                /* child clusters (-1 for leaves) */
+ } BFCluster;
+
+typedef struct ACABlock
+ { int RC, CC;                  /* row and column cluster indices */
+   int Rank;                    /* -1 for dense (near-field) blocks */
+   cdouble *D;                  /* dense block, column-major, NRxNC */
+   cdouble *U, *V;              /* low-rank factors: block = U*V^T */
+ } ACABlock;
+
+class ACAMatrix
+ {
+  public:
+   ACAMatrix(SWGGeometry *G, int noa=-1, int nob=-1);
+   ~ACAMatrix();
+
+   // assemble the G block (plus the VInv overlap blocks if AddVInv)
+   void Assemble(cdouble Omega, bool AddVInv=false);
+
+   // Y = M*X
+   void Apply(HVector *X, HVector *Y);
+
+   // write uncompressed entries into a dense matrix
+   void Unpack(HMatrix *M, int RowOffset=0, int ColOffset=0);
+
+   // block-Jacobi preconditioner from the diagonal (leaf-leaf)
+   // blocks, and a preconditioned GMRES solve; the solution
+   // overwrites X. if VInvBlocks is non-null, the sparse overlap
+   // entries are added to the preconditioner blocks; if NearField
+   // is false, the G entries are omitted from them.
+   void Factorize(SMatrix **VInvBlocks=0, bool NearField=true);
+   void ApplyPreconditioner(HVector *X, HVector *Y);
+   int Solve(HVector *X, double RelTol=1.0e-6, int MaxIters=1000);
+
+//  private:
+   SWGGeometry *G;
+   int NR, NC;
+   bool Symmetric;
+   int *RowNO, *RowNF, *ColNO, *ColNF;
+
+   BFCluster *RowClusters, *ColClusters;
+   int NumRowClusters, NumColClusters;
+   int *RowPerm, *ColPerm;
+
+   ACABlock *Blocks;
+   int NumBlocks, MaxBlocks;
+
+   int NumPCBlocks, *PCClusters;
+   HMatrix **PCBlocks;
+   HVector **PCWork;
+
+   // internal methods
+   void BuildClusterTrees();
+   void AddBlocks(int RC, int CC);
+   void FreeBlocks();
+   cdouble GetEntry(int nr, int nc, cdouble Omega, FIBBICache **Caches);
+   void AssembleBlock(ACABlock *B, cdouble Omega, FIBBICache **Caches);
+   void AddOverlapBlocks(cdouble Omega);
+ };
+
+/***************************************************************/
+/* iterative solution of linear systems. a LinearOperator      */
+/* computes Y = Op*X for the user's operator (or, for the      */
+/* preconditioner, Y = Inverse(P)*X.)                          */
+/***************************************************************/
+typedef void (*LinearOperator)(HVector *X, HVector *Y, void *UserData);
+
+int GMRES(LinearOperator A, void *AData,
+          LinearOperator PInv, void *PData,
+          HVector *B, HVector *X,
+          double RelTol=1.0e-6, int MaxIters=1000, int Restart=50,
+          double *pResidual=0);
+
+int BiCGStab(LinearOperator A, void *AData,
+             LinearOperator PInv, void *PData,
+             HVector *B, HVector *X,
+             double RelTol=1.0e-6, int MaxIters=1000,
+             double *pResidual=0);
+
+/***************************************************************/
+/* VIEOperator applies the VIE matrix G + VInv without forming */
+/* it densely: the G part is stored in hierarchical (ACA) form */
+/* and the VInv part as the sparse per-object overlap blocks   */
+/* assembled by AssembleOverlapBlocks. Solve() runs a          */
+/* preconditioned Krylov solver on the system.                 */
+/***************************************************************/
+#define BUFF_SOLVER_LU       0
+#define BUFF_SOLVER_GMRES    1
+#define BUFF_SOLVER_BICGSTAB 2
+
+#define BUFF_PRECOND_NONE      0
+#define BUFF_PRECOND_OVERLAP   1  // block-Jacobi on the VInv blocks
+#define BUFF_PRECOND_NEARFIELD 2  // block-Jacobi on near-field G + VInv
+
+class VIEOperator
+ {
+  public:
+   VIEOperator(SWGGeometry *G,
+               int Solver=BUFF_SOLVER_GMRES,
+               int Preconditioner=BUFF_PRECOND_OVERLAP);
+   ~VIEOperator();
+
+   // assemble G and VInv blocks and set up the preconditioner
+   void Assemble(cdouble Omega);
+
+   // Y = (G + VInv)*X and Y = Inverse(P)*X
+   void Apply(HVector *X, HVector *Y);
+   void ApplyPreconditioner(HVector *X, HVector *Y);
+
+   // solve the VIE system; on entry J is the RHS vector and on
+   // return it is the solution. returns the number of iterations.
+   int Solve(HVector *J);
+
+   int Solver, Preconditioner;
+   double RelTol;
+   int MaxIters, Restart;
+
+//  private:
+   SWGGeometry *G;
+   ACAMatrix *GMatrix;
+   SMatrix **VInvBlocks;
+   HVector **XBlocks, **YBlocks;
+   bool VInvAssembled;
+ };
+
 /***************************************************************/
 /* non-class utility methods ***********************************/
 /***************************************************************/
@@ -282,6 +614,15 @@ int CompareBFs(SWGVolume *OA, int nfA, SWGVolume *OB, int nfB,
 int CompareTets(SWGVolume *OA, int ntA, SWGVolume *OB, int ntB,
                 int *OVIA=0, int *OVIB=0);
 
+// table of static Taylor-Duffy integrals for tet pairs with 3 or 4
+// common vertices, keyed on the shape of the pair (StaticTTITable.cc)
+bool GetStaticTTI(SWGVolume *OA, int OVIA[4], int iQA,
+                  SWGVolume *OB, int OVIB[4], int iQB,
+                  int ncv, double *TTI);
+void AddStaticTTI(SWGVolume *OA, int OVIA[4], int iQA,
+                  SWGVolume *OB, int OVIB[4], int iQB,
+                  int ncv, double *TTI);
+
 int GetOverlapElements(SWGVolume *O, int nfA,
                        int Indices[MAXOVERLAP],
                        double Entries[MAXOVERLAP]);
@@ -296,7 +637,43 @@ PFTOptions *BUFF_InitPFTOptions(PFTOptions *Options);
 /***************************************************************/
 cdouble GetGMatrixElement(SWGVolume *VA, int nfA,
                           SWGVolume *VB, int nfB,
-                          cdouble Omega, FIBBICache *Cache=0);
+                          cdouble Omega, FIBBICache *Cache=0,
+                          int ncv=-1);
+
+/***************************************************************/
+/* coefficients of the expansion of G_{ab} in powers of ik     */
+/* (see GTaylorSeries.cc)                                      */
+/***************************************************************/
+void GetGSeriesCoefficients(SWGVolume *OA, int nfA,
+                            SWGVolume *OB, int nfB,
+                            int NMax, FIBBICache *GCache,
+                            double *D, double *S);
+void AddGSeriesCubature(SWGVolume *OA, int nfA,
+                        SWGVolume *OB, int nfB,
+                        int nMin, int NMax, int NumPts,
+                        double *D, double *S);
+
+void GetPlacementSignature(SWGVolume *OA, SWGVolume *OB,
+                           double Signature[24]);
+
+/***************************************************************/
+/* batched evaluation of the G-matrix kernel over packets of   */
+/* cubature-point pairs stored in structure-of-arrays layout   */
+/***************************************************************/
+#define KERNEL_HELMHOLTZ      0
+#define KERNEL_DESINGULARIZED 1
+#define KERNEL_STATIC         2
+
+// maximum number of point pairs processed in a single packet
+#define GME_PACKETSIZE 256
+
+void GetPhiBatch(int N, cdouble k, int WhichKernel, const double *r,
+                 double *RePhi, double *ImPhi);
+
+void GMEBatchIntegrate(int N, cdouble k, int WhichKernel,
+                       const double *r, const double *W,
+                       const double *DotProduct, double ScalarProduct,
+                       double *Result);
 
 /***************************************************************/
 /***************************************************************/
@@ -384,6 +761,10 @@ void FaceFaceInt(SWGVolume *VA, int ntA, int nfA, int nfBFA, double SignA,
 
 double *GetTetCR(int NumPts);
 
+void GetTetCubatureData(SWGVolume *O, int nt, int iQ, int NumPts,
+                        const double **X, const double **B,
+                        const double **W, double *Buffer);
+
 } // namespace buff 
 
 /***************************************************************/
@@ -0,0 +1,153 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * buff-test-ACASolve.cc -- buff-em unit test comparing iterative
+ *                       -- solutions of the VIE system with the
+ *                       -- hierarchical (ACA) matrix against the
+ *                       -- dense LU solution
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdarg.h>
+#include <fenv.h>
+
+#include "libbuff.h"
+
+using namespace scuff;
+using namespace buff;
+
+/***************************************************************/
+/* relative residual |M*J - RHS| / |RHS| of a solution J of    */
+/* the dense system                                            */
+/***************************************************************/
+double GetRelativeResidual(HMatrix *M, HVector *J, HVector *RHS)
+{
+  double RNorm2=0.0, BNorm2=0.0;
+  for(int nr=0; nr<M->NR; nr++)
+   { cdouble MJ=0.0;
+     for(int nc=0; nc<M->NC; nc++)
+      MJ += M->GetEntry(nr,nc) * J->GetEntry(nc);
+     RNorm2 += norm(MJ - RHS->GetEntry(nr));
+     BNorm2 += norm(RHS->GetEntry(nr));
+   };
+  return sqrt(RNorm2/BNorm2);
+}
+
+/***************************************************************/
+/* relative difference |J1-J2| / |J2|                          */
+/***************************************************************/
+double GetRelativeDifference(HVector *J1, HVector *J2)
+{
+  double DNorm2=0.0, Norm2=0.0;
+  for(int n=0; n<J2->N; n++)
+   { DNorm2 += norm(J1->GetEntry(n) - J2->GetEntry(n));
+     Norm2  += norm(J2->GetEntry(n));
+   };
+  return sqrt(DNorm2/Norm2);
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+  /***************************************************************/
+  /***************************************************************/
+  /***************************************************************/
+  SetLogFileName("buff-test-ACASolve.log");
+  Log("buff-test-ACASolve running on %s",GetHostName());
+
+  int NumTests=0, NumFailed=0;
+
+  /***************************************************************/
+  /* the iterative solves are converged well below the ACA       */
+  /* tolerance, so that the compression dominates their error    */
+  /***************************************************************/
+  double ACATolerance = 1.0e-5;
+  double SolverTolerance = 1.0e-8;
+  SWGGeometry *G = new SWGGeometry("E10Sphere_533.buffgeo");
+  SWGGeometry::ACATolerance = ACATolerance;
+  cdouble Omega  = 1.0;
+
+  cdouble E0[3]  = {1.0, 0.0, 0.0};
+  double nHat[3] = {0.0, 0.0, 1.0};
+  PlaneWave *PW  = new PlaneWave(E0, nHat);
+
+  HVector *RHS = G->AllocateRHSVector();
+  G->AssembleRHSVector(Omega, PW, RHS);
+
+  /***************************************************************/
+  /* dense reference solution; the unfactorized matrix is kept   */
+  /* for computing residuals                                     */
+  /***************************************************************/
+  HMatrix *M   = G->AllocateVIEMatrix();
+  HMatrix *MLU = G->AllocateVIEMatrix();
+  G->AssembleVIEMatrix(Omega, M);
+  MLU->Copy(M);
+  MLU->LUFactorize();
+  HVector *JLU = G->AllocateRHSVector();
+  JLU->Copy(RHS);
+  MLU->LUSolve(JLU);
+  Log("LU: relative residual %e",GetRelativeResidual(M, JLU, RHS));
+
+  /***************************************************************/
+  /* hierarchical-matrix solutions with each iterative solver.   */
+  /* the residual is computed with the dense matrix, so it       */
+  /* includes the compression error; the solution difference     */
+  /* is allowed a further factor for the conditioning of the     */
+  /* system.                                                     */
+  /***************************************************************/
+  HVector *J = G->AllocateRHSVector();
+  const char *SolverNames[2] = {"GMRES", "BiCGStab"};
+  int Solvers[2]             = {BUFF_SOLVER_GMRES, BUFF_SOLVER_BICGSTAB};
+  for(int ns=0; ns<2; ns++)
+   {
+     Log("Solving with ACA + %s...",SolverNames[ns]);
+     VIEOperator *Op = new VIEOperator(G, Solvers[ns], BUFF_PRECOND_OVERLAP);
+     Op->RelTol = SolverTolerance;
+     Op->Assemble(Omega);
+     J->Copy(RHS);
+     int NumIters=Op->Solve(J);
+
+     double Residual = GetRelativeResidual(M, J, RHS);
+     double RelDiff  = GetRelativeDifference(J, JLU);
+     Log(" %s: %i iterations, relative residual %e, difference from LU %e",
+           SolverNames[ns],NumIters,Residual,RelDiff);
+
+     NumTests++;
+     if ( NumIters>=Op->MaxIters || Residual > 10.0*ACATolerance )
+      { Log(" %s: residual %e exceeds tolerance %e",
+             SolverNames[ns],Residual,10.0*ACATolerance);
+        NumFailed++;
+      };
+
+     NumTests++;
+     if ( RelDiff > 100.0*ACATolerance )
+      { Log(" %s: solution differs from LU by %e (tolerance %e)",
+             SolverNames[ns],RelDiff,100.0*ACATolerance);
+        NumFailed++;
+      };
+
+     delete Op;
+   };
+
+  Log("%i/%i tests passed.",NumTests-NumFailed,NumTests);
+  return NumFailed;
+}
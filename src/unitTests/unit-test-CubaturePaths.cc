@@ -0,0 +1,315 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * buff-test-CubaturePaths.cc -- buff-em regression test comparing the
+ *                            -- templated, table-driven, and batched
+ *                            -- cubature paths against straightforward
+ *                            -- point-by-point evaluation
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdarg.h>
+#include <fenv.h>
+
+#include "libbuff.h"
+#include "TetCubature.h"
+#include "TTaylorDuffy.h"
+
+using namespace scuff;
+using namespace buff;
+
+// all paths evaluate the same points in nearly the same order
+#define CP_TOLERANCE 1.0e-12
+
+#define TFDIM  3
+#define TTFDIM 2
+
+/***************************************************************/
+/* smooth test integrands for single-tet and tet-pair          */
+/* integrals, as function pointers and as functors             */
+/***************************************************************/
+void TestTIntegrand(double *x, double *b, double Divb, void *UserData,
+                    double *I)
+{
+  (void) UserData;
+  I[0] = b[0]*sin(x[0]) + b[1]*cos(x[1]) + b[2]*x[0]*x[2];
+  I[1] = Divb*exp(-(x[0]*x[0] + x[1]*x[1] + x[2]*x[2]));
+  I[2] = b[0]*x[1] - b[1]*x[0];
+}
+
+void TestTTIntegrand(double *xA, double *bA, double DivbA,
+                     double *xB, double *bB, double DivbB,
+                     void *UserData, double *I)
+{
+  (void) UserData;
+  double r = VecDistance(xA, xB);
+  I[0] = VecDot(bA, bB)*cos(r);
+  I[1] = DivbA*DivbB*exp(-r*r);
+}
+
+struct TestTFunctor
+ { void operator()(double *x, double *b, double Divb, double *I)
+    { TestTIntegrand(x, b, Divb, 0, I); }
+ };
+
+struct TestTTFunctor
+ { void operator()(double *xA, double *bA, double DivbA,
+                   double *xB, double *bB, double DivbB, double *I)
+    { TestTTIntegrand(xA, bA, DivbA, xB, bB, DivbB, 0, I); }
+ };
+
+/***************************************************************/
+/* cubature points x, SWG function values b, weights w, and    */
+/* Divb for one tet, computed directly from the reference rule */
+/* as the cubature routines did before the per-volume tables   */
+/***************************************************************/
+double GetDirectPoints(SWGVolume *O, int nt, int iQ, double Sign, int NumPts,
+                       double x[][3], double b[][3], double *w)
+{
+  SWGTet *T     = O->Tets[nt];
+  double *TetCR = GetTetCR(NumPts);
+  double *V[4];
+  for(int i=0; i<4; i++)
+   V[i] = O->Vertices + 3*T->VI[i];
+  double *Q     = O->Vertices + 3*T->VI[iQ];
+  double PreFac = Sign*O->Faces[T->FI[iQ]]->Area / (3.0*T->Volume);
+
+  for(int np=0; np<NumPts; np++)
+   { double *u=TetCR + 4*np;
+     for(int Mu=0; Mu<3; Mu++)
+      { x[np][Mu] = V[0][Mu] + u[0]*(V[1][Mu]-V[0][Mu])
+                             + u[1]*(V[2][Mu]-V[0][Mu])
+                             + u[2]*(V[3][Mu]-V[0][Mu]);
+        b[np][Mu] = PreFac*(x[np][Mu] - Q[Mu]);
+      };
+     w[np] = 6.0*T->Volume*u[3];
+   };
+  return 3.0*PreFac;
+}
+
+/***************************************************************/
+/* direct BF and BF-pair integrals of the test integrands      */
+/***************************************************************/
+void GetDirectBFInt(SWGVolume *O, int nf, int NumPts, double *Result)
+{
+  SWGFace *F = O->Faces[nf];
+  memset(Result, 0, TFDIM*sizeof(double));
+  for(int Sign=0; Sign<2; Sign++)
+   { double x[33][3], b[33][3], w[33], I[TFDIM];
+     double Divb = GetDirectPoints(O, Sign ? F->iMTet : F->iPTet,
+                                   Sign ? F->MIndex : F->PIndex,
+                                   Sign ? -1.0 : 1.0, NumPts, x, b, w);
+     for(int np=0; np<NumPts; np++)
+      { TestTIntegrand(x[np], b[np], Divb, 0, I);
+        for(int n=0; n<TFDIM; n++)
+         Result[n] += w[np]*I[n];
+      };
+   };
+}
+
+void GetDirectBFBFInt(SWGVolume *O, int nfA, int nfB, int NumPts,
+                      double *Result)
+{
+  SWGFace *FA = O->Faces[nfA], *FB = O->Faces[nfB];
+  memset(Result, 0, TTFDIM*sizeof(double));
+  for(int SA=0; SA<2; SA++)
+   for(int SB=0; SB<2; SB++)
+    { double xA[33][3], bA[33][3], wA[33];
+      double xB[33][3], bB[33][3], wB[33], I[TTFDIM];
+      double DivbA = GetDirectPoints(O, SA ? FA->iMTet : FA->iPTet,
+                                     SA ? FA->MIndex : FA->PIndex,
+                                     SA ? -1.0 : 1.0, NumPts, xA, bA, wA);
+      double DivbB = GetDirectPoints(O, SB ? FB->iMTet : FB->iPTet,
+                                     SB ? FB->MIndex : FB->PIndex,
+                                     SB ? -1.0 : 1.0, NumPts, xB, bB, wB);
+      for(int npA=0; npA<NumPts; npA++)
+       for(int npB=0; npB<NumPts; npB++)
+        { TestTTIntegrand(xA[npA], bA[npA], DivbA, xB[npB], bB[npB], DivbB, 0, I);
+          for(int n=0; n<TTFDIM; n++)
+           Result[n] += wA[npA]*wB[npB]*I[n];
+        };
+    };
+}
+
+/***************************************************************/
+/* largest difference between two vectors relative to the      */
+/* largest entry of the second                                 */
+/***************************************************************/
+double GetRelDiff(double *V1, double *V2, int N)
+{
+  double MaxDiff=0.0, MaxEntry=0.0;
+  for(int n=0; n<N; n++)
+   { MaxDiff  = fmax(MaxDiff,  fabs(V1[n]-V2[n]));
+     MaxEntry = fmax(MaxEntry, fabs(V2[n]));
+   };
+  return MaxEntry==0.0 ? MaxDiff : MaxDiff/MaxEntry;
+}
+
+/***************************************************************/
+/* compare BFIntT, BFInt, BFBFIntT, and BFBFInt against the    */
+/* direct integrals for all BFs and all touching BF pairs of O */
+/***************************************************************/
+double CompareBFIntegrals(SWGVolume *O, int NumPts)
+{
+  double MaxRelDiff=0.0;
+  TestTFunctor TF;
+  TestTTFunctor TTF;
+  for(int nfa=0; nfa<O->NumInteriorFaces; nfa++)
+   {
+     double Direct[TFDIM], Template[TFDIM], Wrapper[TFDIM], Error[TFDIM];
+     GetDirectBFInt(O, nfa, NumPts, Direct);
+     BFIntT<TFDIM>(O, nfa, TF, Template, NumPts);
+     BFInt(O, nfa, TestTIntegrand, 0, TFDIM, Wrapper, Error, NumPts, 0, 0.0);
+     MaxRelDiff = fmax(MaxRelDiff, GetRelDiff(Template, Direct, TFDIM));
+     MaxRelDiff = fmax(MaxRelDiff, GetRelDiff(Wrapper,  Direct, TFDIM));
+
+     for(int nn=O->NeighborStart[nfa]; nn<O->NeighborStart[nfa+1]; nn++)
+      { int nfb=O->NeighborList[nn];
+        double DDirect[TTFDIM], DTemplate[TTFDIM], DWrapper[TTFDIM], DError[TTFDIM];
+        GetDirectBFBFInt(O, nfa, nfb, NumPts, DDirect);
+        BFBFIntT<TTFDIM>(O, nfa, O, nfb, TTF, DTemplate, NumPts);
+        BFBFInt(O, nfa, O, nfb, TestTTIntegrand, 0, TTFDIM, DWrapper, DError,
+                NumPts, 0, 0.0);
+        MaxRelDiff = fmax(MaxRelDiff, GetRelDiff(DTemplate, DDirect, TTFDIM));
+        MaxRelDiff = fmax(MaxRelDiff, GetRelDiff(DWrapper,  DDirect, TTFDIM));
+      };
+   };
+  return MaxRelDiff;
+}
+
+/***************************************************************/
+/* compare the batched Taylor-Duffy integrand on full and      */
+/* partial blocks of points with its single-point version, for */
+/* the first pair of tets in O with ncv common vertices        */
+/***************************************************************/
+#define CP_NUMPKS 4
+#define CP_NUMY   19 // two full blocks of 8 points and a partial one
+double CompareTTDIntegrands(SWGVolume *O, int ncv)
+{
+  int OVIA[4], OVIB[4];
+  bool Found=false;
+  for(int ntA=0; ntA<O->NumTets && !Found; ntA++)
+   for(int ntB=ntA; ntB<O->NumTets && !Found; ntB++)
+    if ( CompareTets(O, ntA, O, ntB)==ncv )
+     { CompareTets(O, ntA, O, ntB, OVIA, OVIB);
+       Found=true;
+     };
+  if (!Found)
+   ErrExit("mesh has no tet pairs with %i common vertices",ncv);
+
+  int PIndex[CP_NUMPKS]={TTD_UNITY, TTD_BDOTBP, TTD_UNITY, TTD_BDOTBP};
+  int KIndex[CP_NUMPKS]={TTD_RP, TTD_RP, TTD_HELMHOLTZ, TTD_HELMHOLTZ};
+  cdouble KParam[CP_NUMPKS]={-1.0, -1.0, 1.0, 1.0};
+  cdouble Result[CP_NUMPKS], Error[CP_NUMPKS];
+
+  double *V = O->Vertices;
+  TTDArgStruct MyArgs, *Args=&MyArgs;
+  InitTTDArgs(Args);
+  Args->WhichCase = ncv;
+  Args->NumPKs    = CP_NUMPKS;
+  Args->PIndex    = PIndex;
+  Args->KIndex    = KIndex;
+  Args->KParam    = KParam;
+  Args->V1        = V + 3*OVIA[0];
+  Args->V2 = Args->V2P = V + 3*OVIA[1];
+  Args->V3 = Args->V3P = V + 3*OVIA[2];
+  Args->V4 = Args->V4P = V + 3*OVIA[3];
+  if (ncv<4) Args->V4P = V + 3*OVIB[3];
+  if (ncv<3) Args->V3P = V + 3*OVIB[2];
+  Args->Q         = V + 3*OVIA[3];
+  Args->QP        = V + 3*OVIB[3];
+  Args->Result    = Result;
+  Args->Error     = Error;
+  Args->CubaturePoints = 4;
+
+  void *TTDW = CreateTTDWorkspace(Args);
+  TTaylorDuffy(Args, TTDW);
+
+  // quasi-random points in the unit hypercube
+  int yDim = 6 - ncv, fDim=2*CP_NUMPKS;
+  double Alpha[5]={sqrt(2.0), sqrt(3.0), sqrt(5.0), sqrt(7.0), sqrt(11.0)};
+  double y[CP_NUMY*5], fBatch[CP_NUMY*2*CP_NUMPKS], fSingle[CP_NUMY*2*CP_NUMPKS];
+  for(int n=0; n<CP_NUMY; n++)
+   for(int d=0; d<yDim; d++)
+    { double t=(n+1)*Alpha[d];
+      y[n*yDim + d] = t - floor(t);
+    };
+
+  TTDIntegrand_v(yDim, CP_NUMY, y, TTDW, fDim, fBatch);
+  for(int n=0; n<CP_NUMY; n++)
+   TTDIntegrand(yDim, y + n*yDim, TTDW, fDim, fSingle + n*fDim);
+
+  DestroyTTDWorkspace(TTDW);
+  return GetRelDiff(fBatch, fSingle, CP_NUMY*fDim);
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+  int NumTests=0, NumFailed=0;
+
+  /***************************************************************/
+  /***************************************************************/
+  /***************************************************************/
+  SetLogFileName("buff-test-CubaturePaths.log");
+  Log("buff-test-CubaturePaths running on %s",GetHostName());
+
+  SWGGeometry *G = new SWGGeometry("E10P1ISphere_48.buffgeo");
+  SWGVolume *O = G->Objects[0];
+
+  /***************************************************************/
+  /* templated and wrapped BF and BF-pair cubature, with and     */
+  /* without the per-volume tables, for each fixed rule          */
+  /***************************************************************/
+  int Rules[3]={4, 16, 33};
+  for(int nr=0; nr<3; nr++)
+   for(int UseTables=0; UseTables<2; UseTables++)
+    { SWGVolume::UseQuadTables = (UseTables==1);
+      double RelDiff = CompareBFIntegrals(O, Rules[nr]);
+      Log(" %2i-point rule, tables %s: max relative difference %e",
+           Rules[nr],UseTables ? "on " : "off",RelDiff);
+      NumTests++;
+      if ( !(RelDiff < CP_TOLERANCE) )
+       { Log(" %i-point rule, tables %s: cubature differs from direct evaluation",
+              Rules[nr],UseTables ? "on" : "off");
+         NumFailed++;
+       };
+    };
+  SWGVolume::UseQuadTables=false;
+
+  /***************************************************************/
+  /* batched vs. single-point Taylor-Duffy integrand             */
+  /***************************************************************/
+  const char *CaseNames[5]={0, 0, "common edge", "common triangle", "common tet"};
+  for(int ncv=TTD_COMMONEDGE; ncv<=TTD_COMMONTET; ncv++)
+   { double RelDiff = CompareTTDIntegrands(O, ncv);
+     Log(" TTD integrand, %s: max relative difference %e",CaseNames[ncv],RelDiff);
+     NumTests++;
+     if ( !(RelDiff < CP_TOLERANCE) )
+      { Log(" TTD integrand, %s: batched differs from single-point",CaseNames[ncv]);
+        NumFailed++;
+      };
+   };
+
+  Log("%i/%i tests passed.",NumTests-NumFailed,NumTests);
+  return NumFailed;
+}
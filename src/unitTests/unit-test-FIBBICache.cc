@@ -27,12 +27,90 @@
 #include <math.h>
 #include <stdarg.h>
 #include <fenv.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "libbuff.h"
 
 using namespace scuff;
 using namespace buff;
 
+/***************************************************************/
+/* fetch the FIBBI data for all pairs of touching BFs (nfA,nfB)*/
+/* in O with nfMin <= nfA < nfMax; returns the number of pairs */
+/***************************************************************/
+int GetTouchingPairData(FIBBICache *GCache, SWGVolume *O,
+                        int nfMin, int nfMax)
+{
+  int NumPairs=0;
+  for(int nfa=nfMin; nfa<nfMax; nfa++)
+   for(int nn=O->NeighborStart[nfa]; nn<O->NeighborStart[nfa+1]; nn++)
+    { double Data[FIBBIDATALEN];
+      GCache->GetFIBBIData(O, nfa, O, O->NeighborList[nn], Data);
+      NumPairs++;
+    };
+  return NumPairs;
+}
+
+/***************************************************************/
+/* size of a file in bytes, or -1 if it does not exist         */
+/***************************************************************/
+long GetFileSize(const char *FileName)
+{
+  struct stat FileStats;
+  if ( stat(FileName, &FileStats) )
+   return -1;
+  return (long)FileStats.st_size;
+}
+
+/***************************************************************/
+/* write the mirror image (x -> -x) of a gmsh tetrahedral mesh */
+/* file, swapping two vertices of each tetrahedron to keep its */
+/* orientation positive                                        */
+/***************************************************************/
+void WriteReflectedMesh(const char *InFileName, const char *OutFileName)
+{
+  FILE *InFile=fopen(InFileName,"r");
+  FILE *OutFile=fopen(OutFileName,"w");
+  if (!InFile || !OutFile)
+   ErrExit("could not open mesh files %s, %s",InFileName,OutFileName);
+
+  char Line[MAXSTR];
+  bool InNodes=false, InElements=false;
+  while( fgets(Line,MAXSTR,InFile) )
+   { 
+     if (!strncmp(Line,"$Nodes",6))       InNodes=true;
+     if (!strncmp(Line,"$EndNodes",9))    InNodes=false;
+     if (!strncmp(Line,"$Elements",9))    InElements=true;
+     if (!strncmp(Line,"$EndElements",12)) InElements=false;
+
+     int n, Type, NumTags;
+     double X[3];
+     int nRead;
+     if ( InNodes && 4==sscanf(Line,"%i %le %le %le",&n,X+0,X+1,X+2) )
+      fprintf(OutFile,"%i %.17g %.17g %.17g\n",n,-X[0],X[1],X[2]);
+     else if (    InElements
+               && 3==sscanf(Line,"%i %i %i%n",&n,&Type,&NumTags,&nRead)
+               && Type==4
+             )
+      { int Tags[10], VI[4], Pos;
+        char *p=Line+nRead;
+        for(int nt=0; nt<NumTags && nt<10; nt++, p+=Pos)
+         sscanf(p,"%i%n",Tags+nt,&Pos);
+        for(int nv=0; nv<4; nv++, p+=Pos)
+         sscanf(p,"%i%n",VI+nv,&Pos);
+        fprintf(OutFile,"%i %i %i",n,Type,NumTags);
+        for(int nt=0; nt<NumTags && nt<10; nt++)
+         fprintf(OutFile," %i",Tags[nt]);
+        fprintf(OutFile," %i %i %i %i\n",VI[0],VI[1],VI[3],VI[2]);
+      }
+     else
+      fputs(Line,OutFile);
+   };
+  fclose(InFile);
+  fclose(OutFile);
+}
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
@@ -63,7 +141,7 @@ int main(int argc, char *argv[])
   FIBBICache *GCache=new FIBBICache();
 
   Tic(true);
-  double Data1[6], Data2[6];
+  double Data1[FIBBIDATALEN], Data2[FIBBIDATALEN];
   GCache->GetFIBBIData(O, nfA, O, nfB, Data1);
   unsigned long M1;
   double Time1=Toc(&M1);
@@ -76,7 +154,7 @@ int main(int argc, char *argv[])
   Log("GetData 2 : %.3e us, %8lu b allocated", Time2, M2);
   
   NumTests++;
-  if ( memcmp(Data2, Data1, 6*sizeof(double) ) )
+  if ( memcmp(Data2, Data1, FIBBIDATALEN*sizeof(double) ) )
    { Log(" Data 2 != Data 1");
      NumFailed++;
    };
@@ -96,7 +174,7 @@ int main(int argc, char *argv[])
        GetMemoryUsage() / (1<<20));
 
   Tic(true);
-  double Data3[6];
+  double Data3[FIBBIDATALEN];
   GCache=G->ObjectGCaches[0];
   int Size1=GCache->Size();
   GCache->GetFIBBIData(O, nfA, O, nfB, Data3);
@@ -105,7 +183,7 @@ int main(int argc, char *argv[])
   Log("GetData 3 : %.3e us, %8lu b allocated", Time3, M3);
 
   NumTests++;
-  if ( memcmp(Data3, Data1, 6*sizeof(double) ) )
+  if ( memcmp(Data3, Data1, FIBBIDATALEN*sizeof(double) ) )
    { Log(" Data 3 != Data 1");
      NumFailed++;
    };
@@ -123,17 +201,324 @@ int main(int argc, char *argv[])
    };
 
   Tic(true);
-  double Data4[6];
+  double Data4[FIBBIDATALEN];
   GCache->GetFIBBIData(O, nfA, O, nfB, Data4);
   unsigned long M4;
   double Time4=Toc(&M4);
   Log("GetData 4 : %.3e us, %8lu b allocated", Time4, M4);
   NumTests++;
-  if ( memcmp(Data4, Data1, 6*sizeof(double) ) )
+  if ( memcmp(Data4, Data1, FIBBIDATALEN*sizeof(double) ) )
    { Log(" Data 4 != Data 1");
      NumFailed++;
    };
 
+  delete GCache;
+
+  /***************************************************************/
+  /* records computed after a cache file has been written are    */
+  /* appended to its journal by subsequent Store()s; they are    */
+  /* replayed when the file is preloaded, a partially written    */
+  /* record at the end of the journal is dropped, and a          */
+  /* compacting Store() merges the journal into the file.        */
+  /***************************************************************/
+  Log("Testing cache journal...");
+  int NF=O->NumInteriorFaces;
+  const char *JFileName="Journal.cache";
+  char JournalName[100];
+  snprintf(JournalName,100,"%s.journal",JFileName);
+  unlink(JFileName);
+  unlink(JournalName);
+
+  GCache=new FIBBICache();
+  GetTouchingPairData(GCache, O, 0, NF/2);
+  GCache->StoreAs(JFileName);
+  GetTouchingPairData(GCache, O, NF/2, NF);
+  GCache->StoreAs(JFileName);
+  int JSize=GCache->Size();
+  delete GCache;
+  long JournalSize=GetFileSize(JournalName);
+  NumTests++;
+  if ( JournalSize<=0 )
+   { Log(" no journal written to %s",JournalName);
+     NumFailed++;
+   };
+
+  // reopen without compacting: the journal is replayed
+  GCache=new FIBBICache();
+  GCache->PreLoad(JFileName);
+  int Size3=GCache->Size();
+  GetTouchingPairData(GCache, O, 0, NF);
+  NumTests++;
+  if ( Size3!=JSize || GCache->Misses!=0 )
+   { Log(" journal replay: %i records, %i misses (should have been %i, 0)",
+          Size3,GCache->Misses,JSize);
+     NumFailed++;
+   };
+  delete GCache;
+
+  // cut the last record short, as if the process writing it had
+  // died: only that record is lost, and the journal is trimmed
+  // back to the end of the last complete record
+  if ( truncate(JournalName, JournalSize-5) )
+   ErrExit("could not truncate %s",JournalName);
+  GCache=new FIBBICache();
+  GCache->PreLoad(JFileName);
+  int Size4=GCache->Size();
+  long JournalSize2=GetFileSize(JournalName);
+  GetTouchingPairData(GCache, O, 0, NF);
+  NumTests++;
+  if ( Size4!=JSize-1 || GCache->Misses!=1 )
+   { Log(" truncated journal: %i records, %i misses (should have been %i, 1)",
+          Size4,GCache->Misses,JSize-1);
+     NumFailed++;
+   };
+  NumTests++;
+  if ( JournalSize2<=0 || JournalSize2>=JournalSize-5 )
+   { Log(" truncated journal: size %li after preload (was %li)",JournalSize2,JournalSize-5);
+     NumFailed++;
+   };
+
+  // a compacting store merges the journal into the cache file
+  GCache->StoreAs(JFileName, true);
+  delete GCache;
+  NumTests++;
+  if ( GetFileSize(JournalName)!=-1 )
+   { Log(" journal %s not removed by compacting store",JournalName);
+     NumFailed++;
+   };
+  GCache=new FIBBICache();
+  GCache->PreLoad(JFileName);
+  int Size5=GCache->Size();
+  GetTouchingPairData(GCache, O, 0, NF);
+  NumTests++;
+  if ( Size5!=JSize || GCache->Misses!=0 )
+   { Log(" compacted cache: %i records, %i misses (should have been %i, 0)",
+          Size5,GCache->Misses,JSize);
+     NumFailed++;
+   };
+  delete GCache;
+
+  /***************************************************************/
+  /* cache keys are invariant under rotations and reflections:   */
+  /* BF pairs in rotated and mirror-image copies of the mesh hit */
+  /* the records computed for the original, and the cached data  */
+  /* agree with those computed directly for the copies.          */
+  /***************************************************************/
+  Log("Testing rotated and reflected copies...");
+  SWGVolume *Copies[2];
+  Copies[0]=new SWGVolume(O->MeshFileName);
+  Copies[0]->Transform("ROTATED 37 ABOUT 1 2 3");
+  WriteReflectedMesh(O->MeshFileName, "Reflected.vmsh");
+  Copies[1]=new SWGVolume((char *)"Reflected.vmsh");
+  if (Copies[1]->ErrMsg)
+   ErrExit(Copies[1]->ErrMsg);
+
+  GCache=new FIBBICache();
+  GetTouchingPairData(GCache, O, 0, NF);
+  for(int nc=0; nc<2; nc++)
+   { SWGVolume *OC=Copies[nc];
+     int Misses0=GCache->Misses, NumPairs=0;
+     double MaxRelDiff=0.0;
+     for(int nfa=0; nfa<OC->NumInteriorFaces; nfa++)
+      for(int nn=OC->NeighborStart[nfa]; nn<OC->NeighborStart[nfa+1]; nn++)
+       { int nfb=OC->NeighborList[nn];
+         double Cached[FIBBIDATALEN], Direct[FIBBIDATALEN];
+         GCache->GetFIBBIData(OC, nfa, OC, nfb, Cached);
+         ComputeFIBBIData(OC, nfa, OC, nfb, Direct);
+         double Norm=0.0, Diff=0.0;
+         for(int n=0; n<FIBBIDATALEN; n++)
+          { Norm = fmax(Norm, fabs(Direct[n]));
+            Diff = fmax(Diff, fabs(Cached[n]-Direct[n]));
+          };
+         MaxRelDiff = fmax(MaxRelDiff, Diff/Norm);
+         NumPairs++;
+       };
+     int NewMisses=GCache->Misses - Misses0;
+     Log(" %s copy: %i pairs, %i misses, max rel diff %e",
+           nc==0 ? "rotated" : "reflected",NumPairs,NewMisses,MaxRelDiff);
+     NumTests++;
+     if ( NumPairs==0 || NewMisses!=0 || MaxRelDiff>1.0e-5 )
+      { Log(" %s copy: cache lookups failed",nc==0 ? "rotated" : "reflected");
+        NumFailed++;
+      };
+   };
+  delete GCache;
+  delete Copies[0];
+  delete Copies[1];
+
+  /***************************************************************/
+  /* merging the cache files for two overlapping sets of BF      */
+  /* pairs yields their union, with each record present once     */
+  /***************************************************************/
+  Log("Testing cache merge...");
+  unlink("MergeA.cache");
+  unlink("MergeB.cache");
+  GCache=new FIBBICache();
+  GetTouchingPairData(GCache, O, 0, (2*NF)/3);
+  GCache->StoreAs("MergeA.cache", true);
+  int SizeA=GCache->Size();
+  delete GCache;
+  GCache=new FIBBICache();
+  GetTouchingPairData(GCache, O, NF/3, NF);
+  GCache->StoreAs("MergeB.cache", true);
+  delete GCache;
+  GCache=new FIBBICache();
+  GetTouchingPairData(GCache, O, 0, NF);
+  int UnionSize=GCache->Size();
+  delete GCache;
+
+  GCache=new FIBBICache();
+  int NumAddedA=GCache->Merge("MergeA.cache");
+  int NumAddedB=GCache->Merge("MergeB.cache");
+  int NumAddedA2=GCache->Merge("MergeA.cache");
+  int MergedSize=GCache->Size();
+  GetTouchingPairData(GCache, O, 0, NF);
+  NumTests++;
+  if (    NumAddedA!=SizeA || NumAddedA+NumAddedB!=UnionSize
+       || NumAddedA2!=0 || MergedSize!=UnionSize || GCache->Misses!=0
+     )
+   { Log(" merge: %i+%i+%i records added, size %i, %i misses (should have been %i+%i+0, %i, 0)",
+          NumAddedA,NumAddedB,NumAddedA2,MergedSize,GCache->Misses,
+          SizeA,UnionSize-SizeA,UnionSize);
+     NumFailed++;
+   };
+  delete GCache;
+
+  /***************************************************************/
+  /* a cache with compact (fingerprint) keys can preload a file  */
+  /* written with full keys, and returns the same data for the   */
+  /* same BF pairs                                               */
+  /***************************************************************/
+  Log("Testing compact-key preload of a full-key file...");
+  unlink("FullKey.cache");
+  FIBBICache *FullCache=new FIBBICache();
+  GetTouchingPairData(FullCache, O, 0, NF);
+  int FullSize=FullCache->Size();
+  FullCache->StoreAs("FullKey.cache", true);
+
+  FIBBICache::CompactKeys=true;
+  GCache=new FIBBICache();
+  FIBBICache::CompactKeys=false;
+  int PreLoadStatus=GCache->PreLoad("FullKey.cache");
+  int CompactSize=GCache->Size();
+  int NumMismatched=0;
+  for(int nfa=0; nfa<NF; nfa++)
+   for(int nn=O->NeighborStart[nfa]; nn<O->NeighborStart[nfa+1]; nn++)
+    { int nfb=O->NeighborList[nn];
+      double FullData[FIBBIDATALEN], CompactData[FIBBIDATALEN];
+      FullCache->GetFIBBIData(O, nfa, O, nfb, FullData);
+      GCache->GetFIBBIData(O, nfa, O, nfb, CompactData);
+      if ( memcmp(FullData, CompactData, FIBBIDATALEN*sizeof(double)) )
+       NumMismatched++;
+    };
+  NumTests++;
+  if (    PreLoadStatus!=0 || CompactSize!=FullSize
+       || GCache->Misses!=0 || NumMismatched!=0
+     )
+   { Log(" compact keys: preload status %i, %i/%i records, %i misses, %i mismatched pairs",
+          PreLoadStatus,CompactSize,FullSize,GCache->Misses,NumMismatched);
+     NumFailed++;
+   };
+  delete GCache;
+  delete FullCache;
+
+  /***************************************************************/
+  /* trimming the cache brings its memory use within the budget  */
+  /* and spares the records that were looked up since they were  */
+  /* computed. each record is filled from one ordering of its BF */
+  /* pair only, and keys are only translation-invariant, so that */
+  /* no record is marked in use while the cache is being filled. */
+  /***************************************************************/
+  Log("Testing cache trim...");
+  FIBBICache::KeyTolerance=0.0;
+  GCache=new FIBBICache();
+  FIBBICache::KeyTolerance=1.0e-6;
+  for(int Hot=0; Hot<2; Hot++)
+   for(int nfa=0; nfa<NF; nfa+= (Hot ? 10 : 1) )
+    for(int nn=O->NeighborStart[nfa]; nn<O->NeighborStart[nfa+1]; nn++)
+     { double Data[FIBBIDATALEN];
+       if (O->NeighborList[nn]>=nfa)
+        GCache->GetFIBBIData(O, nfa, O, O->NeighborList[nn], Data);
+     };
+  size_t Bytes0=GCache->MemoryUsage(), MaxBytes=Bytes0/2;
+  int Size0=GCache->Size();
+  int NumEvicted=GCache->Trim(MaxBytes);
+  size_t Bytes1=GCache->MemoryUsage();
+  int Misses0=GCache->Misses;
+  for(int nfa=0; nfa<NF; nfa+=10)
+   for(int nn=O->NeighborStart[nfa]; nn<O->NeighborStart[nfa+1]; nn++)
+    { double Data[FIBBIDATALEN];
+      if (O->NeighborList[nn]>=nfa)
+       GCache->GetFIBBIData(O, nfa, O, O->NeighborList[nn], Data);
+    };
+  int HotMisses=GCache->Misses - Misses0;
+  Log(" trim: %lu -> %lu bytes (budget %lu), %i/%i records evicted, %i hot misses",
+        (unsigned long)Bytes0,(unsigned long)Bytes1,(unsigned long)MaxBytes,
+        NumEvicted,Size0,HotMisses);
+  NumTests++;
+  if (    Bytes1>MaxBytes || NumEvicted<=0
+       || GCache->Size()!=Size0-NumEvicted || HotMisses!=0
+     )
+   { Log(" trim: cache exceeds budget or evicted records in use");
+     NumFailed++;
+   };
+  delete GCache;
+
+  /***************************************************************/
+  /* with the default (canonical) keys, congruent BF pairs share */
+  /* records, so lookups during the fill mark records in use and */
+  /* hot records cannot be told apart from cold ones. here we    */
+  /* check only that the budget is met and that evicted records  */
+  /* are recomputed with the same data.                          */
+  /***************************************************************/
+  Log("Testing cache trim with canonical keys...");
+  GCache=new FIBBICache();
+  int NumPairs=O->NeighborStart[NF];
+  double *Before=new double[FIBBIDATALEN*NumPairs];
+  for(int nfa=0, np=0; nfa<NF; nfa++)
+   for(int nn=O->NeighborStart[nfa]; nn<O->NeighborStart[nfa+1]; nn++, np++)
+    GCache->GetFIBBIData(O, nfa, O, O->NeighborList[nn], Before + FIBBIDATALEN*np);
+  Bytes0=GCache->MemoryUsage();
+  MaxBytes=Bytes0/2;
+  Size0=GCache->Size();
+  NumEvicted=GCache->Trim(MaxBytes);
+  Bytes1=GCache->MemoryUsage();
+  int Size1b=GCache->Size();
+  Misses0=GCache->Misses;
+  double MaxRelDiff=0.0;
+  for(int nfa=0, np=0; nfa<NF; nfa++)
+   for(int nn=O->NeighborStart[nfa]; nn<O->NeighborStart[nfa+1]; nn++, np++)
+    { double After[FIBBIDATALEN], Norm=0.0, Diff=0.0;
+      GCache->GetFIBBIData(O, nfa, O, O->NeighborList[nn], After);
+      for(int n=0; n<FIBBIDATALEN; n++)
+       { Norm = fmax(Norm, fabs(Before[FIBBIDATALEN*np + n]));
+         Diff = fmax(Diff, fabs(After[n] - Before[FIBBIDATALEN*np + n]));
+       };
+      MaxRelDiff = fmax(MaxRelDiff, Diff/Norm);
+    };
+  Log(" canonical trim: %lu -> %lu bytes (budget %lu), %i/%i records evicted, %i recomputed, max rel diff %e",
+        (unsigned long)Bytes0,(unsigned long)Bytes1,(unsigned long)MaxBytes,
+        NumEvicted,Size0,GCache->Misses-Misses0,MaxRelDiff);
+  NumTests++;
+  if (    Bytes1>MaxBytes || NumEvicted<=0 || Size1b!=Size0-NumEvicted
+       || GCache->Misses==Misses0 || MaxRelDiff>1.0e-5
+     )
+   { Log(" canonical trim: cache exceeds budget or recomputed data differ");
+     NumFailed++;
+   };
+  delete[] Before;
+  delete GCache;
+
+  /***************************************************************/
+  /* remove the files written by the tests above                 */
+  /***************************************************************/
+  unlink(JFileName);
+  unlink(JournalName);
+  unlink("MergeA.cache");
+  unlink("MergeB.cache");
+  unlink("FullKey.cache");
+  unlink("Reflected.vmsh");
+
   Log("%i/%i tests passed.",NumTests-NumFailed,NumTests);
   return NumFailed;
 }
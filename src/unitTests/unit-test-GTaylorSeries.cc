@@ -0,0 +1,127 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * buff-test-GTaylorSeries.cc -- buff-em unit test comparing G-matrix
+ *                            -- blocks evaluated from their low-
+ *                            -- frequency series against direct
+ *                            -- assembly
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdarg.h>
+#include <fenv.h>
+
+#include "libbuff.h"
+
+using namespace scuff;
+using namespace buff;
+
+// direct assembly evaluates touching pairs from the cached
+// ik-expansion with relative error up to TouchingSeriesTolerance
+// (1e-6), so the two blocks are allowed to differ by a bit more
+#define GS_TOLERANCE 1.0e-5
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+  int NumTests=0, NumFailed=0;
+
+  /***************************************************************/
+  /***************************************************************/
+  /***************************************************************/
+  SetLogFileName("buff-test-GTaylorSeries.log");
+  Log("buff-test-GTaylorSeries running on %s",GetHostName());
+
+  SWGGeometry *G = new SWGGeometry("E10P1ISphere_48.buffgeo");
+  int NF = G->Objects[0]->NumInteriorFaces;
+  G->UseGSeries=false;
+
+  HMatrix *GSeries = new HMatrix(NF, NF, LHM_COMPLEX);
+  HMatrix *GDirect = new HMatrix(NF, NF, LHM_COMPLEX);
+
+  /***************************************************************/
+  /* at small kD the series block agrees with direct assembly    */
+  /***************************************************************/
+  GTaylorSeries *S = new GTaylorSeries(G, 0, 0, SWGGeometry::GSeriesOrder);
+  double OmegaList[] = {1.0e-3, 1.0e-2, 1.0e-1};
+  int NumOmegas = sizeof(OmegaList)/sizeof(OmegaList[0]);
+  for(int nw=0; nw<NumOmegas; nw++)
+   {
+     cdouble Omega = OmegaList[nw];
+     double ErrorEstimate;
+     NumTests++;
+     if ( !S->Evaluate(Omega, GSeries, 0, 0, &ErrorEstimate) )
+      { Log(" Omega=%g: series declined (error estimate %e)",
+             real(Omega),ErrorEstimate);
+        NumFailed++;
+        continue;
+      };
+     G->AssembleGBlock(0, 0, Omega, GDirect);
+
+     double MaxDiff=0.0, MaxEntry=0.0;
+     for(int nr=0; nr<NF; nr++)
+      for(int nc=0; nc<NF; nc++)
+       { MaxDiff  = fmax(MaxDiff, abs(GSeries->GetEntry(nr,nc)-GDirect->GetEntry(nr,nc)));
+         MaxEntry = fmax(MaxEntry, abs(GDirect->GetEntry(nr,nc)));
+       };
+     double RelDiff = MaxDiff/MaxEntry;
+     Log(" Omega=%g (kD=%g): error estimate %e, max relative difference %e",
+          real(Omega),real(Omega)*S->MaxSeparation,ErrorEstimate,RelDiff);
+     if ( !(RelDiff < GS_TOLERANCE) )
+      { Log(" Omega=%g: series block differs from direct block",real(Omega));
+        NumFailed++;
+      };
+   };
+  delete S;
+
+  /***************************************************************/
+  /* the series held by the geometry count towards the memory    */
+  /* budget and are freed by EndFrequencySweep()                 */
+  /***************************************************************/
+  double Budget = SWGGeometry::SweepMemoryBudget;
+  G->UseGSeries=true;
+  NumTests++;
+  if ( G->GetGSeries(0,0)==0 || G->SweepBytes==0 )
+   { Log(" series not retained within memory budget");
+     NumFailed++;
+   };
+  G->EndFrequencySweep();
+  NumTests++;
+  if ( G->GSeriesBlocks!=0 || G->SweepBytes!=0 )
+   { Log(" series not freed by EndFrequencySweep");
+     NumFailed++;
+   };
+  SWGGeometry::SweepMemoryBudget = 0.0;
+  NumTests++;
+  if ( G->GetGSeries(0,0)!=0 )
+   { Log(" series retained in excess of memory budget");
+     NumFailed++;
+   };
+  SWGGeometry::SweepMemoryBudget = Budget;
+
+  delete GSeries;
+  delete GDirect;
+  delete G;
+
+  Log("%i/%i tests passed.",NumTests-NumFailed,NumTests);
+  return NumFailed;
+}
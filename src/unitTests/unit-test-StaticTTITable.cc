@@ -0,0 +1,182 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * buff-test-StaticTTITable.cc -- buff-em unit test comparing FIBBI data
+ *                             -- computed with and without the table
+ *                             -- of static tet-pair integrals, for a
+ *                             -- mesh and a scaled, rotated copy of it
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdarg.h>
+#include <fenv.h>
+#include <unistd.h>
+
+#include "libbuff.h"
+
+using namespace scuff;
+using namespace buff;
+
+// scaling by a power of 2 is exact, so the copy differs from the
+// original only by the rounding of the rotated coordinates. the
+// table matches shapes whose normalized distances agree to 1e-9,
+// which bounds the agreement of looked-up and direct data.
+#define STTI_COPYSCALE 2.0
+#define STTI_TOLERANCE 1.0e-8
+
+/***************************************************************/
+/* write a copy of a gmsh tetrahedral mesh file with all       */
+/* vertex coordinates multiplied by Scale                      */
+/***************************************************************/
+void WriteScaledMesh(const char *InFileName, const char *OutFileName,
+                     double Scale)
+{
+  FILE *InFile=fopen(InFileName,"r");
+  FILE *OutFile=fopen(OutFileName,"w");
+  if (!InFile || !OutFile)
+   ErrExit("could not open mesh files %s, %s",InFileName,OutFileName);
+
+  char Line[MAXSTR];
+  bool InNodes=false;
+  while( fgets(Line,MAXSTR,InFile) )
+   {
+     if (!strncmp(Line,"$Nodes",6))    InNodes=true;
+     if (!strncmp(Line,"$EndNodes",9)) InNodes=false;
+
+     int n;
+     double X[3];
+     if ( InNodes && 4==sscanf(Line,"%i %le %le %le",&n,X+0,X+1,X+2) )
+      fprintf(OutFile,"%i %.17g %.17g %.17g\n",n,Scale*X[0],Scale*X[1],Scale*X[2]);
+     else
+      fputs(Line,OutFile);
+   };
+  fclose(InFile);
+  fclose(OutFile);
+}
+
+/***************************************************************/
+/* FIBBI data for all touching BF pairs of O; returns the      */
+/* number of pairs                                             */
+/***************************************************************/
+int GetTouchingFIBBIData(SWGVolume *O, double *Data)
+{
+  int NumPairs=0;
+  for(int nfa=0; nfa<O->NumInteriorFaces; nfa++)
+   for(int nn=O->NeighborStart[nfa]; nn<O->NeighborStart[nfa+1]; nn++)
+    ComputeFIBBIData(O, nfa, O, O->NeighborList[nn], Data + FIBBIDATALEN*(NumPairs++));
+  return NumPairs;
+}
+
+/***************************************************************/
+/* largest difference between two sets of FIBBI records, each  */
+/* relative to the largest entry of its record                 */
+/***************************************************************/
+double GetMaxRelDiff(double *Data1, double *Data2, int NumPairs)
+{
+  double MaxRelDiff=0.0;
+  for(int np=0; np<NumPairs; np++)
+   { double *D1=Data1 + FIBBIDATALEN*np, *D2=Data2 + FIBBIDATALEN*np;
+     double Norm=0.0, Diff=0.0;
+     for(int n=0; n<FIBBIDATALEN; n++)
+      { Norm = fmax(Norm, fabs(D2[n]));
+        Diff = fmax(Diff, fabs(D1[n]-D2[n]));
+      };
+     MaxRelDiff = fmax(MaxRelDiff, Diff/Norm);
+   };
+  return MaxRelDiff;
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+  int NumTests=0, NumFailed=0;
+
+  /***************************************************************/
+  /***************************************************************/
+  /***************************************************************/
+  SetLogFileName("buff-test-StaticTTITable.log");
+  Log("buff-test-StaticTTITable running on %s",GetHostName());
+
+  SWGGeometry *G = new SWGGeometry("E10P1ISphere_48.buffgeo");
+  SWGVolume *O = G->Objects[0];
+
+  // a fixed Taylor-Duffy rule, so that the direct data for
+  // congruent pairs are not subject to different adaptive
+  // subdivisions
+  SWGGeometry::TaylorDuffyOrder=12;
+
+  WriteScaledMesh(O->MeshFileName, "ScaledRotated.vmsh", STTI_COPYSCALE);
+  SWGVolume *OC = new SWGVolume((char *)"ScaledRotated.vmsh");
+  if (OC->ErrMsg)
+   ErrExit(OC->ErrMsg);
+  OC->Transform("ROTATED 37 ABOUT 1 2 3");
+
+  int NumPairs  = O->NeighborStart[O->NumInteriorFaces];
+  double *Direct     = new double[FIBBIDATALEN*NumPairs];
+  double *DirectCopy = new double[FIBBIDATALEN*NumPairs];
+  double *Table      = new double[FIBBIDATALEN*NumPairs];
+  double *TableCopy  = new double[FIBBIDATALEN*NumPairs];
+
+  /***************************************************************/
+  /* reference data with the table disabled                     */
+  /***************************************************************/
+  unsigned long TableSize = SWGGeometry::StaticTTITableSize;
+  SWGGeometry::StaticTTITableSize=0;
+  GetTouchingFIBBIData(O,  Direct);
+  GetTouchingFIBBIData(OC, DirectCopy);
+
+  /***************************************************************/
+  /* with the table enabled, pairs in the original that have the */
+  /* shape of an earlier pair are looked up, and every ncv=3,4   */
+  /* pair in the copy is looked up and rescaled from the entries */
+  /* for the original                                            */
+  /***************************************************************/
+  SWGGeometry::StaticTTITableSize=TableSize;
+  GetTouchingFIBBIData(O,  Table);
+  GetTouchingFIBBIData(OC, TableCopy);
+
+  double RelDiff = GetMaxRelDiff(Table, Direct, NumPairs);
+  Log(" original: %i pairs, max relative difference %e",NumPairs,RelDiff);
+  NumTests++;
+  if ( !(RelDiff < STTI_TOLERANCE) )
+   { Log(" original: table data differ from direct data");
+     NumFailed++;
+   };
+
+  RelDiff = GetMaxRelDiff(TableCopy, DirectCopy, NumPairs);
+  Log(" scaled, rotated copy: %i pairs, max relative difference %e",NumPairs,RelDiff);
+  NumTests++;
+  if ( !(RelDiff < STTI_TOLERANCE) )
+   { Log(" scaled, rotated copy: table data differ from direct data");
+     NumFailed++;
+   };
+
+  delete[] Direct;
+  delete[] DirectCopy;
+  delete[] Table;
+  delete[] TableCopy;
+  delete OC;
+  unlink("ScaledRotated.vmsh");
+
+  Log("%i/%i tests passed.",NumTests-NumFailed,NumTests);
+  return NumFailed;
+}
@@ -0,0 +1,170 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * buff-test-TTDGLOrders.cc -- buff-em unit test checking that the
+ *                          -- fixed-order Gauss-Legendre rules chosen
+ *                          -- by TTaylorDuffy for a given RelTol reach
+ *                          -- that accuracy
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdarg.h>
+#include <fenv.h>
+
+#include "libbuff.h"
+#include "TTaylorDuffy.h"
+
+using namespace scuff;
+using namespace buff;
+
+#define MAXPAIRS 4
+#define NUMPKS   10
+
+// the reference integrals are computed by adaptive cubature to
+// a relative tolerance well below those tested
+#define REF_RELTOL 1.0e-9
+#define REF_MAXEVAL 10000000
+
+/***************************************************************/
+/* find up to MaxPairs pairs of tetrahedra in O with ncv       */
+/* common vertices; returns the number found                   */
+/***************************************************************/
+int FindTetPairs(SWGVolume *O, int ncv, int MaxPairs,
+                 int OVIA[][4], int OVIB[][4])
+{
+  int NumPairs=0;
+  for(int ntA=0; ntA<O->NumTets && NumPairs<MaxPairs; ntA++)
+   for(int ntB=ntA; ntB<O->NumTets && NumPairs<MaxPairs; ntB++)
+    if ( CompareTets(O, ntA, O, ntB)==ncv )
+     { CompareTets(O, ntA, O, ntB, OVIA[NumPairs], OVIB[NumPairs]);
+       NumPairs++;
+     };
+  return NumPairs;
+}
+
+/***************************************************************/
+/* the static (r^{-1}, r^0, r^1) and Helmholtz (kL=0.5, 2)     */
+/* integrals of the unity and b.b' polynomials for one pair,   */
+/* with L the length of the edge V1-V2                         */
+/***************************************************************/
+void GetTTDIntegrals(SWGVolume *O, int OVIA[4], int OVIB[4], int ncv,
+                     double RelTol, int CubaturePoints, cdouble *Result)
+{
+  double *V = O->Vertices;
+  double L  = VecDistance(V + 3*OVIA[0], V + 3*OVIA[1]);
+
+  int PIndex[NUMPKS], KIndex[NUMPKS];
+  cdouble KParam[NUMPKS], Error[NUMPKS];
+  double rPowers[3] = {-1.0, 0.0, 1.0};
+  double kLs[2]     = {0.5, 2.0};
+  int npk=0;
+  for(int n=0; n<3; n++, npk+=2)
+   { PIndex[npk+0]=TTD_UNITY;  KIndex[npk+0]=TTD_RP; KParam[npk+0]=rPowers[n];
+     PIndex[npk+1]=TTD_BDOTBP; KIndex[npk+1]=TTD_RP; KParam[npk+1]=rPowers[n];
+   };
+  for(int n=0; n<2; n++, npk+=2)
+   { PIndex[npk+0]=TTD_UNITY;  KIndex[npk+0]=TTD_HELMHOLTZ; KParam[npk+0]=kLs[n]/L;
+     PIndex[npk+1]=TTD_BDOTBP; KIndex[npk+1]=TTD_HELMHOLTZ; KParam[npk+1]=kLs[n]/L;
+   };
+
+  TTDArgStruct MyArgs, *Args=&MyArgs;
+  InitTTDArgs(Args);
+  Args->WhichCase = ncv;
+  Args->NumPKs    = NUMPKS;
+  Args->PIndex    = PIndex;
+  Args->KIndex    = KIndex;
+  Args->KParam    = KParam;
+  Args->V1        = V + 3*OVIA[0];
+  Args->V2 = Args->V2P = V + 3*OVIA[1];
+  Args->V3 = Args->V3P = V + 3*OVIA[2];
+  Args->V4 = Args->V4P = V + 3*OVIA[3];
+  if (ncv<4) Args->V4P = V + 3*OVIB[3];
+  if (ncv<3) Args->V3P = V + 3*OVIB[2];
+  Args->Q         = V + 3*OVIA[3];
+  Args->QP        = V + 3*OVIB[3];
+  Args->Result    = Result;
+  Args->Error     = Error;
+  Args->RelTol    = RelTol;
+  Args->MaxEval   = REF_MAXEVAL;
+  Args->CubaturePoints = CubaturePoints;
+  TTaylorDuffy(Args);
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+  int NumTests=0, NumFailed=0;
+
+  /***************************************************************/
+  /***************************************************************/
+  /***************************************************************/
+  SetLogFileName("buff-test-TTDGLOrders.log");
+  Log("buff-test-TTDGLOrders running on %s",GetHostName());
+
+  SWGGeometry *G = new SWGGeometry("E10P1ISphere_48.buffgeo");
+  SWGVolume *O = G->Objects[0];
+
+  const char *CaseNames[5]={0, 0, "common edge", "common triangle", "common tet"};
+  double RelTols[2]={1.0e-4, 1.0e-6};
+  for(int ncv=TTD_COMMONEDGE; ncv<=TTD_COMMONTET; ncv++)
+   {
+     int OVIA[MAXPAIRS][4], OVIB[MAXPAIRS][4];
+     int NumPairs=FindTetPairs(O, ncv, MAXPAIRS, OVIA, OVIB);
+     if (NumPairs==0)
+      ErrExit("mesh has no tet pairs with %i common vertices",ncv);
+
+     for(int np=0; np<NumPairs; np++)
+      {
+        cdouble Ref[NUMPKS];
+        GetTTDIntegrals(O, OVIA[np], OVIB[np], ncv, REF_RELTOL, 0, Ref);
+
+        for(int nt=0; nt<2; nt++)
+         {
+           cdouble GL[NUMPKS];
+           GetTTDIntegrals(O, OVIA[np], OVIB[np], ncv, RelTols[nt],
+                           TTD_AUTOORDER, GL);
+
+           // the b.b' integrals may be small through cancellation,
+           // so errors are measured against the larger of the two
+           // integrals with the same kernel
+           double MaxRelErr=0.0;
+           for(int npk=0; npk<NUMPKS; npk++)
+            { double Scale = fmax(abs(Ref[2*(npk/2)]), abs(Ref[2*(npk/2)+1]));
+              MaxRelErr = fmax(MaxRelErr, abs(GL[npk]-Ref[npk])/Scale);
+            };
+           Log(" %s pair %i, RelTol %.0e (%i points): max relative error %e",
+                CaseNames[ncv],np,RelTols[nt],
+                GetTTDGLOrder(ncv, RelTols[nt]),MaxRelErr);
+
+           NumTests++;
+           if ( !(MaxRelErr < RelTols[nt]) )
+            { Log(" %s pair %i: error %e exceeds RelTol %e",
+                   CaseNames[ncv],np,MaxRelErr,RelTols[nt]);
+              NumFailed++;
+            };
+         };
+      };
+   };
+
+  Log("%i/%i tests passed.",NumTests-NumFailed,NumTests);
+  return NumFailed;
+}
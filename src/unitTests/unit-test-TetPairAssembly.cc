@@ -0,0 +1,112 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * buff-test-TetPairAssembly.cc -- buff-em unit test comparing G-matrix
+ *                              -- blocks assembled by looping over
+ *                              -- tetrahedron pairs against the
+ *                              -- BF-pair loop
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdarg.h>
+#include <fenv.h>
+
+#include "libbuff.h"
+
+using namespace scuff;
+using namespace buff;
+
+// with the default quadrature policy both assemblies use the same
+// 4-point rule, so they differ only in the order of summation
+#define TPA_TOLERANCE 1.0e-10
+
+/***************************************************************/
+/* assemble the (noa,nob) G block by tet pairs and compare it  */
+/* entry by entry against GetGMatrixElement; returns the       */
+/* largest difference relative to the largest entry            */
+/***************************************************************/
+double CompareGBlocks(SWGGeometry *G, int noa, int nob, cdouble Omega,
+                      int StorageType, FIBBICache *GCache)
+{
+  SWGVolume *OA = G->Objects[noa], *OB = G->Objects[nob];
+  int NFA = OA->NumInteriorFaces, NFB = OB->NumInteriorFaces;
+
+  HMatrix *GTP = new HMatrix(NFA, NFB, LHM_COMPLEX, StorageType);
+  G->AssembleGBlockByTetPairs(noa, nob, Omega, GTP, 0, 0, GCache);
+
+  double MaxDiff=0.0, MaxEntry=0.0;
+  for(int nfa=0; nfa<NFA; nfa++)
+   for(int nfb=0; nfb<NFB; nfb++)
+    { cdouble GRef=GetGMatrixElement(OA, nfa, OB, nfb, Omega, GCache);
+      MaxDiff  = fmax(MaxDiff,  abs(GTP->GetEntry(nfa,nfb) - GRef));
+      MaxEntry = fmax(MaxEntry, abs(GRef));
+    };
+
+  delete GTP;
+  return MaxDiff / MaxEntry;
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+  int NumTests=0, NumFailed=0;
+
+  /***************************************************************/
+  /***************************************************************/
+  /***************************************************************/
+  SetLogFileName("buff-test-TetPairAssembly.log");
+  Log("buff-test-TetPairAssembly running on %s",GetHostName());
+
+  SWGGeometry *G = new SWGGeometry("E10SphereDimer_48.buffgeo");
+  cdouble Omega  = 1.0;
+
+  /***************************************************************/
+  /* self block with and without a FIBBI cache, in full and      */
+  /* packed symmetric storage, and the block coupling the two    */
+  /* spheres (for which there is no cache)                       */
+  /***************************************************************/
+  struct { int noa, nob, StorageType; bool UseCache; const char *Name; }
+   Cases[] =
+   { {0, 0, LHM_NORMAL,    false, "self block, no cache, full storage"},
+     {0, 0, LHM_NORMAL,    true,  "self block, cache, full storage"},
+     {0, 0, LHM_SYMMETRIC, false, "self block, no cache, packed storage"},
+     {0, 0, LHM_SYMMETRIC, true,  "self block, cache, packed storage"},
+     {0, 1, LHM_NORMAL,    false, "distinct objects, full storage"}
+   };
+  int NumCases = sizeof(Cases)/sizeof(Cases[0]);
+
+  for(int nc=0; nc<NumCases; nc++)
+   {
+     FIBBICache *GCache = Cases[nc].UseCache ? G->GetGCache(0,0) : 0;
+     double RelDiff = CompareGBlocks(G, Cases[nc].noa, Cases[nc].nob, Omega,
+                                     Cases[nc].StorageType, GCache);
+     Log(" %s: max relative difference %e",Cases[nc].Name,RelDiff);
+     NumTests++;
+     if ( !(RelDiff < TPA_TOLERANCE) )
+      { Log(" %s: tet-pair block differs from BF-pair block",Cases[nc].Name);
+        NumFailed++;
+      };
+   };
+
+  Log("%i/%i tests passed.",NumTests-NumFailed,NumTests);
+  return NumFailed;
+}
@@ -0,0 +1,114 @@
+/* Copyright (C) 2005-2011 M. T. Homer Reid
+ *
+ * This file is part of BUFF-EM.
+ *
+ * BUFF-EM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * BUFF-EM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * buff-test-TouchingSeries.cc -- buff-em unit test comparing G-matrix
+ *                             -- elements of touching BF pairs computed
+ *                             -- from the cached ik-expansion against
+ *                             -- the cubature path
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdarg.h>
+#include <fenv.h>
+
+#include "libbuff.h"
+
+using namespace scuff;
+using namespace buff;
+
+#define TS_TOLERANCE 1.0e-6
+
+/***************************************************************/
+/* G-matrix elements of all touching BF pairs of O, computed   */
+/* with the given touching-series tolerance                    */
+/***************************************************************/
+void GetTouchingElements(SWGVolume *O, cdouble Omega, FIBBICache *GCache,
+                         double Tolerance, cdouble *GME)
+{
+  SWGGeometry::TouchingSeriesTolerance = Tolerance;
+  int np=0;
+  for(int nfa=0; nfa<O->NumInteriorFaces; nfa++)
+   for(int nn=O->NeighborStart[nfa]; nn<O->NeighborStart[nfa+1]; nn++)
+    GME[np++] = GetGMatrixElement(O, nfa, O, O->NeighborList[nn], Omega, GCache);
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+  int NumTests=0, NumFailed=0;
+
+  /***************************************************************/
+  /***************************************************************/
+  /***************************************************************/
+  SetLogFileName("buff-test-TouchingSeries.log");
+  Log("buff-test-TouchingSeries running on %s",GetHostName());
+
+  SWGGeometry *G = new SWGGeometry("E10P1ISphere_48.buffgeo");
+  SWGVolume *O = G->Objects[0];
+  FIBBICache *GCache = G->GetGCache(0,0);
+
+  // the cubature path evaluates the n>=3 terms with the rule
+  // chosen by the quadrature policy; ask for the most accurate
+  // rule so that its error does not mask the truncation error
+  SWGGeometry::QuadraturePolicy.SetTolerance(1.0e-10);
+
+  int NumPairs = O->NeighborStart[O->NumInteriorFaces];
+  cdouble *GSeries   = new cdouble[NumPairs];
+  cdouble *GCubature = new cdouble[NumPairs];
+
+  /***************************************************************/
+  /* the series is used at the lower frequencies and the test    */
+  /* then checks the truncation bound; at the higher ones no     */
+  /* order qualifies and the two paths must agree exactly        */
+  /***************************************************************/
+  double OmegaList[] = {1.0e-3, 1.0e-2, 3.0e-2, 1.0e-1, 3.0e-1, 1.0, 3.0};
+  int NumOmegas = sizeof(OmegaList)/sizeof(OmegaList[0]);
+  for(int nw=0; nw<NumOmegas; nw++)
+   {
+     cdouble Omega = OmegaList[nw];
+     GetTouchingElements(O, Omega, GCache, TS_TOLERANCE, GSeries);
+     GetTouchingElements(O, Omega, GCache, 0.0,          GCubature);
+
+     // the truncation bound is relative to the n=0 term, so the
+     // difference is measured against the largest element
+     double MaxDiff=0.0, MaxEntry=0.0;
+     for(int np=0; np<NumPairs; np++)
+      { MaxDiff  = fmax(MaxDiff,  abs(GSeries[np] - GCubature[np]));
+        MaxEntry = fmax(MaxEntry, abs(GCubature[np]));
+      };
+     double RelDiff = MaxDiff / MaxEntry;
+     Log(" Omega=%g: max relative difference %e",real(Omega),RelDiff);
+
+     NumTests++;
+     if ( !(RelDiff < TS_TOLERANCE) )
+      { Log(" Omega=%g: series differs from cubature by %e (tolerance %e)",
+             real(Omega),RelDiff,TS_TOLERANCE);
+        NumFailed++;
+      };
+   };
+
+  delete[] GSeries;
+  delete[] GCubature;
+
+  Log("%i/%i tests passed.",NumTests-NumFailed,NumTests);
+  return NumFailed;
+}